@@ -0,0 +1,741 @@
+/* Copyright (C) 2014 DiUS Computing Pty. Ltd.   See LICENSE file. */
+
+#include "backend_bench.h"
+#include <string.h>
+#include <stdlib.h>
+
+// The bench backend writes a stand-alone program which fills an instance of
+// each requested type with synthetic data, and times storing and loading it
+// with each of the other backends selected. The data follows the model:
+// varlen arrays agree with their size members, zero terminated arrays are
+// terminated, and pointers are sometimes null. Nesting through pointers and
+// arrays is cut off at CSER_BENCH_DEPTH, so recursive types stay finite.
+
+
+static bool is_composite (const char *base_type)
+{
+  const type_t *t = lookup_type (base_type);
+  return t && t->csfn == TYPE_COMPOSITE;
+}
+
+
+static bool is_char_native (const char *base_type)
+{
+  const type_t *t = lookup_type (base_type);
+  return t && t->csfn == TYPE_NATIVE && strstr (t->type_name, "char");
+}
+
+
+// Whether a member gives the size of a varlen array in the same struct
+static bool is_size_member (const type_t *type, const member_t *m)
+{
+  for (const member_t *a = type->composite; a; a = a->next)
+    if (a->opts.cardinality == CDN_VAR_ARRAY &&
+        strcmp (a->opts.variable_array_size_member, m->member_name) == 0)
+      return true;
+  return false;
+}
+
+
+// Whether filling a struct depends on how deeply it is nested
+static bool uses_depth (const type_t *type)
+{
+  if (list_link (type))
+    return true;
+  for (const member_t *m = type->composite; m; m = m->next)
+    if (m->opts.is_ptr || is_composite (m->base_type) || is_size_member (type, m))
+      return true;
+  return false;
+}
+
+
+static void write_bench_support (const char *header, unsigned backends, FILE *fb)
+{
+  fprintf (fb,
+"#include \"%s\"\n"
+"#include <errno.h>\n"
+"#include <stdio.h>\n"
+"#include <time.h>\n"
+"\n"
+"/* Average length of varlen and zero terminated arrays and strings */\n"
+"#ifndef CSER_BENCH_LEN\n"
+"# define CSER_BENCH_LEN 16\n"
+"#endif\n"
+"/* Nesting through pointers and arrays beyond this is left empty */\n"
+"#ifndef CSER_BENCH_DEPTH\n"
+"# define CSER_BENCH_DEPTH 4\n"
+"#endif\n"
+"/* Minimum time spent on each measurement */\n"
+"#ifndef CSER_BENCH_NS\n"
+"# define CSER_BENCH_NS 100000000\n"
+"#endif\n"
+"#ifndef CSER_BENCH_SEED\n"
+"# define CSER_BENCH_SEED 1\n"
+"#endif\n"
+"/* Copies loaded in place are this far apart, and take up this much */\n"
+"#ifndef CSER_BENCH_ALIGN\n"
+"# define CSER_BENCH_ALIGN 64\n"
+"#endif\n"
+"#ifndef CSER_BENCH_WORK\n"
+"# define CSER_BENCH_WORK (1u << 20)\n"
+"#endif\n"
+"/* Whether calls to the C library heap are counted, by wrapping glibc's */\n"
+"#ifndef CSER_BENCH_HEAP\n"
+"# ifdef __GLIBC__\n"
+"#  define CSER_BENCH_HEAP 1\n"
+"# else\n"
+"#  define CSER_BENCH_HEAP 0\n"
+"# endif\n"
+"#endif\n"
+"\n"
+"typedef struct cser_bench\n"
+"{\n"
+"  uint64_t seed;\n"
+"  cser_arena_t arena; /* holds all of the synthetic data */\n"
+"} cser_bench_t;\n"
+"\n"
+"/* xorshift64*, so that runs are repeatable across C libraries */\n"
+"static inline uint64_t cser_bench_next (cser_bench_t *b)\n"
+"{\n"
+"  b->seed ^= b->seed >> 12;\n"
+"  b->seed ^= b->seed << 25;\n"
+"  b->seed ^= b->seed >> 27;\n"
+"  return b->seed * 0x2545f4914f6cdd1dull;\n"
+"}\n"
+"\n"
+"static inline void *cser_bench_alloc (cser_bench_t *b, size_t n, size_t size)\n"
+"{\n"
+"  void *ptr = (size && n > SIZE_MAX / size) ? 0 : cser_arena_zalloc (n * size, &b->arena);\n"
+"  if (!ptr)\n"
+"  {\n"
+"    fputs (\"error: out of memory\\n\", stderr);\n"
+"    exit (1);\n"
+"  }\n"
+"  return ptr;\n"
+"}\n"
+"\n"
+"/* Pointers are left null one time in four, and past the depth limit */\n"
+"static inline bool cser_bench_present (cser_bench_t *b, unsigned depth)\n"
+"{\n"
+"  return depth < CSER_BENCH_DEPTH && cser_bench_next (b) %% 4;\n"
+"}\n"
+"\n"
+"static inline size_t cser_bench_count (cser_bench_t *b, unsigned depth)\n"
+"{\n"
+"  return depth < CSER_BENCH_DEPTH ? cser_bench_next (b) %% (2 * CSER_BENCH_LEN + 1) : 0;\n"
+"}\n"
+"\n"
+"static inline char *cser_bench_string (cser_bench_t *b, unsigned depth)\n"
+"{\n"
+"  size_t n = cser_bench_count (b, depth);\n"
+"  char *str = cser_bench_alloc (b, n + 1, 1);\n"
+"  for (size_t i = 0; i < n; ++i)\n"
+"    str[i] = 'a' + cser_bench_next (b) %% 26;\n"
+"  return str;\n"
+"}\n"
+"\n"
+"/* Serialized data lives in mem; work holds slots copies of it, stride */\n"
+"/* bytes apart, for in-place loads, and slot is the one to load next.   */\n"
+"typedef struct cser_bench_io\n"
+"{\n"
+"  uint8_t *mem;\n"
+"  size_t len;\n"
+"  size_t pos;\n"
+"  size_t cap;\n"
+"  uint8_t *work;\n"
+"  size_t stride;\n"
+"  size_t slots;\n"
+"  size_t slot;\n"
+"  cser_arena_t arena; /* for loaded data, reset after each load */\n"
+"  cser_alloc_t alloc; /* the arena, counting allocations */\n"
+"  size_t allocs;\n"
+"  char tag[256];\n"
+"} cser_bench_io_t;\n"
+"\n"
+"typedef int (*cser_bench_store_fn) (const void *val, cser_bench_io_t *io);\n"
+"typedef int (*cser_bench_load_fn) (void *val, cser_bench_io_t *io);\n"
+"\n"
+"static inline bool cser_bench_reserve (cser_bench_io_t *io, size_t n)\n"
+"{\n"
+"  if (n <= io->cap - io->len)\n"
+"    return true;\n"
+"  size_t cap = io->cap ? io->cap : 4096;\n"
+"  while (cap - io->len < n)\n"
+"    cap *= 2;\n"
+"  uint8_t *mem = realloc (io->mem, cap);\n"
+"  if (!mem)\n"
+"    return false;\n"
+"  io->mem = mem;\n"
+"  io->cap = cap;\n"
+"  return true;\n"
+"}\n"
+"\n"
+"static inline int cser_bench_write (const uint8_t *bytes, size_t n, void *q)\n"
+"{\n"
+"  cser_bench_io_t *io = q;\n"
+"  if (!cser_bench_reserve (io, n))\n"
+"    return -ENOMEM;\n"
+"  memcpy (io->mem + io->len, bytes, n);\n"
+"  io->len += n;\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"static inline int cser_bench_read (uint8_t *bytes, size_t n, void *q)\n"
+"{\n"
+"  cser_bench_io_t *io = q;\n"
+"  if (n > io->len - io->pos)\n"
+"    return -ENODATA;\n"
+"  memcpy (bytes, io->mem + io->pos, n);\n"
+"  io->pos += n;\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"static void *cser_bench_zalloc (size_t size, void *ctx)\n"
+"{\n"
+"  cser_bench_io_t *io = ctx;\n"
+"  ++io->allocs;\n"
+"  return cser_arena_zalloc (size, &io->arena);\n"
+"}\n"
+"\n"
+"static void *cser_bench_resize (void *ptr, size_t old_size, size_t size, void *ctx)\n"
+"{\n"
+"  cser_bench_io_t *io = ctx;\n"
+"  ++io->allocs;\n"
+"  return cser_arena_resize (ptr, old_size, size, &io->arena);\n"
+"}\n"
+"\n"
+"static void cser_bench_release (void *ptr, size_t size, void *ctx)\n"
+"{\n"
+"  cser_bench_io_t *io = ctx;\n"
+"  cser_arena_release (ptr, size, &io->arena);\n"
+"}\n"
+"\n"
+"#if CSER_BENCH_HEAP\n"
+"/* Every malloc, calloc and realloc, be it by the generated code, the */\n"
+"/* glue, an arena or the C library itself, is counted on its way.     */\n"
+"static size_t cser_bench_heap;\n"
+"extern void *__libc_malloc (size_t size);\n"
+"extern void *__libc_calloc (size_t n, size_t size);\n"
+"extern void *__libc_realloc (void *ptr, size_t size);\n"
+"\n"
+"void *malloc (size_t size)\n"
+"{\n"
+"  __atomic_add_fetch (&cser_bench_heap, 1, __ATOMIC_RELAXED);\n"
+"  return __libc_malloc (size);\n"
+"}\n"
+"\n"
+"void *calloc (size_t n, size_t size)\n"
+"{\n"
+"  __atomic_add_fetch (&cser_bench_heap, 1, __ATOMIC_RELAXED);\n"
+"  return __libc_calloc (n, size);\n"
+"}\n"
+"\n"
+"void *realloc (void *ptr, size_t size)\n"
+"{\n"
+"  __atomic_add_fetch (&cser_bench_heap, 1, __ATOMIC_RELAXED);\n"
+"  return __libc_realloc (ptr, size);\n"
+"}\n"
+"#endif\n"
+"\n"
+"static inline size_t cser_bench_heap_calls (void)\n"
+"{\n"
+"#if CSER_BENCH_HEAP\n"
+"  return __atomic_load_n (&cser_bench_heap, __ATOMIC_RELAXED);\n"
+"#else\n"
+"  return 0;\n"
+"#endif\n"
+"}\n"
+"\n"
+"/* Refills the copies for in-place loads, outside the timed region */\n"
+"static void cser_bench_copy (cser_bench_io_t *io)\n"
+"{\n"
+"  for (size_t k = 0; k < io->slots; ++k)\n"
+"    memcpy (io->work + k * io->stride, io->mem, io->len);\n"
+"}\n"
+"\n"
+"static double cser_bench_now (void)\n"
+"{\n"
+"  struct timespec ts;\n"
+"  clock_gettime (CLOCK_MONOTONIC, &ts);\n"
+"  return ts.tv_sec * 1e9 + ts.tv_nsec;\n"
+"}\n"
+"\n"
+"/* Allocations are seen through the allocator, which only loads use, and */\n"
+"/* with CSER_BENCH_HEAP through the C library heap too. Otherwise stores  */\n"
+"/* have no figure for them.                                               */\n"
+"static void cser_bench_result (const char *op, double ns, size_t ops, size_t bytes, const size_t *allocs, bool last)\n"
+"{\n"
+"  printf (\"      \\\"%%s\\\": { \\\"ns_per_op\\\": %%.1f, \\\"bytes_per_op\\\": %%zu, \\\"mb_per_s\\\": %%.1f, \",\n"
+"    op, ns / ops, bytes, bytes * ops * 1e3 / ns);\n"
+"  if (allocs)\n"
+"    printf (\"\\\"allocs_per_op\\\": %%.1f, \", (double)*allocs / ops);\n"
+"  printf (\"\\\"ops\\\": %%zu }%%s\\n\", ops, last ? \"\" : \",\");\n"
+"}\n"
+"\n"
+"/* Stores and loads val over and over, doubling the number of operations */\n"
+"/* until they take at least CSER_BENCH_NS. Loads start from a zeroed     */\n"
+"/* value each time, and include setting up and tearing down the arena.  */\n"
+"/* In-place loads get a fresh copy each time, made a batch at a time    */\n"
+"/* with the clock stopped. The first load is checked by storing it again.*/\n"
+"static int cser_bench_run (const char *type, const char *backend, const void *val, size_t size, cser_bench_store_fn store, cser_bench_load_fn load, bool in_place, bool *first)\n"
+"{\n"
+"  cser_bench_io_t io, check;\n"
+"  memset (&io, 0, sizeof (io));\n"
+"  memset (&check, 0, sizeof (check));\n"
+"  const cser_alloc_t alloc = { cser_bench_zalloc, cser_bench_resize, cser_bench_release, &io };\n"
+"  io.alloc = alloc;\n"
+"  void *tmp = calloc (1, size);\n"
+"  printf (\"%%s\\n    { \\\"type\\\": \\\"%%s\\\", \\\"backend\\\": \\\"%%s\\\",\\n\", *first ? \"\" : \",\", type, backend);\n"
+"  *first = false;\n"
+"  int ret = tmp ? store (val, &io) : -ENOMEM;\n"
+"  if (!ret && in_place)\n"
+"  {\n"
+"    void *work;\n"
+"    io.stride = ((io.len ? io.len : 1) + CSER_BENCH_ALIGN - 1) / CSER_BENCH_ALIGN * CSER_BENCH_ALIGN;\n"
+"    io.slots = io.stride < CSER_BENCH_WORK ? CSER_BENCH_WORK / io.stride : 1;\n"
+"    if (posix_memalign (&work, CSER_BENCH_ALIGN, io.slots * io.stride) != 0)\n"
+"      ret = -ENOMEM;\n"
+"    else\n"
+"      io.work = work;\n"
+"  }\n"
+"  if (!ret)\n"
+"  {\n"
+"    cser_bench_copy (&io);\n"
+"    cser_arena_init (&io.arena, 0);\n"
+"    ret = load (tmp, &io);\n"
+"    if (!ret)\n"
+"      ret = store (tmp, &check);\n"
+"    if (!ret && (check.len != io.len || memcmp (check.mem, io.mem, io.len) != 0))\n"
+"      ret = -EILSEQ;\n"
+"    cser_arena_destroy (&io.arena);\n"
+"  }\n"
+"\n"
+"  size_t ops = 1, bytes = io.len, allocs = 0;\n"
+"  double ns = 0;\n"
+"  while (!ret)\n"
+"  {\n"
+"    size_t heap = cser_bench_heap_calls ();\n"
+"    double start = cser_bench_now ();\n"
+"    for (size_t i = 0; i < ops && !ret; ++i)\n"
+"    {\n"
+"      io.len = 0;\n"
+"      ret = store (val, &io);\n"
+"    }\n"
+"    ns = cser_bench_now () - start;\n"
+"    allocs = cser_bench_heap_calls () - heap;\n"
+"    if (ns >= CSER_BENCH_NS)\n"
+"      break;\n"
+"    ops *= 2;\n"
+"  }\n"
+"  if (!ret)\n"
+"    cser_bench_result (\"store\", ns, ops, bytes, CSER_BENCH_HEAP ? &allocs : 0, false);\n"
+"\n"
+"  ops = 1;\n"
+"  while (!ret)\n"
+"  {\n"
+"    io.allocs = 0;\n"
+"    size_t heap = cser_bench_heap_calls ();\n"
+"    ns = 0;\n"
+"    double start = cser_bench_now ();\n"
+"    for (size_t i = 0; i < ops && !ret; ++i)\n"
+"    {\n"
+"      if (io.slots && (io.slot = i %% io.slots) == 0)\n"
+"      {\n"
+"        ns += cser_bench_now () - start;\n"
+"        cser_bench_copy (&io);\n"
+"        start = cser_bench_now ();\n"
+"      }\n"
+"      io.pos = 0;\n"
+"      memset (tmp, 0, size);\n"
+"      cser_arena_init (&io.arena, 0);\n"
+"      ret = load (tmp, &io);\n"
+"      cser_arena_destroy (&io.arena);\n"
+"    }\n"
+"    ns += cser_bench_now () - start;\n"
+"    allocs = io.allocs + cser_bench_heap_calls () - heap;\n"
+"    if (ns >= CSER_BENCH_NS)\n"
+"      break;\n"
+"    ops *= 2;\n"
+"  }\n"
+"  if (!ret)\n"
+"    cser_bench_result (\"load\", ns, ops, bytes, &allocs, true);\n"
+"  else\n"
+"    printf (\"      \\\"error\\\": %%d\\n\", ret);\n"
+"  printf (\"    }\");\n"
+"\n"
+"  free (io.mem);\n"
+"  free (io.work);\n"
+"  free (check.mem);\n"
+"  free (tmp);\n"
+"  return ret;\n"
+"}\n"
+"\n",
+    header);
+
+  // In-memory glue for the XML backend. Values are written unescaped, which
+  // is fine for numbers and the synthetic strings.
+  if (backends & BACKEND_XML)
+    fputs (
+"static inline bool cser_bench_puts (const char *str, cser_bench_io_t *io)\n"
+"{\n"
+"  return cser_bench_write ((const uint8_t *)str, strlen (str), io) == 0;\n"
+"}\n"
+"\n"
+"bool cser_xml_opentag (const cser_xml_tag_t *tag, void *ctx)\n"
+"{\n"
+"  return\n"
+"    cser_bench_puts (\"<\", ctx) &&\n"
+"    cser_bench_puts (tag->name, ctx) &&\n"
+"    cser_bench_puts (tag->has_value ? \">\" : \" null=\\\"true\\\">\", ctx);\n"
+"}\n"
+"\n"
+"bool cser_xml_setvalue (const char *value, void *ctx)\n"
+"{\n"
+"  return cser_bench_puts (value, ctx);\n"
+"}\n"
+"\n"
+"bool cser_xml_closetag (const char *tagname, void *ctx)\n"
+"{\n"
+"  return\n"
+"    cser_bench_puts (\"</\", ctx) &&\n"
+"    cser_bench_puts (tagname, ctx) &&\n"
+"    cser_bench_puts (\">\", ctx);\n"
+"}\n"
+"\n"
+"/* Skips closing tags, which the loaders do not ask for */\n"
+"bool cser_xml_nexttag (cser_xml_tag_t *tag, void *ctx)\n"
+"{\n"
+"  cser_bench_io_t *io = ctx;\n"
+"  const char *p = (const char *)io->mem + io->pos;\n"
+"  const char *end = (const char *)io->mem + io->len;\n"
+"  for (;;)\n"
+"  {\n"
+"    if (p == end || *p != '<')\n"
+"      return false;\n"
+"    const char *close = memchr (p, '>', end - p);\n"
+"    if (!close)\n"
+"      return false;\n"
+"    if (p[1] != '/')\n"
+"    {\n"
+"      size_t n = strcspn (p + 1, \" >\");\n"
+"      if (n >= sizeof (io->tag))\n"
+"        return false;\n"
+"      memcpy (io->tag, p + 1, n);\n"
+"      io->tag[n] = 0;\n"
+"      tag->name = io->tag;\n"
+"      tag->has_value = (p[1 + n] == '>');\n"
+"      io->pos = close + 1 - (const char *)io->mem;\n"
+"      return true;\n"
+"    }\n"
+"    p = close + 1;\n"
+"  }\n"
+"}\n"
+"\n"
+"char *cser_xml_getvalue (void *ctx)\n"
+"{\n"
+"  cser_bench_io_t *io = ctx;\n"
+"  const char *p = (const char *)io->mem + io->pos;\n"
+"  const char *lt = memchr (p, '<', io->len - io->pos);\n"
+"  size_t n = lt ? (size_t)(lt - p) : io->len - io->pos;\n"
+"  char *str = malloc (n + 1);\n"
+"  if (!str)\n"
+"    return 0;\n"
+"#if !CSER_BENCH_HEAP\n"
+"  ++io->allocs;\n"
+"#endif\n"
+"  memcpy (str, p, n);\n"
+"  str[n] = 0;\n"
+"  io->pos += n;\n"
+"  return str;\n"
+"}\n"
+"\n"
+"const cser_alloc_t *cser_xml_allocator (void *ctx)\n"
+"{\n"
+"  cser_bench_io_t *io = ctx;\n"
+"  return &io->alloc;\n"
+"}\n"
+"\n"
+    , fb);
+}
+
+
+static void write_fill_item (const member_t *m, const char *lhs, const char *depth, const char *indent, FILE *fb)
+{
+  if (is_composite (m->base_type))
+  {
+    char *utype = make_cname (m->base_type);
+    fprintf (fb, "%scser_bench_fill_%s (&%s, b, %s);\n", indent, utype, lhs, depth);
+    free (utype);
+  }
+  else
+    fprintf (fb, "%s%s = (%s)cser_bench_next (b);\n", indent, lhs, m->base_type);
+}
+
+
+static void write_fill_pointer (const member_t *m, const char *lhs, const char *indent, FILE *fb)
+{
+  fprintf (fb,
+    "%sif (cser_bench_present (b, depth))\n"
+    "%s{\n"
+    "%s  %s = (%s *)cser_bench_alloc (b, 1, sizeof (%s));\n",
+    indent, indent,
+    indent, lhs, m->base_type, m->base_type);
+  char *item, *inner;
+  if (asprintf (&item, "*%s", lhs) >= 0)
+  {
+    if (asprintf (&inner, "%s  ", indent) >= 0)
+    {
+      write_fill_item (m, item, "depth + 1", inner, fb);
+      free (inner);
+    }
+    free (item);
+  }
+  fprintf (fb, "%s}\n", indent);
+}
+
+
+static void write_fill_member (const type_t *type, const member_t *m, FILE *fb)
+{
+  char *lhs = 0;
+  switch (m->opts.cardinality)
+  {
+    case CDN_SINGLE:
+      if (asprintf (&lhs, "val->%s", m->member_name) < 0)
+        break;
+      if (m->opts.is_ptr)
+        write_fill_pointer (m, lhs, "  ", fb);
+      else if (is_size_member (type, m))
+        fprintf (fb, "  %s = (%s)cser_bench_count (b, depth);\n", lhs, m->base_type);
+      else
+        write_fill_item (m, lhs, "depth", "  ", fb);
+      break;
+    case CDN_FIXED_ARRAY:
+      if (asprintf (&lhs, "val->%s[i]", m->member_name) < 0)
+        break;
+      fprintf (fb, "  for (size_t i = 0; i < (%s); ++i)\n  {\n", m->opts.arr_sz);
+      if (m->opts.is_ptr)
+        write_fill_pointer (m, lhs, "    ", fb);
+      else
+        write_fill_item (m, lhs, "depth", "    ", fb);
+      fputs ("  }\n", fb);
+      break;
+    case CDN_VAR_ARRAY:
+      if (asprintf (&lhs, "val->%s[i]", m->member_name) < 0)
+        break;
+      fprintf (fb,
+        "  val->%s = (%s *)cser_bench_alloc (b, val->%s, sizeof (%s));\n"
+        "  for (size_t i = 0; i < (val->%s); ++i)\n"
+        "  {\n",
+        m->member_name, m->base_type, m->opts.variable_array_size_member, m->base_type,
+        m->opts.variable_array_size_member);
+      write_fill_item (m, lhs, "depth + 1", "    ", fb);
+      fputs ("  }\n", fb);
+      break;
+    case CDN_ZEROTERM_ARRAY:
+      // Only integers can be zero terminated; the backends reject anything
+      // else, so it is left null here
+      if (is_char_native (m->base_type))
+        fprintf (fb,
+          "  if (cser_bench_present (b, depth))\n"
+          "    val->%s = (%s *)cser_bench_string (b, depth + 1);\n",
+          m->member_name, m->base_type);
+      else if (!is_composite (m->base_type))
+        fprintf (fb,
+          "  if (cser_bench_present (b, depth))\n"
+          "  {\n"
+          "    size_t n = cser_bench_count (b, depth + 1);\n"
+          "    val->%s = (%s *)cser_bench_alloc (b, n + 1, sizeof (%s));\n"
+          "    for (size_t i = 0; i < n; ++i)\n"
+          "      val->%s[i] = (%s)(1 + cser_bench_next (b) %% 127);\n"
+          "  }\n",
+          m->member_name, m->base_type, m->base_type,
+          m->member_name, m->base_type);
+      break;
+  }
+  free (lhs);
+}
+
+
+static void write_fill_struct (const type_t *type, FILE *fb)
+{
+  char *utype = make_cname (type->type_name);
+  fprintf (fb,
+    "static void cser_bench_fill_%s (%s *val, cser_bench_t *b, unsigned depth)\n"
+    "{\n",
+    utype, type->type_name);
+  free (utype);
+  if (!uses_depth (type))
+    fputs ("  (void)depth;\n", fb);
+
+  // Lists get a number of items like an array would, filled iteratively
+  const member_t *link = list_link (type);
+  if (link)
+    fputs (
+      "  for (size_t k = cser_bench_count (b, depth); ; --k)\n"
+      "  {\n", fb);
+
+  for (const member_t *m = type->composite; m; m = m->next)
+    if (m != link)
+      write_fill_member (type, m, fb);
+
+  if (link)
+    fprintf (fb,
+      "  if (!k)\n"
+      "    break;\n"
+      "  val->%s = (%s *)cser_bench_alloc (b, 1, sizeof (%s));\n"
+      "  val = val->%s;\n"
+      "  }\n",
+      link->member_name, type->type_name, type->type_name,
+      link->member_name);
+
+  fputs ("}\n\n", fb);
+}
+
+
+// Adapters from the entry points of each backend to the common signatures.
+// Not all backends have entry points for aliases, so the actual type is used.
+static void write_adapters (const type_t *type, unsigned backends, FILE *fb)
+{
+  const char *name = type->type_name;
+  char *uname = make_cname (name);
+  if (backends & BACKEND_RAW)
+    fprintf (fb,
+      "static int cser_bench_raw_store_%s (const void *val, cser_bench_io_t *io)\n"
+      "{\n"
+      "  return cser_raw_store_%s (val, cser_bench_write, io);\n"
+      "}\n"
+      "\n"
+      "static int cser_bench_raw_load_%s (void *val, cser_bench_io_t *io)\n"
+      "{\n"
+      "  return cser_raw_load_alloc_%s (val, cser_bench_read, io, &io->alloc);\n"
+      "}\n"
+      "\n",
+      uname, uname, uname, uname);
+  if (backends & BACKEND_XML)
+    fprintf (fb,
+      "static int cser_bench_xml_store_%s (const void *val, cser_bench_io_t *io)\n"
+      "{\n"
+      "  return cser_xml_store_%s (val, io) ? 0 : -EIO;\n"
+      "}\n"
+      "\n"
+      "static int cser_bench_xml_load_%s (void *val, cser_bench_io_t *io)\n"
+      "{\n"
+      "  return cser_xml_load_%s (val, io) ? 0 : -EIO;\n"
+      "}\n"
+      "\n",
+      uname, uname, uname, uname);
+  // Mapping works in place, so each load maps a fresh copy of the image,
+  // which cser_bench_run makes beforehand
+  if (backends & BACKEND_IMAGE)
+    fprintf (fb,
+      "static int cser_bench_image_store_%s (const void *val, cser_bench_io_t *io)\n"
+      "{\n"
+      "  size_t len = cser_image_size_%s (val);\n"
+      "  if (!cser_bench_reserve (io, len))\n"
+      "    return -ENOMEM;\n"
+      "  io->len = len;\n"
+      "  return cser_image_store_%s (val, io->mem, len);\n"
+      "}\n"
+      "\n"
+      "static int cser_bench_image_load_%s (void *val, cser_bench_io_t *io)\n"
+      "{\n"
+      "  %s *root;\n"
+      "  int ret = cser_image_map_%s (io->work + io->slot * io->stride, io->len, &root);\n"
+      "  if (!ret)\n"
+      "    memcpy (val, root, sizeof (*root));\n"
+      "  return ret;\n"
+      "}\n"
+      "\n",
+      uname, uname, uname,
+      uname, name, uname);
+  free (uname);
+}
+
+
+static void write_main (char *const *names, size_t n_names, unsigned backends, FILE *fb)
+{
+  static const struct { unsigned backend; const char *name; bool in_place; } which[] =
+  {
+    { BACKEND_RAW, "raw", false },
+    { BACKEND_XML, "xml", false },
+    { BACKEND_IMAGE, "image", true },
+  };
+
+  fputs (
+    "int main (void)\n"
+    "{\n"
+    "  cser_bench_t b;\n"
+    "  b.seed = CSER_BENCH_SEED | 1;\n"
+    "  cser_arena_init (&b.arena, 0);\n"
+    "  bool first = true;\n"
+    "  int ret = 0;\n"
+    "  printf (\"{\\n  \\\"results\\\": [\");\n",
+    fb);
+
+  for (size_t i = 0; i < n_names; ++i)
+  {
+    const type_t *t = lookup_type (names[i]);
+    char *utype = make_cname (t->type_name);
+    fprintf (fb,
+      "  {\n"
+      "    %s *val = (%s *)cser_bench_alloc (&b, 1, sizeof (%s));\n"
+      "    cser_bench_fill_%s (val, &b, 0);\n",
+      names[i], names[i], names[i],
+      utype);
+    for (size_t k = 0; k < sizeof (which) / sizeof (which[0]); ++k)
+      if (backends & which[k].backend)
+        fprintf (fb,
+          "    if (cser_bench_run (\"%s\", \"%s\", val, sizeof (*val), cser_bench_%s_store_%s, cser_bench_%s_load_%s, %s, &first) != 0)\n"
+          "      ret = 1;\n",
+          names[i], which[k].name,
+          which[k].name, utype, which[k].name, utype,
+          which[k].in_place ? "true" : "false");
+    fputs ("  }\n", fb);
+    free (utype);
+  }
+
+  fputs (
+    "  printf (\"\\n  ]\\n}\\n\");\n"
+    "  cser_arena_destroy (&b.arena);\n"
+    "  return ret;\n"
+    "}\n",
+    fb);
+}
+
+
+bool backend_bench (const type_list_t *types, char *const *names, size_t n_names, unsigned backends, const char *header, FILE *fb)
+{
+  write_bench_support (header, backends, fb);
+
+  // The fill functions recurse into each other, so declare them up front
+  for (const type_list_t *t = types; t; t = t->next)
+  {
+    if (t->def.csfn != TYPE_COMPOSITE)
+      continue;
+    char *utype = make_cname (t->def.type_name);
+    fprintf (fb,
+      "static void cser_bench_fill_%s (%s *val, cser_bench_t *b, unsigned depth);\n",
+      utype, t->def.type_name);
+    free (utype);
+  }
+  fputs ("\n", fb);
+
+  for (const type_list_t *t = types; t; t = t->next)
+    if (t->def.csfn == TYPE_COMPOSITE)
+      write_fill_struct (&t->def, fb);
+
+  // One set of adapters per type, even if requested under several names
+  for (size_t i = 0; i < n_names; ++i)
+  {
+    const type_t *t = lookup_type (names[i]);
+    bool seen = false;
+    for (size_t k = 0; k < i; ++k)
+      seen = seen || lookup_type (names[k]) == t;
+    if (!seen)
+      write_adapters (t, backends, fb);
+  }
+
+  write_main (names, n_names, backends, fb);
+
+  return !ferror (fb);
+}
@@ -0,0 +1,11 @@
+/* Copyright (C) 2014 DiUS Computing Pty. Ltd.   See LICENSE file. */
+
+#ifndef _BACKEND_BENCH_H_
+#define _BACKEND_BENCH_H_
+
+#include "model.h"
+#include <stdio.h>
+
+bool backend_bench (const type_list_t *types, char *const *names, size_t n_names, unsigned backends, const char *header, FILE *fb);
+
+#endif
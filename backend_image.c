@@ -0,0 +1,687 @@
+/* Copyright (C) 2014 DiUS Computing Pty. Ltd.   See LICENSE file. */
+
+#include "backend_image.h"
+#include <string.h>
+#include <stdlib.h>
+
+// The image backend lays out an object graph as a single block of memory,
+// with every struct in its native layout and every pointer replaced by an
+// offset relative to the pointer itself. Out-of-line data is placed in
+// depth first order, and mapping an image walks it in that same order,
+// requiring each pointer target to lie beyond everything claimed so far.
+// That rules out cycles and overlapping objects in a corrupt image, and
+// means each byte is validated only once.
+
+
+static bool is_composite (const char *base_type)
+{
+  const type_t *t = lookup_type (base_type);
+  return t && t->csfn == TYPE_COMPOSITE;
+}
+
+
+// Whether a type holds any pointers, and hence needs fixing up when mapped
+static bool has_pointers (const type_t *t)
+{
+  if (!t || t->csfn != TYPE_COMPOSITE)
+    return false;
+  for (const member_t *m = t->composite; m; m = m->next)
+    if (m->opts.is_ptr || has_pointers (lookup_type (m->base_type)))
+      return true;
+  return false;
+}
+
+
+static bool check_member (const type_t *type, const member_t *m)
+{
+  // Shared objects would have to be duplicated, and may form cycles
+  bool ok = !m->opts.shared && ((m->opts.cardinality == CDN_SINGLE ||
+             m->opts.cardinality == CDN_FIXED_ARRAY) ?
+    m->opts.is_ptr <= 1 : m->opts.is_ptr == 1);
+  if (!ok)
+    fprintf (stderr, "error: backend_image does not support member '%s' of '%s'\n",
+      m->member_name, type->type_name);
+  return ok;
+}
+
+
+// Copies n items from src into the image at dst, placing the out-of-line
+// data of composite items as it goes. When sizing, guard is null and only
+// the placement is done.
+static void write_place_items (
+  const char *base_type, const char *src, const char *guard, const char *dst,
+  const char *n, const char *indent, FILE *fc)
+{
+  if (is_composite (base_type))
+  {
+    char *utype = make_cname (base_type);
+    fprintf (fc,
+      "%sfor (size_t i = 0; i < (%s); ++i)\n"
+      "%s  cser_image_place_%s (&(%s)[i], %s ? &(%s)[i] : 0, o);\n",
+      indent, n,
+      indent, utype, src, guard, dst);
+    free (utype);
+  }
+  else
+    fprintf (fc,
+      "%sif (%s)\n"
+      "%s  memcpy ((void *)(%s), (%s), (%s) * sizeof (%s));\n",
+      indent, guard,
+      indent, dst, src, n, base_type);
+}
+
+
+static void write_place_pointer (
+  const member_t *m, const char *field, const char *count, FILE *fc)
+{
+  fprintf (fc,
+    "  if (val->%s)\n"
+    "  {\n"
+    "    size_t n = %s;\n"
+    "    size_t off = cser_image_reserve (o, CSER_IMAGE_ALIGNOF (%s), n, sizeof (%s));\n"
+    "    %s *item = dst ? (%s *)(o->base + off) : 0;\n"
+    "    if (dst)\n"
+    "      cser_image_set (o, &dst->%s, off);\n",
+    field,
+    count,
+    m->base_type, m->base_type,
+    m->base_type, m->base_type,
+    field);
+  char *src;
+  if (asprintf (&src, "val->%s", field) < 0)
+    abort ();
+  write_place_items (m->base_type, src, "item", "item", "n", "    ", fc);
+  free (src);
+  fputs ("  }\n", fc);
+}
+
+
+static bool write_place_struct (const type_t *type, FILE *fc)
+{
+  char *utype = make_cname (type->type_name);
+  fprintf (fc,
+    "static void cser_image_place_%s (const %s *val, %s *dst, cser_image_out_t *o)\n"
+    "{\n",
+    utype, type->type_name, type->type_name);
+  free (utype);
+  if (!has_pointers (type))
+    fputs ("  (void)o;\n", fc);
+
+  const member_t *link = list_link (type);
+  if (link)
+    fputs ("  for (;;)\n  {\n", fc);
+
+  for (const member_t *m = type->composite; m; m = m->next)
+  {
+    if (m == link)
+      break;
+    if (!check_member (type, m))
+      return false;
+
+    char *field = 0, *count = 0, *src = 0, *dst = 0;
+    bool ok = true;
+    switch (m->opts.cardinality)
+    {
+      case CDN_SINGLE:
+        if (m->opts.is_ptr)
+        {
+          ok = asprintf (&field, "%s", m->member_name) >= 0;
+          if (ok)
+            write_place_pointer (m, field, "1", fc);
+        }
+        else
+        {
+          ok = asprintf (&src, "&val->%s", m->member_name) >= 0 &&
+               asprintf (&dst, "&dst->%s", m->member_name) >= 0;
+          if (ok)
+            write_place_items (m->base_type, src, "dst", dst, "1", "  ", fc);
+        }
+        break;
+      case CDN_FIXED_ARRAY:
+        if (m->opts.is_ptr)
+        {
+          fprintf (fc, "  for (size_t j = 0; j < (%s); ++j)\n  {\n", m->opts.arr_sz);
+          ok = asprintf (&field, "%s[j]", m->member_name) >= 0;
+          if (ok)
+            write_place_pointer (m, field, "1", fc);
+          fputs ("  }\n", fc);
+        }
+        else
+        {
+          ok = asprintf (&src, "val->%s", m->member_name) >= 0 &&
+               asprintf (&dst, "dst->%s", m->member_name) >= 0;
+          if (ok)
+            write_place_items (m->base_type, src, "dst", dst, m->opts.arr_sz, "  ", fc);
+        }
+        break;
+      case CDN_VAR_ARRAY:
+        ok = asprintf (&field, "%s", m->member_name) >= 0 &&
+             asprintf (&count, "val->%s", m->opts.variable_array_size_member) >= 0;
+        if (ok)
+          write_place_pointer (m, field, count, fc);
+        break;
+      case CDN_ZEROTERM_ARRAY:
+        ok = asprintf (&field, "%s", m->member_name) >= 0 &&
+             asprintf (&count, "cser_image_zeroterm (val->%s, sizeof (%s))",
+               m->member_name, m->base_type) >= 0;
+        if (ok)
+          write_place_pointer (m, field, count, fc);
+        break;
+    }
+    free (field);
+    free (count);
+    free (src);
+    free (dst);
+    if (!ok)
+      return false;
+  }
+
+  // Lists are placed iteratively, each node directly after the out-of-line
+  // data of its predecessor.
+  if (link)
+    fprintf (fc,
+      "  if (!val->%s)\n"
+      "    break;\n"
+      "  size_t off = cser_image_reserve (o, CSER_IMAGE_ALIGNOF (%s), 1, sizeof (%s));\n"
+      "  if (dst)\n"
+      "  {\n"
+      "    cser_image_set (o, &dst->%s, off);\n"
+      "    dst = (%s *)(o->base + off);\n"
+      "  }\n"
+      "  val = val->%s;\n"
+      "  }\n",
+      link->member_name,
+      type->type_name, type->type_name,
+      link->member_name,
+      type->type_name,
+      link->member_name);
+
+  fputs ("}\n\n", fc);
+  return !ferror (fc);
+}
+
+
+static void write_fix_pointer (
+  const member_t *m, const char *field, const char *count, FILE *fc)
+{
+  fprintf (fc,
+    "  {\n"
+    "    size_t off;\n"
+    "    int ret = cser_image_locate (in, &val->%s, CSER_IMAGE_ALIGNOF (%s), &off);\n"
+    "    if (ret != 0)\n"
+    "      return ret;\n"
+    "    if (!off)\n"
+    "      val->%s = 0;\n"
+    "    else\n"
+    "    {\n"
+    "      size_t n = %s;\n"
+    "      ret = cser_image_claim (in, off, n, sizeof (%s));\n"
+    "      if (ret != 0)\n"
+    "        return ret;\n"
+    "      val->%s = (%s *)(in->base + off);\n",
+    field, m->base_type,
+    field,
+    count,
+    m->base_type,
+    field, m->base_type);
+  if (has_pointers (lookup_type (m->base_type)))
+  {
+    char *utype = make_cname (m->base_type);
+    fprintf (fc,
+      "      for (size_t i = 0; i < n; ++i)\n"
+      "      {\n"
+      "        ret = cser_image_fix_%s ((%s *)&val->%s[i], in);\n"
+      "        if (ret != 0)\n"
+      "          return ret;\n"
+      "      }\n",
+      utype, m->base_type, field);
+    free (utype);
+  }
+  fputs ("    }\n  }\n", fc);
+}
+
+
+static bool write_fix_struct (const type_t *type, FILE *fc)
+{
+  char *utype = make_cname (type->type_name);
+  fprintf (fc,
+    "static int cser_image_fix_%s (%s *val, cser_image_in_t *in)\n"
+    "{\n",
+    utype, type->type_name);
+  free (utype);
+
+  const member_t *link = list_link (type);
+  if (link)
+    fputs ("  for (;;)\n  {\n", fc);
+
+  for (const member_t *m = type->composite; m; m = m->next)
+  {
+    if (m == link)
+      break;
+
+    char *field = 0, *count = 0;
+    bool ok = true;
+    if (!m->opts.is_ptr)
+    {
+      // Members held by value only need visiting if they hold pointers
+      if (has_pointers (lookup_type (m->base_type)))
+      {
+        char *umember = make_cname (m->base_type);
+        if (m->opts.cardinality == CDN_FIXED_ARRAY)
+          fprintf (fc,
+            "  for (size_t i = 0; i < (%s); ++i)\n"
+            "  {\n"
+            "    int ret = cser_image_fix_%s (&val->%s[i], in);\n"
+            "    if (ret != 0)\n"
+            "      return ret;\n"
+            "  }\n",
+            m->opts.arr_sz,
+            umember, m->member_name);
+        else
+          fprintf (fc,
+            "  {\n"
+            "    int ret = cser_image_fix_%s (&val->%s, in);\n"
+            "    if (ret != 0)\n"
+            "      return ret;\n"
+            "  }\n",
+            umember, m->member_name);
+        free (umember);
+      }
+      continue;
+    }
+
+    switch (m->opts.cardinality)
+    {
+      case CDN_SINGLE:
+        ok = asprintf (&field, "%s", m->member_name) >= 0;
+        if (ok)
+          write_fix_pointer (m, field, "1", fc);
+        break;
+      case CDN_FIXED_ARRAY:
+        fprintf (fc, "  for (size_t j = 0; j < (%s); ++j)\n  {\n", m->opts.arr_sz);
+        ok = asprintf (&field, "%s[j]", m->member_name) >= 0;
+        if (ok)
+          write_fix_pointer (m, field, "1", fc);
+        fputs ("  }\n", fc);
+        break;
+      case CDN_VAR_ARRAY:
+        ok = asprintf (&field, "%s", m->member_name) >= 0 &&
+             asprintf (&count, "val->%s", m->opts.variable_array_size_member) >= 0;
+        if (ok)
+          write_fix_pointer (m, field, count, fc);
+        break;
+      case CDN_ZEROTERM_ARRAY:
+        ok = asprintf (&field, "%s", m->member_name) >= 0 &&
+             asprintf (&count, "cser_image_scan (in, off, sizeof (%s))",
+               m->base_type) >= 0;
+        if (ok)
+          write_fix_pointer (m, field, count, fc);
+        break;
+    }
+    free (field);
+    free (count);
+    if (!ok)
+      return false;
+  }
+
+  if (link)
+    fprintf (fc,
+      "  size_t off;\n"
+      "  int ret = cser_image_locate (in, &val->%s, CSER_IMAGE_ALIGNOF (%s), &off);\n"
+      "  if (ret == 0 && off)\n"
+      "    ret = cser_image_claim (in, off, 1, sizeof (%s));\n"
+      "  if (ret != 0)\n"
+      "    return ret;\n"
+      "  if (!off)\n"
+      "  {\n"
+      "    val->%s = 0;\n"
+      "    break;\n"
+      "  }\n"
+      "  val = val->%s = (%s *)(in->base + off);\n"
+      "  }\n",
+      link->member_name, type->type_name,
+      type->type_name,
+      link->member_name,
+      link->member_name, type->type_name);
+
+  fputs ("  return 0;\n}\n\n", fc);
+  return !ferror (fc);
+}
+
+
+// With -I, stores and maps count into cser_image_stats_<type>, with the
+// size of the image as the bytes.
+static void write_entry_points (const type_t *type, bool stats, FILE *fh, FILE *fc)
+{
+  char *utype = make_cname (type->type_name);
+  const char *leave = stats ? "cser_stats_leave (&call, " : "";
+  const char *left = stats ? ")" : "";
+
+  if (stats)
+  {
+    fprintf (fh, "extern cser_stats_t cser_image_stats_%s;\n", utype);
+    fprintf (fc,
+      "cser_stats_t cser_image_stats_%s = { .backend = \"image\", .type = \"%s\" };\n",
+      utype, type->type_name);
+  }
+
+  fprintf (fh,
+    "size_t cser_image_size_%s (const %s *val);\n"
+    "int cser_image_store_%s (const %s *val, void *mem, size_t len);\n"
+    "int cser_image_map_%s (void *mem, size_t len, %s **root);\n",
+    utype, type->type_name,
+    utype, type->type_name,
+    utype, type->type_name);
+
+  fprintf (fc,
+    "_Static_assert (CSER_IMAGE_ALIGNOF (%s) <= CSER_IMAGE_ALIGN, \"%s alignment exceeds CSER_IMAGE_ALIGN\");\n"
+    "\n"
+    "size_t cser_image_size_%s (const %s *val)\n"
+    "{\n"
+    "  cser_image_out_t o = { 0, sizeof (cser_image_header_t) };\n"
+    "  cser_image_reserve (&o, CSER_IMAGE_ALIGNOF (%s), 1, sizeof (%s));\n"
+    "  cser_image_place_%s (val, 0, &o);\n"
+    "  return o.used;\n"
+    "}\n"
+    "\n"
+    "int cser_image_store_%s (const %s *val, void *mem, size_t len)\n"
+    "{\n",
+    type->type_name, type->type_name,
+    utype, type->type_name,
+    type->type_name, type->type_name,
+    utype,
+    utype, type->type_name);
+  if (stats)
+    fprintf (fc,
+      "  cser_stats_call_t call;\n"
+      "  cser_stats_enter (&call, &cser_image_stats_%s.store);\n",
+      utype);
+  fprintf (fc,
+    "  size_t size = cser_image_size_%s (val);\n"
+    "  if (size > len)\n"
+    "    return %s-ENOSPC%s;\n"
+    "  if ((uintptr_t)mem %% CSER_IMAGE_ALIGN)\n"
+    "    return %s-EINVAL%s;\n"
+    "  memset (mem, 0, size);\n"
+    "  cser_image_out_t o = { mem, sizeof (cser_image_header_t) };\n"
+    "  size_t root = cser_image_reserve (&o, CSER_IMAGE_ALIGNOF (%s), 1, sizeof (%s));\n"
+    "  cser_image_place_%s (val, (%s *)(o.base + root), &o);\n"
+    "  cser_image_set_header (mem, root, sizeof (%s), size);\n",
+    utype,
+    leave, left,
+    leave, left,
+    type->type_name, type->type_name,
+    utype, type->type_name,
+    type->type_name);
+  if (stats)
+    fputs (
+      "  call.bytes = size;\n"
+      "  return cser_stats_leave (&call, 0);\n", fc);
+  else
+    fputs ("  return 0;\n", fc);
+  fprintf (fc,
+    "}\n"
+    "\n"
+    "int cser_image_map_%s (void *mem, size_t len, %s **root)\n"
+    "{\n",
+    utype, type->type_name);
+  if (stats)
+    fprintf (fc,
+      "  cser_stats_call_t call;\n"
+      "  cser_stats_enter (&call, &cser_image_stats_%s.load);\n",
+      utype);
+  fprintf (fc,
+    "  cser_image_in_t in;\n"
+    "  int ret = cser_image_check_header (&in, mem, len, CSER_IMAGE_ALIGNOF (%s), sizeof (%s));\n"
+    "  if (ret != 0)\n"
+    "    return %sret%s;\n"
+    "  %s *val = (%s *)(in.base + in.next - sizeof (%s));\n",
+    type->type_name, type->type_name,
+    leave, left,
+    type->type_name, type->type_name, type->type_name);
+  if (has_pointers (type))
+    fprintf (fc,
+      "  ret = cser_image_fix_%s (val, &in);\n"
+      "  if (ret != 0)\n"
+      "    return %sret%s;\n",
+      utype,
+      leave, left);
+  if (stats)
+    fputs (
+      "  *root = val;\n"
+      "  call.bytes = len;\n"
+      "  return cser_stats_leave (&call, 0);\n"
+      "}\n\n", fc);
+  else
+    fputs (
+      "  *root = val;\n"
+      "  return 0;\n"
+      "}\n\n", fc);
+
+  free (utype);
+}
+
+
+static void write_image_support (FILE *fh, FILE *fc)
+{
+  fputs (
+"\n\n/* cser image backend */\n"
+"#include <errno.h>\n"
+"#include <stddef.h>\n"
+"#include <stdint.h>\n"
+"#include <string.h>\n"
+"\n"
+"/* An image holds an object graph in native layout, with pointers stored */\n"
+"/* as self-relative offsets. Images are only portable between hosts of  */\n"
+"/* the same ABI, and both storing and mapping require the memory to be  */\n"
+"/* aligned to CSER_IMAGE_ALIGN bytes (mmap(2) takes care of that).      */\n"
+"/* Mapping converts the offsets back to pointers in place. On failure   */\n"
+"/* the image contents are unspecified.                                   */\n"
+"#ifndef CSER_IMAGE_ALIGN\n"
+"# define CSER_IMAGE_ALIGN 16\n"
+"#endif\n"
+"typedef struct cser_image_header\n"
+"{\n"
+"  uint8_t magic[4];\n"
+"  uint8_t big_endian;\n"
+"  uint8_t ptr_size;\n"
+"  uint16_t version;\n"
+"  uint32_t root;      /* offset of the root object */\n"
+"  uint32_t root_size; /* sizeof the root object */\n"
+"  uint64_t size;      /* of the whole image */\n"
+"} cser_image_header_t;\n"
+"\n"
+, fh);
+
+  fputs (
+"#define CSER_IMAGE_ALIGNOF(T) offsetof (struct { char c; T t; }, t)\n"
+"#define CSER_IMAGE_VERSION 1\n"
+"\n"
+"_Static_assert (sizeof (void *) == sizeof (intptr_t), \"pointers must fit intptr_t\");\n"
+"\n"
+"typedef struct cser_image_out\n"
+"{\n"
+"  uint8_t *base; /* null when only sizing */\n"
+"  size_t used;\n"
+"} cser_image_out_t;\n"
+"\n"
+"typedef struct cser_image_in\n"
+"{\n"
+"  uint8_t *base;\n"
+"  size_t len;\n"
+"  size_t next; /* lowest offset not yet claimed */\n"
+"} cser_image_in_t;\n"
+"\n"
+"static const uint8_t cser_image_magic[4] = { 'c', 's', 'i', 'm' };\n"
+"\n"
+"static inline int cser_image_host_be (void)\n"
+"{\n"
+"  return *(const uint8_t *)&(const uint16_t){ 1 } == 0;\n"
+"}\n"
+"\n"
+"static inline size_t cser_image_zeroterm (const void *items, size_t size)\n"
+"{\n"
+"  static const uint8_t zero[16];\n"
+"  const uint8_t *p = items;\n"
+"  size_t n = 1;\n"
+"  if (size == 1)\n"
+"    return strlen ((const char *)p) + 1;\n"
+"  for (; memcmp (p, zero, size) != 0; p += size)\n"
+"    ++n;\n"
+"  return n;\n"
+"}\n"
+"\n"
+"static inline size_t cser_image_reserve (cser_image_out_t *o, size_t align, size_t n, size_t size)\n"
+"{\n"
+"  size_t off = (o->used + align - 1) / align * align;\n"
+"  o->used = off + n * size;\n"
+"  return off;\n"
+"}\n"
+"\n"
+"static inline void cser_image_set (cser_image_out_t *o, void *field, size_t off)\n"
+"{\n"
+"  intptr_t rel = (intptr_t)off - (intptr_t)((uint8_t *)field - o->base);\n"
+"  memcpy (field, &rel, sizeof (rel));\n"
+"}\n"
+"\n"
+"static void cser_image_set_header (void *mem, size_t root, size_t root_size, size_t size)\n"
+"{\n"
+"  cser_image_header_t hdr = {\n"
+"    { cser_image_magic[0], cser_image_magic[1], cser_image_magic[2], cser_image_magic[3] },\n"
+"    (uint8_t)cser_image_host_be (), sizeof (void *), CSER_IMAGE_VERSION,\n"
+"    (uint32_t)root, (uint32_t)root_size, size };\n"
+"  memcpy (mem, &hdr, sizeof (hdr));\n"
+"}\n"
+"\n"
+"static int cser_image_check_header (cser_image_in_t *in, void *mem, size_t len, size_t align, size_t root_size)\n"
+"{\n"
+"  cser_image_header_t hdr;\n"
+"  if ((uintptr_t)mem % CSER_IMAGE_ALIGN || len < sizeof (hdr))\n"
+"    return -EINVAL;\n"
+"  memcpy (&hdr, mem, sizeof (hdr));\n"
+"  if (memcmp (hdr.magic, cser_image_magic, sizeof (hdr.magic)) != 0 ||\n"
+"      hdr.big_endian != cser_image_host_be () ||\n"
+"      hdr.ptr_size != sizeof (void *) ||\n"
+"      hdr.version != CSER_IMAGE_VERSION ||\n"
+"      hdr.root_size != root_size)\n"
+"    return -EPROTO;\n"
+"  if (hdr.size > len || hdr.root < sizeof (hdr) || hdr.root % align ||\n"
+"      hdr.root > hdr.size || hdr.size - hdr.root < root_size)\n"
+"    return -EINVAL;\n"
+"  in->base = mem;\n"
+"  in->len = (size_t)hdr.size;\n"
+"  in->next = hdr.root + root_size;\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"/* Finds the target offset of a relative pointer, or zero for null */\n"
+"static inline int cser_image_locate (cser_image_in_t *in, const void *field, size_t align, size_t *off)\n"
+"{\n"
+"  intptr_t rel;\n"
+"  memcpy (&rel, field, sizeof (rel));\n"
+"  size_t at = (size_t)((const uint8_t *)field - in->base);\n"
+"  if (rel == 0)\n"
+"  {\n"
+"    *off = 0;\n"
+"    return 0;\n"
+"  }\n"
+"  if (rel < 0 || (size_t)rel > in->len - at)\n"
+"    return -EINVAL;\n"
+"  *off = at + (size_t)rel;\n"
+"  if (*off < in->next || *off % align)\n"
+"    return -EINVAL;\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"static inline int cser_image_claim (cser_image_in_t *in, size_t off, size_t n, size_t size)\n"
+"{\n"
+"  if (size && n > (in->len - off) / size)\n"
+"    return -EINVAL;\n"
+"  in->next = off + n * size;\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"/* Counts the items of a zero terminated array, terminator included, */\n"
+"/* or returns an impossible count if the image ends first.            */\n"
+"static inline size_t cser_image_scan (const cser_image_in_t *in, size_t off, size_t size)\n"
+"{\n"
+"  static const uint8_t zero[16];\n"
+"  const uint8_t *p = in->base + off;\n"
+"  const uint8_t *end = in->base + in->len;\n"
+"  if (size == 1)\n"
+"  {\n"
+"    const uint8_t *z = memchr (p, 0, (size_t)(end - p));\n"
+"    return z ? (size_t)(z - p) + 1 : SIZE_MAX;\n"
+"  }\n"
+"  for (size_t n = 1; (size_t)(end - p) >= size; p += size, ++n)\n"
+"    if (memcmp (p, zero, size) == 0)\n"
+"      return n;\n"
+"  return SIZE_MAX;\n"
+"}\n"
+"\n"
+, fc);
+}
+
+
+bool backend_image (const type_list_t *types, const alias_list_t *aliases, const options_t *opts, FILE *fh, FILE *fc)
+{
+  write_image_support (fh, fc);
+
+  // The placement and fixup functions recurse into each other, so declare
+  // them all up front.
+  for (const type_list_t *t = types; t; t = t->next)
+  {
+    if (t->def.csfn != TYPE_COMPOSITE)
+      continue;
+    char *utype = make_cname (t->def.type_name);
+    fprintf (fc,
+      "static void cser_image_place_%s (const %s *val, %s *dst, cser_image_out_t *o);\n",
+      utype, t->def.type_name, t->def.type_name);
+    if (has_pointers (&t->def))
+      fprintf (fc,
+        "static int cser_image_fix_%s (%s *val, cser_image_in_t *in);\n",
+        utype, t->def.type_name);
+    free (utype);
+  }
+  fputs ("\n", fc);
+
+  for (; types; types = types->next)
+  {
+    if (types->def.csfn != TYPE_COMPOSITE)
+      continue;
+    if (!write_place_struct (&types->def, fc) ||
+        (has_pointers (&types->def) && !write_fix_struct (&types->def, fc)))
+      return false;
+    write_entry_points (&types->def, opts->instrument, fh, fc);
+  }
+
+  for (; aliases; aliases = aliases->next)
+  {
+    const type_t *actual = lookup_type (aliases->actual_name);
+    if (!actual || actual->csfn != TYPE_COMPOSITE)
+      continue;
+
+    char *ualias = make_cname (aliases->alias_name);
+    char *uactual = make_cname (aliases->actual_name);
+
+    fprintf (fh,
+     "static inline size_t cser_image_size_%s (const %s *val)\n"
+     "{ return cser_image_size_%s (val); }\n"
+     "static inline int cser_image_store_%s (const %s *val, void *mem, size_t len)\n"
+     "{ return cser_image_store_%s (val, mem, len); }\n"
+     "static inline int cser_image_map_%s (void *mem, size_t len, %s **root)\n"
+     "{ return cser_image_map_%s (mem, len, root); }\n",
+      ualias, aliases->alias_name,
+      uactual,
+      ualias, aliases->alias_name,
+      uactual,
+      ualias, aliases->alias_name,
+      uactual
+    );
+
+    free (ualias);
+    free (uactual);
+  }
+
+  return !ferror (fh) && !ferror (fc);
+}
@@ -0,0 +1,11 @@
+/* Copyright (C) 2014 DiUS Computing Pty. Ltd.   See LICENSE file. */
+
+#ifndef _BACKEND_IMAGE_H_
+#define _BACKEND_IMAGE_H_
+
+#include "model.h"
+#include <stdio.h>
+
+bool backend_image (const type_list_t *types, const alias_list_t *aliases, const options_t *opts, FILE *fh, FILE *fc);
+
+#endif
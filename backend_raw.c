@@ -4,362 +4,5939 @@
 #include <string.h>
 #include <stdlib.h>
 
-static bool write_store_native (const type_t *type, FILE *fh, FILE *fc)
+static const options_t *options;
+static const type_list_t *all_types;
+
+
+static bool is_integer_native (const char *base_type)
+{
+  const type_t *t = lookup_type (base_type);
+  return
+    t && t->csfn == TYPE_NATIVE &&
+    !strstr (t->type_name, "float") &&
+    !strstr (t->type_name, "double") &&
+    strcmp (t->type_name, "_Bool") != 0 &&
+    strcmp (t->type_name, "void") != 0;
+}
+
+
+static bool is_char_native (const char *base_type)
+{
+  const type_t *t = lookup_type (base_type);
+  return t && t->csfn == TYPE_NATIVE && strstr (t->type_name, "char");
+}
+
+
+// Whether all integers of this type are written as varints
+static bool is_varint_native (const char *base_type)
+{
+  return
+    options->varint &&
+    is_integer_native (base_type) &&
+    !is_char_native (base_type);
+}
+
+
+static bool is_varint_member (const member_t *m)
+{
+  return
+    (m->opts.varint || options->varint) &&
+    is_integer_native (m->base_type) &&
+    !is_char_native (m->base_type);
+}
+
+
+// Native integer element types can be (de)serialized as a single block,
+// with at most a byte swap in between.
+static bool is_bulk_native (const char *base_type)
+{
+  return is_integer_native (base_type) && !is_varint_native (base_type);
+}
+
+
+// Name of the codec function suffix for (members of) the given type
+static char *codec_name (const char *base_type, bool varint)
+{
+  char *utype = make_cname (base_type);
+  if (!varint)
+    return utype;
+  char *name;
+  if (asprintf (&name, "varint_%s", utype) < 0)
+    abort ();
+  free (utype);
+  return name;
+}
+
+
+// Shared objects are tracked per type, so that e.g. a struct and its first
+// member are not mistaken for one another. The kind is simply the position
+// of the type in the type list.
+static unsigned type_kind (const char *base_type)
+{
+  const type_t *t = lookup_type (base_type);
+  unsigned kind = 0;
+  for (const type_list_t *l = all_types; l && &l->def != t; l = l->next)
+    ++kind;
+  return kind;
+}
+
+
+static bool check_shared (const type_t *type, const member_t *m)
+{
+  if (!m->opts.shared ||
+      (m->opts.is_ptr == 1 &&
+       (m->opts.cardinality == CDN_SINGLE ||
+        m->opts.cardinality == CDN_FIXED_ARRAY)))
+    return true;
+  fprintf (stderr, "error: shared member '%s' of '%s' must be a pointer or an array of pointers\n",
+    m->member_name, type->type_name);
+  return false;
+}
+
+
+static bool check_shuffle (const type_t *type, const member_t *m)
+{
+  if (!m->opts.shuffle || is_varint_member (m) ||
+      (is_bulk_native (m->base_type) &&
+       (m->opts.cardinality == CDN_FIXED_ARRAY ||
+        m->opts.cardinality == CDN_VAR_ARRAY)))
+    return true;
+  fprintf (stderr, "error: shuffle member '%s' of '%s' must be a fixed size or varlen array of integers\n",
+    m->member_name, type->type_name);
+  return false;
+}
+
+
+// Whether storing the type may involve shared objects, which need tracking
+// throughout the store and hence rule out e.g. stateless sizing.
+static bool reaches_shared (const type_t *t)
+{
+  static const type_t *visiting[64];
+  static size_t depth;
+
+  if (!t || t->csfn != TYPE_COMPOSITE)
+    return false;
+  for (size_t i = 0; i < depth; ++i)
+    if (visiting[i] == t)
+      return false;
+  if (depth == sizeof (visiting) / sizeof (visiting[0]))
+    return true;
+
+  bool shared = false;
+  visiting[depth++] = t;
+  for (const member_t *m = t->composite; m && !shared; m = m->next)
+    shared = m->opts.shared || reaches_shared (lookup_type (m->base_type));
+  --depth;
+  return shared;
+}
+
+
+// Structs use the tagged encoding throughout with -T, and otherwise once
+// any of their members has been given a field id.
+static bool is_tagged (const type_t *t)
+{
+  if (!t || t->csfn != TYPE_COMPOSITE)
+    return false;
+  if (options->tagged)
+    return true;
+  for (const member_t *m = t->composite; m; m = m->next)
+    if (m->opts.field_id)
+      return true;
+  return false;
+}
+
+
+static bool has_index (const type_t *t)
+{
+  if (!t || t->csfn != TYPE_COMPOSITE)
+    return false;
+  for (const member_t *m = t->composite; m; m = m->next)
+    if (m->opts.index)
+      return true;
+  return false;
+}
+
+
+// The resumable functions do without tagged structs and indexed arrays,
+// both of which need sizes worked out ahead of the data.
+static bool reaches_unresumable (const type_t *t)
+{
+  static const type_t *visiting[64];
+  static size_t depth;
+
+  if (!t || t->csfn != TYPE_COMPOSITE)
+    return false;
+  for (size_t i = 0; i < depth; ++i)
+    if (visiting[i] == t)
+      return false;
+  if (is_tagged (t) || has_index (t) ||
+      depth == sizeof (visiting) / sizeof (visiting[0]))
+    return true;
+
+  bool found = false;
+  visiting[depth++] = t;
+  for (const member_t *m = t->composite; m && !found; m = m->next)
+    found = reaches_unresumable (lookup_type (m->base_type));
+  --depth;
+  return found;
+}
+
+
+// Members without an id pragma get one from a hash of their name, kept
+// clear of the range available to the pragma.
+static unsigned member_id (const member_t *m)
+{
+  if (m->opts.field_id)
+    return m->opts.field_id;
+  uint32_t h = 0x811c9dc5u;
+  for (const char *c = m->member_name; *c; ++c)
+    h = (h ^ (uint8_t)*c) * 0x01000193u;
+  return 0x100000u | (h & 0xfffffu);
+}
+
+
+// Tagged members are preceded by their length, which has to be worked
+// out up front, so nothing stateful like shared objects may be involved.
+static bool check_tagged (const type_t *type)
+{
+  if (!is_tagged (type))
+    return true;
+  for (const member_t *m = type->composite; m; m = m->next)
+  {
+    if (m->opts.shared || reaches_shared (lookup_type (m->base_type)))
+    {
+      fprintf (stderr, "error: tagged struct '%s' can not have shared member '%s'\n",
+        type->type_name, m->member_name);
+      return false;
+    }
+    for (const member_t *o = type->composite; o != m; o = o->next)
+    {
+      if (member_id (o) == member_id (m))
+      {
+        fprintf (stderr, "error: members '%s' and '%s' of '%s' have the same field id, use an id pragma\n",
+          o->member_name, m->member_name, type->type_name);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+
+// Elements of indexed arrays are found by offset alone, so must not depend
+// on anything stored before them, like shared objects. Loading one from a
+// stream means loading the members ahead of the array first (the array
+// size among them), which rules out tagged structs.
+static bool check_index (const type_t *type, const member_t *m)
+{
+  if (!m->opts.index)
+    return true;
+  const type_t *mt = lookup_type (m->base_type);
+  if (m->opts.cardinality != CDN_VAR_ARRAY || m->opts.is_ptr != 1 ||
+      m->opts.shared || !mt || mt->csfn != TYPE_COMPOSITE)
+  {
+    fprintf (stderr, "error: index member '%s' of '%s' must be a varlen array of structs\n",
+      m->member_name, type->type_name);
+    return false;
+  }
+  if (reaches_shared (mt) || is_tagged (type))
+  {
+    fprintf (stderr, "error: index member '%s' of '%s' can not involve shared members or tagged structs\n",
+      m->member_name, type->type_name);
+    return false;
+  }
+  return true;
+}
+
+
+// Integers are written as LEB128 style varints, with signed values
+// zigzag encoded first so that small negative numbers stay small too.
+static bool write_varint_native (const type_t *type, FILE *fc)
 {
   char *utype = make_cname (type->type_name);
 
-  fprintf (fh,
-    "int cser_raw_store_%s (const %s *val, cser_raw_write_fn w, void *q);\n",
-    utype, type->type_name);
   fprintf (fc,
-    "int cser_raw_store_%s (const %s *val, cser_raw_write_fn w, void *q)\n"
+    "static inline int cser_raw_bstore_varint_%s (const %s *val, cser_raw_buf_t *b)\n"
     "{\n"
-    "  %s tmp = *val;\n"
-    "  uint8_t bytes[sizeof (%s)];\n"
-    "  for (unsigned i = 1; i <= sizeof (%s); ++i)\n"
+    "  if ((%s)-1 < (%s)1)\n"
+    "  {\n"
+    "    int64_t v = (int64_t)*val;\n"
+    "    return cser_raw_bput_varint (b, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));\n"
+    "  }\n"
+    "  return cser_raw_bput_varint (b, (uint64_t)*val);\n"
+    "}\n"
+    "static inline size_t cser_raw_bsize_varint_%s (const %s *val)\n"
+    "{\n"
+    "  if ((%s)-1 < (%s)1)\n"
+    "  {\n"
+    "    int64_t v = (int64_t)*val;\n"
+    "    return cser_raw_bsize_varint (((uint64_t)v << 1) ^ (uint64_t)(v >> 63));\n"
+    "  }\n"
+    "  return cser_raw_bsize_varint ((uint64_t)*val);\n"
+    "}\n"
+    "static inline int cser_raw_bload_varint_%s (%s *val, cser_raw_buf_t *b)\n"
+    "{\n"
+    "  uint64_t v = 0;\n"
+    "  int ret = cser_raw_bget_varint (b, &v);\n"
+    "  if (ret != 0)\n"
+    "    return ret;\n"
+    "  if ((%s)-1 < (%s)1)\n"
     "  {\n"
-    "    bytes[sizeof (%s) - i] = (uint8_t)(tmp & 0xff);\n"
-    "    tmp >>= 8;\n"
+    "    int64_t s = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);\n"
+    "    *val = (%s)s;\n"
+    "    if ((int64_t)*val != s)\n"
+    "      return -ERANGE;\n"
     "  }\n"
-    "  return w (bytes, sizeof (%s), q);\n"
+    "  else\n"
+    "  {\n"
+    "    *val = (%s)v;\n"
+    "    if ((uint64_t)*val != v)\n"
+    "      return -ERANGE;\n"
+    "  }\n"
+    "  return 0;\n"
     "}\n",
     utype, type->type_name,
+    type->type_name, type->type_name,
+    utype, type->type_name,
+    type->type_name, type->type_name,
+    utype, type->type_name,
+    type->type_name, type->type_name,
     type->type_name,
+    type->type_name);
+
+  free (utype);
+  return !ferror (fc);
+}
+
+
+static bool write_store_native (const type_t *type, FILE *fh, FILE *fc)
+{
+  (void)fh;
+  char *utype = make_cname (type->type_name);
+
+  if (is_varint_native (type->type_name))
+  {
+    fprintf (fc,
+      "static inline int cser_raw_bstore_%s (const %s *val, cser_raw_buf_t *b)\n"
+      "{ return cser_raw_bstore_varint_%s (val, b); }\n",
+      utype, type->type_name, utype);
+    free (utype);
+    return !ferror (fc);
+  }
+
+  fprintf (fc,
+    "static inline int cser_raw_bstore_%s (const %s *val, cser_raw_buf_t *b)\n"
+    "{\n"
+    "  uint8_t bytes[sizeof (%s)];\n"
+    "  memcpy (bytes, val, sizeof (%s));\n"
+    "  if (CSER_RAW_SWAP)\n"
+    "    cser_raw_swap (bytes, sizeof (%s));\n"
+    "  return cser_raw_bput (b, bytes, sizeof (%s));\n"
+    "}\n",
+    utype, type->type_name,
     type->type_name,
     type->type_name,
     type->type_name,
     type->type_name
     );
   free (utype);
-  return !ferror (fh) && !ferror (fc);
+  return !ferror (fc);
 }
 
 
 static bool write_load_native (const type_t *type, FILE *fh, FILE *fc)
 {
+  (void)fh;
   char *utype = make_cname (type->type_name);
 
-  fprintf (fh,"int cser_raw_load_%s (%s *val, cser_raw_read_fn r, void *q);\n",
-    utype, type->type_name);
+  if (is_varint_native (type->type_name))
+  {
+    fprintf (fc,
+      "static inline int cser_raw_bload_%s (%s *val, cser_raw_buf_t *b)\n"
+      "{ return cser_raw_bload_varint_%s (val, b); }\n",
+      utype, type->type_name, utype);
+    free (utype);
+    return !ferror (fc);
+  }
 
   fprintf (fc,
-    "int cser_raw_load_%s (%s *val, cser_raw_read_fn r, void *q)\n"
+    "static inline int cser_raw_bload_%s (%s *val, cser_raw_buf_t *b)\n"
     "{\n"
     "  uint8_t bytes[sizeof (%s)];\n"
-    "  int ret = r (bytes, sizeof (%s), q);\n"
+    "  int ret = cser_raw_bget (b, bytes, sizeof (%s));\n"
     "  if (ret != 0)\n"
-    "    return ret;\n"
-    "  %s tmp = 0;\n"
-    "  for (unsigned i = 0; i < (sizeof (%s)); ++i)\n"
-    "    tmp = (%s)((tmp << 8) | bytes[i]);\n"
-    "  *val = tmp;\n"
-    "  return 0;\n"
-    "}\n",
+    "    return ret;\n",
     utype, type->type_name,
     type->type_name,
-    type->type_name,
-    type->type_name,
-    type->type_name,
     type->type_name
     );
+  if (strcmp (type->type_name, "_Bool") == 0)
+    fputs ("  *val = (bytes[0] != 0);\n", fc); // avoid trap representations
+  else
+    fprintf (fc,
+      "  if (CSER_RAW_SWAP)\n"
+      "    cser_raw_swap (bytes, sizeof (%s));\n"
+      "  memcpy (val, bytes, sizeof (%s));\n",
+      type->type_name,
+      type->type_name
+      );
+  fputs (
+    "  return 0;\n"
+    "}\n", fc);
+  free (utype);
+  return !ferror (fc);
+}
+
+
+static bool write_size_native (const type_t *type, FILE *fc)
+{
+  char *utype = make_cname (type->type_name);
+  if (is_varint_native (type->type_name))
+    fprintf (fc,
+      "static inline size_t cser_raw_bsize_%s (const %s *val)\n"
+      "{ return cser_raw_bsize_varint_%s (val); }\n",
+      utype, type->type_name, utype);
+  else
+    fprintf (fc,
+      "static inline size_t cser_raw_bsize_%s (const %s *val)\n"
+      "{ (void)val; return sizeof (%s); }\n",
+      utype, type->type_name, type->type_name);
+  free (utype);
+  return !ferror (fc);
+}
+
+
+// The fingerprint of a type as stored by this backend also covers the
+// options which change its wire format.
+static uint64_t raw_fingerprint (const type_t *type)
+{
+  uint8_t wire[] = {
+    (uint8_t)options->byte_order, options->varint, options->counted
+  };
+  return fingerprint_bytes (type_fingerprint (type), wire, sizeof (wire));
+}
+
+
+// With -P the stream header is preceded by the type fingerprint, which a
+// load checks before anything else is read (let alone allocated).
+static void write_header_store (const char *utype, FILE *fc)
+{
+  if (options->prefixed)
+    fprintf (fc,
+      "  int ret = cser_raw_bstore_fingerprint (&b, CSER_RAW_FINGERPRINT_%s);\n"
+      "  if (ret == 0)\n"
+      "    ret = cser_raw_bstore_header (&b);\n",
+      utype);
+  else
+    fputs ("  int ret = cser_raw_bstore_header (&b);\n", fc);
+}
+
+
+static void write_header_load (const char *utype, FILE *fc)
+{
+  if (options->prefixed)
+    fprintf (fc,
+      "  int ret = cser_raw_bload_fingerprint (&b, CSER_RAW_FINGERPRINT_%s);\n"
+      "  if (ret == 0)\n"
+      "    ret = cser_raw_bload_header (&b);\n",
+      utype);
+  else
+    fputs ("  int ret = cser_raw_bload_header (&b);\n", fc);
+}
+
+
+// With -I, the entry points of a struct count into cser_raw_stats_<type>.
+// The callback given (fn, one of w, wv, r or pr) and the allocator are
+// swapped for counting stand-ins on the way in.
+static bool is_instrumented (const type_t *type)
+{
+  return options->instrument && type->csfn == TYPE_COMPOSITE;
+}
+
+
+static void write_stats_enter (
+  const type_t *type, const char *op, const char *fn, const char *shim,
+  bool alloc, FILE *fc)
+{
+  if (!is_instrumented (type))
+    return;
+  char *utype = make_cname (type->type_name);
+  fprintf (fc,
+    "  %s io;\n"
+    "  cser_stats_enter (&io.call, &cser_raw_stats_%s.%s);\n"
+    "  io.%s = %s;\n"
+    "  io.q = q;\n"
+    "  %s = cser_raw_stats_%s;\n"
+    "  q = &io;\n",
+    strcmp (fn, "pr") == 0 ? "cser_raw_stats_pio_t" : "cser_raw_stats_io_t",
+    utype, op,
+    fn, fn,
+    fn, shim);
+  if (alloc)
+    fputs ("  alloc = cser_stats_allocator (&io.call, alloc);\n", fc);
+  free (utype);
+}
+
+
+static void write_stats_return (const type_t *type, FILE *fc)
+{
+  fputs (is_instrumented (type) ?
+    "  return cser_stats_leave (&io.call, ret);\n" :
+    "  return ret;\n", fc);
+}
+
+
+static void write_stats_support (FILE *fc)
+{
+  fputs (
+"/* Counting stand-ins for the callbacks, for -I */\n"
+"typedef struct cser_raw_stats_io\n"
+"{\n"
+"  cser_stats_call_t call;\n"
+"  cser_raw_write_fn w;\n"
+"  cser_raw_writev_fn wv;\n"
+"  cser_raw_read_fn r;\n"
+"  cser_raw_readsome_fn rs;\n"
+"  void *q;\n"
+"} cser_raw_stats_io_t;\n"
+"\n"
+"static int cser_raw_stats_write (const uint8_t *bytes, size_t n, void *q)\n"
+"{\n"
+"  cser_raw_stats_io_t *io = q;\n"
+"  io->call.bytes += n;\n"
+"  return io->w (bytes, n, io->q);\n"
+"}\n"
+"\n"
+"static int cser_raw_stats_writev (const struct iovec *iov, int iovcnt, void *q)\n"
+"{\n"
+"  cser_raw_stats_io_t *io = q;\n"
+"  for (int i = 0; i < iovcnt; ++i)\n"
+"    io->call.bytes += iov[i].iov_len;\n"
+"  return io->wv (iov, iovcnt, io->q);\n"
+"}\n"
+"\n"
+"static int cser_raw_stats_read (uint8_t *bytes, size_t n, void *q)\n"
+"{\n"
+"  cser_raw_stats_io_t *io = q;\n"
+"  io->call.bytes += n;\n"
+"  return io->r (bytes, n, io->q);\n"
+"}\n"
+"\n"
+"static ssize_t cser_raw_stats_readsome (uint8_t *bytes, size_t n, void *q)\n"
+"{\n"
+"  cser_raw_stats_io_t *io = q;\n"
+"  ssize_t got = io->rs (bytes, n, io->q);\n"
+"  if (got > 0)\n"
+"    io->call.bytes += (size_t)got;\n"
+"  return got;\n"
+"}\n"
+"\n"
+, fc);
+}
+
+
+// The callback based entry points are thin wrappers around the buffer
+// cursor versions. Stores are batched through a stack buffer (which for
+// gathers holds just what is not listed in place). Loads from a read
+// function use an empty buffer so that no more than is needed is read from
+// the source, while buffered ones read ahead into a stack buffer.
+static bool write_wrappers (const type_t *type, FILE *fh, FILE *fc)
+{
+  char *utype = make_cname (type->type_name);
+
+  fprintf (fh,
+    "#define CSER_RAW_FINGERPRINT_%s 0x%016llxull\n"
+    "int cser_raw_store_%s (const %s *val, cser_raw_write_fn w, void *q);\n"
+    "int cser_raw_storev_%s (const %s *val, cser_raw_writev_fn wv, void *q);\n"
+    "int cser_raw_load_%s (%s *val, cser_raw_read_fn r, void *q);\n"
+    "int cser_raw_load_alloc_%s (%s *val, cser_raw_read_fn r, void *q, const cser_alloc_t *alloc);\n"
+    "int cser_raw_load_buffered_%s (%s *val, cser_raw_readsome_fn rs, void *q, const cser_alloc_t *alloc);\n"
+    "size_t cser_raw_size_%s (const %s *val);\n",
+    utype, (unsigned long long)raw_fingerprint (type),
+    utype, type->type_name,
+    utype, type->type_name,
+    utype, type->type_name,
+    utype, type->type_name,
+    utype, type->type_name,
+    utype, type->type_name);
+
+  if (is_instrumented (type))
+  {
+    fprintf (fh, "extern cser_stats_t cser_raw_stats_%s;\n", utype);
+    fprintf (fc,
+      "cser_stats_t cser_raw_stats_%s = { .backend = \"raw\", .type = \"%s\" };\n",
+      utype, type->type_name);
+  }
+
+  fprintf (fc,
+    "int cser_raw_store_%s (const %s *val, cser_raw_write_fn w, void *q)\n"
+    "{\n",
+    utype, type->type_name);
+  write_stats_enter (type, "store", "w", "write", false, fc);
+  fputs (
+    "  uint8_t mem[CSER_RAW_BUFSZ];\n"
+    "  cser_raw_buf_t b = { .p = mem, .end = mem + sizeof (mem), .mem = mem, .w = w, .q = q };\n",
+    fc);
+  write_header_store (utype, fc);
+  fprintf (fc,
+    "  if (ret == 0)\n"
+    "    ret = cser_raw_bstore_%s (val, &b);\n"
+    "  if (ret == 0)\n"
+    "    ret = cser_raw_buf_flush (&b);\n"
+    "  cser_raw_refs_release (&b);\n",
+    utype);
+  write_stats_return (type, fc);
+  fprintf (fc,
+    "}\n"
+    "int cser_raw_storev_%s (const %s *val, cser_raw_writev_fn wv, void *q)\n"
+    "{\n",
+    utype, type->type_name);
+  write_stats_enter (type, "store", "wv", "writev", false, fc);
+  fputs (
+    "  uint8_t mem[CSER_RAW_BUFSZ];\n"
+    "  struct iovec iov[CSER_RAW_IOVMAX];\n"
+    "  cser_raw_buf_t b = { .p = mem, .end = mem + sizeof (mem), .mem = mem, .q = q, .iov = iov, .iovmax = CSER_RAW_IOVMAX, .seg = mem, .wv = wv };\n",
+    fc);
+  write_header_store (utype, fc);
+  fprintf (fc,
+    "  if (ret == 0)\n"
+    "    ret = cser_raw_bstore_%s (val, &b);\n"
+    "  if (ret == 0)\n"
+    "    ret = cser_raw_buf_flush (&b);\n"
+    "  cser_raw_refs_release (&b);\n",
+    utype);
+  write_stats_return (type, fc);
+  fprintf (fc,
+    "}\n"
+    "int cser_raw_load_alloc_%s (%s *val, cser_raw_read_fn r, void *q, const cser_alloc_t *alloc)\n"
+    "{\n",
+    utype, type->type_name);
+  write_stats_enter (type, "load", "r", "read", true, fc);
+  fputs (
+    "  cser_raw_buf_t b = { .r = r, .q = q, .alloc = alloc };\n",
+    fc);
+  write_header_load (utype, fc);
+  fprintf (fc,
+    "  if (ret == 0)\n"
+    "    ret = cser_raw_bload_%s (val, &b);\n"
+    "  cser_raw_refs_release (&b);\n",
+    utype);
+  write_stats_return (type, fc);
+  fprintf (fc,
+    "}\n"
+    "int cser_raw_load_buffered_%s (%s *val, cser_raw_readsome_fn rs, void *q, const cser_alloc_t *alloc)\n"
+    "{\n",
+    utype, type->type_name);
+  write_stats_enter (type, "load", "rs", "readsome", true, fc);
+  fputs (
+    "  uint8_t mem[CSER_RAW_BUFSZ];\n"
+    "  cser_raw_buf_t b = { .p = mem, .end = mem, .mem = mem, .q = q, .alloc = alloc, .rs = rs, .cap = mem + sizeof (mem) };\n",
+    fc);
+  write_header_load (utype, fc);
+  fprintf (fc,
+    "  if (ret == 0)\n"
+    "    ret = cser_raw_bload_%s (val, &b);\n"
+    "  cser_raw_refs_release (&b);\n",
+    utype);
+  write_stats_return (type, fc);
+  fprintf (fc,
+    "}\n"
+    "int cser_raw_load_%s (%s *val, cser_raw_read_fn r, void *q)\n"
+    "{\n"
+    "  return cser_raw_load_alloc_%s (val, r, q, 0);\n"
+    "}\n"
+    "size_t cser_raw_size_%s (const %s *val)\n"
+    "{\n"
+    "  return %scser_raw_bsize_header () + cser_raw_bsize_%s (val);\n"
+    "}\n",
+    utype, type->type_name,
+    utype,
+    utype, type->type_name,
+    options->prefixed ? "CSER_RAW_FINGERPRINT_SIZE + " : "", utype);
+
+  free (utype);
+  return !ferror (fh) && !ferror (fc);
+}
+
+
+// Framed entry points, for -F. These go through a stack buffer both ways,
+// as a chunk is only of use once all of it has been checked.
+static bool write_framed (const type_t *type, FILE *fh, FILE *fc)
+{
+  char *utype = make_cname (type->type_name);
+
+  fprintf (fh,
+    "int cser_raw_store_framed_%s (const %s *val, cser_raw_write_fn w, void *q);\n"
+    "int cser_raw_load_framed_%s (%s *val, cser_raw_read_fn r, void *q);\n"
+    "int cser_raw_load_alloc_framed_%s (%s *val, cser_raw_read_fn r, void *q, const cser_alloc_t *alloc);\n",
+    utype, type->type_name,
+    utype, type->type_name,
+    utype, type->type_name);
+
+  fprintf (fc,
+    "int cser_raw_store_framed_%s (const %s *val, cser_raw_write_fn w, void *q)\n"
+    "{\n",
+    utype, type->type_name);
+  write_stats_enter (type, "store", "w", "write", false, fc);
+  fprintf (fc,
+    "  uint8_t mem[CSER_RAW_BUFSZ];\n"
+    "  cser_raw_buf_t b = { .p = mem + 4, .end = mem + sizeof (mem) - 4, .mem = mem, .w = w, .q = q, .lim = mem + sizeof (mem) };\n"
+    "  int ret = cser_raw_frame_begin (&b, CSER_RAW_FINGERPRINT_%s);\n"
+    "  if (ret == 0)\n"
+    "    ret = cser_raw_bstore_header (&b);\n"
+    "  if (ret == 0)\n"
+    "    ret = cser_raw_bstore_%s (val, &b);\n"
+    "  if (ret == 0)\n"
+    "    ret = cser_raw_frame_end (&b);\n"
+    "  cser_raw_refs_release (&b);\n",
+    utype,
+    utype);
+  write_stats_return (type, fc);
+  fprintf (fc,
+    "}\n"
+    "int cser_raw_load_alloc_framed_%s (%s *val, cser_raw_read_fn r, void *q, const cser_alloc_t *alloc)\n"
+    "{\n",
+    utype, type->type_name);
+  write_stats_enter (type, "load", "r", "read", true, fc);
+  fprintf (fc,
+    "  uint8_t mem[CSER_RAW_BUFSZ];\n"
+    "  cser_raw_buf_t b = { .p = mem, .end = mem, .mem = mem, .r = r, .q = q, .alloc = alloc, .lim = mem + sizeof (mem) };\n"
+    "  int ret = cser_raw_frame_check (&b, CSER_RAW_FINGERPRINT_%s);\n"
+    "  if (ret == 0)\n"
+    "    ret = cser_raw_bload_header (&b);\n"
+    "  if (ret == 0)\n"
+    "    ret = cser_raw_bload_%s (val, &b);\n"
+    "  if (ret == 0)\n"
+    "    ret = cser_raw_frame_done (&b);\n"
+    "  cser_raw_refs_release (&b);\n",
+    utype,
+    utype);
+  write_stats_return (type, fc);
+  fprintf (fc,
+    "}\n"
+    "int cser_raw_load_framed_%s (%s *val, cser_raw_read_fn r, void *q)\n"
+    "{\n"
+    "  return cser_raw_load_alloc_framed_%s (val, r, q, 0);\n"
+    "}\n",
+    utype, type->type_name,
+    utype);
+
+  free (utype);
+  return !ferror (fh) && !ferror (fc);
+}
+
+
+static void write_presence (FILE *fc, const char *name, bool arr)
+{
+  fprintf (fc,
+    "   uint8_t present = (val->%s%s != 0);\n"
+    "   int ret = cser_raw_bput (b, &present, sizeof (present));\n"
+    "   if (ret != 0)\n"
+    "     return ret;\n"
+    "   if (present)\n"
+    "   {\n",
+    name, arr ? "[i]" : ""
+    );
+}
+
+
+// A composite type is plain old data if it holds only fixed width natives,
+// either directly, in fixed size arrays or in nested plain old data. Such
+// types are (de)serialized as a single block whenever their in-memory
+// layout matches the wire format, as determined at compile time by the
+// CSER_RAW_POD_<type> macro.
+static bool is_pod (const type_t *t)
+{
+  if (!t || t->csfn != TYPE_COMPOSITE || is_tagged (t))
+    return false;
+  for (const member_t *m = t->composite; m; m = m->next)
+  {
+    if (m->opts.is_ptr ||
+        (m->opts.cardinality != CDN_SINGLE &&
+         m->opts.cardinality != CDN_FIXED_ARRAY))
+      return false;
+    const type_t *mt = lookup_type (m->base_type);
+    if (!is_bulk_native (m->base_type) && !is_pod (mt))
+      return false;
+    if (is_varint_member (m))
+      return false;
+  }
+  return true;
+}
+
+
+static bool is_bulk_member (const member_t *m)
+{
+  if (m->opts.index)
+    return false;
+  if (!is_bulk_native (m->base_type) && !is_pod (lookup_type (m->base_type)))
+    return false;
+  if (is_varint_member (m))
+    return false;
+  return
+    (m->opts.cardinality == CDN_FIXED_ARRAY && !m->opts.is_ptr) ||
+    (m->opts.cardinality == CDN_VAR_ARRAY && m->opts.is_ptr == 1);
+}
+
+
+// A type has a fixed wire size if it holds neither pointers, nor varints,
+// nor tags, directly or in nested types. Each of its values then encodes to
+// exactly CSER_RAW_MAX_BSIZE_<type> bytes.
+static bool is_fixed_wire (const type_t *t)
+{
+  if (!t || t->csfn != TYPE_COMPOSITE || is_tagged (t))
+    return false;
+  for (const member_t *m = t->composite; m; m = m->next)
+  {
+    if (m->opts.is_ptr || m->opts.shared || is_varint_member (m) ||
+        (m->opts.cardinality != CDN_SINGLE &&
+         m->opts.cardinality != CDN_FIXED_ARRAY))
+      return false;
+    const type_t *mt = lookup_type (m->base_type);
+    if (!mt)
+      return false;
+    if (mt->csfn == TYPE_NATIVE ?
+          is_varint_native (m->base_type) : !is_fixed_wire (mt))
+      return false;
+  }
+  return true;
+}
+
+
+// With -M, varlen arrays of fixed wire size structs are split into chunks
+// which are (de)serialized in parallel, see cser_raw_par_run.
+static bool is_par_member (const member_t *m)
+{
+  return
+    options->parallel &&
+    m->opts.cardinality == CDN_VAR_ARRAY && m->opts.is_ptr == 1 &&
+    !m->opts.shared && !m->opts.index &&
+    is_fixed_wire (lookup_type (m->base_type));
+}
+
+
+static bool is_par_element (const type_t *t)
+{
+  for (const type_list_t *l = all_types; l; l = l->next)
+    if (l->def.csfn == TYPE_COMPOSITE)
+      for (const member_t *m = l->def.composite; m; m = m->next)
+        if (is_par_member (m) && lookup_type (m->base_type) == t)
+          return true;
+  return false;
+}
+
+
+// Emits the function used to (de)serialize a run of items of the member's
+// type, e.g. "cser_raw_bstore_array (b, items, count, sizeof (int))".
+static void write_bulk_call (
+  const char *dir, const member_t *m, const char *items, const char *count,
+  FILE *fc)
+{
+  const char *base_type = m->base_type;
+  if (is_par_member (m))
+  {
+    // Plain old data is best left as a single block copy
+    char *utype = make_cname (base_type);
+    if (is_pod (lookup_type (base_type)))
+      fprintf (fc, "CSER_RAW_POD_%s ?\n      cser_raw_%s_array_%s (b, %s, %s) :\n      ",
+        utype, dir, utype, items, count);
+    fprintf (fc, "cser_raw_par_%s (b, (void *)%s, %s, sizeof (%s), CSER_RAW_MAX_BSIZE_%s, cser_raw_p%s_%s)",
+      dir + 1, items, count, base_type, utype, dir + 1, utype);
+    free (utype);
+  }
+  else if (is_bulk_native (base_type))
+    fprintf (fc, "cser_raw_%s_%s (b, %s, %s, sizeof (%s))",
+      dir, m->opts.shuffle ? "shuffled" : "array", items, count, base_type);
+  else
+  {
+    char *utype = make_cname (base_type);
+    fprintf (fc, "cser_raw_%s_array_%s (b, (%s%s *)%s, %s)",
+      dir, utype, strcmp (dir, "bstore") == 0 ? "const " : "", base_type,
+      items, count);
+    free (utype);
+  }
+}
+
+
+// With -L, zero-terminated arrays are measured up front and written as a
+// varint element count followed by the elements, without the terminator.
+static void write_store_counted (const member_t *m, FILE *fc)
+{
+  write_presence (fc, m->member_name, false);
+  if (is_char_native (m->base_type))
+    fprintf (fc,
+      "    size_t n = strlen ((const char *)val->%s);\n",
+      m->member_name);
+  else
+    fprintf (fc,
+      "    size_t n = 0;\n"
+      "    while (val->%s[n])\n"
+      "      ++n;\n",
+      m->member_name);
+  fputs (
+    "    ret = cser_raw_bput_varint (b, n);\n"
+    "    if (ret != 0)\n"
+    "      return ret;\n", fc);
+  if (is_bulk_native (m->base_type) && !is_varint_member (m))
+  {
+    fputs ("    ret = ", fc);
+    char *items;
+    if (asprintf (&items, "val->%s", m->member_name) < 0)
+      abort ();
+    write_bulk_call ("bstore", m, items, "n", fc);
+    free (items);
+    fputs (
+      ";\n"
+      "    if (ret != 0)\n"
+      "      return ret;\n", fc);
+  }
+  else
+  {
+    char *utype = codec_name (m->base_type, is_varint_member (m));
+    fprintf (fc,
+      "    for (size_t i = 0; i < n; ++i)\n"
+      "    {\n"
+      "      ret = cser_raw_bstore_%s (&val->%s[i], b);\n"
+      "      if (ret != 0)\n"
+      "        return ret;\n"
+      "    }\n",
+      utype, m->member_name);
+    free (utype);
+  }
+  fputs ("   }\n", fc);
+}
+
+
+// Strings go out in one piece, terminator included, which is exactly what
+// storing them char by char would produce.
+static void write_store_string (const member_t *m, FILE *fc)
+{
+  write_presence (fc, m->member_name, false);
+  fprintf (fc,
+    "    ret = cser_raw_bput_ref (b, (const uint8_t *)val->%s, strlen ((const char *)val->%s) + 1);\n"
+    "    if (ret != 0)\n"
+    "      return ret;\n"
+    "   }\n",
+    m->member_name, m->member_name);
+}
+
+
+// Shared objects are written out the first time they are encountered only,
+// and referred to by id from then on. See cser_raw_ref_put.
+static void write_store_shared (const member_t *m, FILE *fc)
+{
+  bool arr = (m->opts.cardinality == CDN_FIXED_ARRAY);
+  char *utype = codec_name (m->base_type, is_varint_member (m));
+  if (arr)
+    fprintf (fc, "  for (size_t i = 0; i < (%s); ++i)\n", m->opts.arr_sz);
+  fprintf (fc,
+    "  {\n"
+    "    bool fresh;\n"
+    "    int ret = cser_raw_ref_put (b, val->%s%s, %u, &fresh);\n"
+    "    if (ret == 0 && fresh)\n"
+    "      ret = cser_raw_bstore_%s (val->%s%s, b);\n"
+    "    if (ret != 0)\n"
+    "      return ret;\n"
+    "  }\n",
+    m->member_name, arr ? "[i]" : "", type_kind (m->base_type),
+    utype, m->member_name, arr ? "[i]" : "");
+  free (utype);
+}
+
+
+static void write_store_bulk (const member_t *m, FILE *fc)
+{
+  char *items, *count;
+  if (asprintf (&items, "val->%s", m->member_name) < 0 ||
+      asprintf (&count, "%s%s%s",
+        m->opts.variable_array_size_member ? "val->" : "(",
+        m->opts.variable_array_size_member ?
+          m->opts.variable_array_size_member : m->opts.arr_sz,
+        m->opts.variable_array_size_member ? "" : ")") < 0)
+    abort ();
+
+  if (m->opts.cardinality == CDN_VAR_ARRAY)
+  {
+    write_presence (fc, m->member_name, false);
+    fputs ("    ret = ", fc);
+  }
+  else
+    fputs ("    int ret = ", fc);
+  write_bulk_call ("bstore", m, items, count, fc);
+  fputs (
+    ";\n"
+    "    if (ret != 0)\n"
+    "      return ret;\n", fc);
+  if (m->opts.cardinality == CDN_VAR_ARRAY)
+    fputs ("   }\n", fc);
+
+  free (items);
+  free (count);
+}
+
+
+// Plain old data types get their layout checked at compile time, so that
+// the generated code can not silently get out of sync with the header.
+static void write_pod_support (const type_t *type, FILE *fc)
+{
+  char *utype = make_cname (type->type_name);
+
+  fprintf (fc, "#define CSER_RAW_POD_%s (!CSER_RAW_SWAP && sizeof (%s) == (0", utype, type->type_name);
+  for (const member_t *m = type->composite; m; m = m->next)
+    fprintf (fc, " + sizeof (((%s *)0)->%s)", type->type_name, m->member_name);
+  fputs ("))", fc);
+  for (const member_t *m = type->composite; m; m = m->next)
+  {
+    if (!is_bulk_native (m->base_type))
+    {
+      char *umember = make_cname (m->base_type);
+      fprintf (fc, " && CSER_RAW_POD_%s", umember);
+      free (umember);
+    }
+  }
+  fputs ("\n", fc);
+
+  for (const member_t *m = type->composite; m; m = m->next)
+  {
+    fprintf (fc,
+      "_Static_assert (sizeof (((%s *)0)->%s) == sizeof (%s)%s%s%s, \"cser: size of %s.%s changed\");\n",
+      type->type_name, m->member_name, m->base_type,
+      m->opts.arr_sz ? " * (" : "",
+      m->opts.arr_sz ? m->opts.arr_sz : "",
+      m->opts.arr_sz ? ")" : "",
+      type->type_name, m->member_name);
+    if (m->next)
+      fprintf (fc,
+        "_Static_assert (offsetof (%s, %s) < offsetof (%s, %s), \"cser: order of %s.%s changed\");\n",
+        type->type_name, m->member_name, type->type_name, m->next->member_name,
+        type->type_name, m->next->member_name);
+  }
+
+  fprintf (fc,
+    "static inline int cser_raw_bstore_array_%s (cser_raw_buf_t *b, const %s *items, size_t count)\n"
+    "{\n"
+    "  if (CSER_RAW_POD_%s)\n"
+    "    return cser_raw_bput_ref (b, (const uint8_t *)items, count * sizeof (%s));\n"
+    "  for (size_t i = 0; i < count; ++i)\n"
+    "  {\n"
+    "    int ret = cser_raw_bstore_%s (&items[i], b);\n"
+    "    if (ret != 0)\n"
+    "      return ret;\n"
+    "  }\n"
+    "  return 0;\n"
+    "}\n"
+    "static inline int cser_raw_bload_array_%s (cser_raw_buf_t *b, %s *items, size_t count)\n"
+    "{\n"
+    "  if (CSER_RAW_POD_%s)\n"
+    "    return cser_raw_bget (b, (uint8_t *)items, count * sizeof (%s));\n"
+    "  for (size_t i = 0; i < count; ++i)\n"
+    "  {\n"
+    "    int ret = cser_raw_bload_%s (&items[i], b);\n"
+    "    if (ret != 0)\n"
+    "      return ret;\n"
+    "  }\n"
+    "  return 0;\n"
+    "}\n\n",
+    utype, type->type_name,
+    utype,
+    type->type_name,
+    utype,
+    utype, type->type_name,
+    utype,
+    type->type_name,
+    utype);
+
+  free (utype);
+}
+
+
+// Adds the encoded size of count items to "size". Fixed width items need
+// no walking; plain old data composites only when their layout allows.
+static void write_size_items (
+  const member_t *m, const char *items, const char *count, const char *indent,
+  FILE *fc)
+{
+  const type_t *t = lookup_type (m->base_type);
+  bool varint = is_varint_member (m);
+  if (t && t->csfn == TYPE_NATIVE && !varint && !is_varint_native (m->base_type))
+  {
+    fprintf (fc, "%ssize += (%s) * sizeof (%s);\n", indent, count, m->base_type);
+    return;
+  }
+  char *utype = codec_name (m->base_type, varint);
+  if (is_pod (t))
+    fprintf (fc,
+      "%sif (CSER_RAW_POD_%s)\n"
+      "%s  size += (%s) * sizeof (%s);\n"
+      "%selse\n",
+      indent, utype,
+      indent, count, m->base_type,
+      indent);
+  fprintf (fc,
+    "%sfor (size_t i = 0; i < (%s); ++i)\n"
+    "%s  size += cser_raw_bsize_%s ((const %s *)&(%s)[i]);\n",
+    indent, count,
+    indent, utype, m->base_type, items);
+  free (utype);
+}
+
+
+// Adds the encoded size of a member to "size"
+static bool write_size_member (const member_t *m, FILE *fc)
+{
+  char *items = 0, *count = 0;
+  bool ok = true;
+  switch (m->opts.cardinality)
+  {
+    case CDN_SINGLE:
+      if (m->opts.is_ptr)
+      {
+        ok = asprintf (&items, "val->%s", m->member_name) >= 0;
+        fprintf (fc,
+          "  size += 1;\n"
+          "  if (val->%s)\n"
+          "  {\n",
+          m->member_name);
+        if (ok)
+          write_size_items (m, items, "1", "    ", fc);
+        fputs ("  }\n", fc);
+      }
+      else
+      {
+        ok = asprintf (&items, "&val->%s", m->member_name) >= 0;
+        if (ok)
+          write_size_items (m, items, "1", "  ", fc);
+      }
+      break;
+    case CDN_FIXED_ARRAY:
+      if (m->opts.is_ptr)
+      {
+        ok = asprintf (&items, "val->%s[j]", m->member_name) >= 0;
+        fprintf (fc,
+          "  for (size_t j = 0; j < (%s); ++j)\n"
+          "  {\n"
+          "    size += 1;\n"
+          "    if (val->%s[j])\n"
+          "    {\n",
+          m->opts.arr_sz,
+          m->member_name);
+        if (ok)
+          write_size_items (m, items, "1", "      ", fc);
+        fputs ("    }\n  }\n", fc);
+      }
+      else
+      {
+        ok = asprintf (&items, "val->%s", m->member_name) >= 0 &&
+             asprintf (&count, "%s", m->opts.arr_sz) >= 0;
+        if (ok)
+          write_size_items (m, items, count, "  ", fc);
+      }
+      break;
+    case CDN_VAR_ARRAY:
+      ok = asprintf (&items, "val->%s", m->member_name) >= 0 &&
+           asprintf (&count, "val->%s", m->opts.variable_array_size_member) >= 0;
+      fprintf (fc,
+        "  size += 1;\n"
+        "  if (val->%s)\n"
+        "  {\n",
+        m->member_name);
+      if (m->opts.index)
+        fputs ("    const size_t start = size;\n", fc);
+      if (ok)
+        write_size_items (m, items, count, "    ", fc);
+      if (m->opts.index)
+        fprintf (fc,
+          "    size += 1 + cser_raw_index_width (val->%s, size - start) * val->%s;\n",
+          m->opts.variable_array_size_member, m->opts.variable_array_size_member);
+      fputs ("  }\n", fc);
+      break;
+    case CDN_ZEROTERM_ARRAY:
+      ok = asprintf (&items, "val->%s", m->member_name) >= 0;
+      fprintf (fc,
+        "  size += 1;\n"
+        "  if (val->%s)\n"
+        "  {\n",
+        m->member_name);
+      if (is_char_native (m->base_type))
+        fprintf (fc,
+          "    size_t n = strlen ((const char *)val->%s);\n",
+          m->member_name);
+      else
+        fprintf (fc,
+          "    size_t n = 0;\n"
+          "    while (val->%s[n])\n"
+          "      ++n;\n",
+          m->member_name);
+      // Counted arrays leave out the terminator, but write the count
+      fputs (options->counted ?
+        "    size += cser_raw_bsize_varint (n);\n" :
+        "    ++n;\n", fc);
+      if (ok)
+        write_size_items (m, items, "n", "    ", fc);
+      fputs ("  }\n", fc);
+      break;
+  }
+  free (items);
+  free (count);
+  return ok;
+}
+
+
+// Indexed arrays are preceded by the table width and, for arrays of at
+// least CSER_RAW_INDEX_MIN elements, the offset of each element from the
+// first one. Sizes are worked out twice over to get these, which is far
+// cheaper than the encoding itself for the types involved.
+static void write_store_index (const member_t *m, FILE *fc)
+{
+  char *utype = make_cname (m->base_type);
+  fprintf (fc,
+    "    uint64_t total = 0;\n"
+    "    for (size_t i = 0; val->%s >= CSER_RAW_INDEX_MIN && i < val->%s; ++i)\n"
+    "      total += cser_raw_bsize_%s (&val->%s[i]);\n"
+    "    uint8_t width = cser_raw_index_width (val->%s, total);\n"
+    "    ret = cser_raw_bput (b, &width, sizeof (width));\n"
+    "    uint64_t offset = 0;\n"
+    "    for (size_t i = 0; ret == 0 && width && i < val->%s; ++i)\n"
+    "    {\n"
+    "      ret = cser_raw_bput_offset (b, offset, width);\n"
+    "      offset += cser_raw_bsize_%s (&val->%s[i]);\n"
+    "    }\n"
+    "    if (ret != 0)\n"
+    "      return ret;\n",
+    m->opts.variable_array_size_member, m->opts.variable_array_size_member,
+    utype, m->member_name,
+    m->opts.variable_array_size_member,
+    m->opts.variable_array_size_member,
+    utype, m->member_name);
+  free (utype);
+}
+
+
+static void write_store_member (const member_t *m, FILE *fc)
+{
+  fputs (" {\n", fc);
+  if (m->opts.shared)
+  {
+    write_store_shared (m, fc);
+    fputs (" }\n", fc);
+    return;
+  }
+  if (is_bulk_member (m) || is_par_member (m))
+  {
+    write_store_bulk (m, fc);
+    fputs (" }\n", fc);
+    return;
+  }
+  if (options->counted && m->opts.cardinality == CDN_ZEROTERM_ARRAY)
+  {
+    write_store_counted (m, fc);
+    fputs (" }\n", fc);
+    return;
+  }
+  if (m->opts.cardinality == CDN_ZEROTERM_ARRAY &&
+      is_char_native (m->base_type))
+  {
+    write_store_string (m, fc);
+    fputs (" }\n", fc);
+    return;
+  }
+  bool array = false;
+  if (m->opts.variable_array_size_member)
+  {
+    if (!m->opts.is_ptr)
+      abort ();
+    write_presence (fc, m->member_name, false);
+    if (m->opts.index)
+      write_store_index (m, fc);
+    fprintf (fc,
+      "    for (size_t i = 0; (val->%s) && (i < val->%s); ++i)\n"
+      "    {\n",
+      m->member_name, m->opts.variable_array_size_member
+      );
+    array = true;
+  }
+  else switch (m->opts.cardinality)
+  {
+    case CDN_ZEROTERM_ARRAY:
+      write_presence (fc, m->member_name, false);
+      fprintf (fc,
+        "    for (size_t i = 0; (val->%s) && ((i == 0) || (val->%s[i-1])); ++i)\n"
+        "    {\n",
+        m->member_name, m->member_name
+        );
+      array = true;
+      break;
+    case CDN_SINGLE:
+      if (m->opts.is_ptr)
+        write_presence (fc, m->member_name, false);
+      else
+        fputs ("    {\n", fc);
+      break;
+    default:
+      fprintf (fc,
+        "  for (size_t i = 0; i < (%s); ++i)\n"
+        "  {\n",
+        m->opts.arr_sz);
+      if (m->opts.is_ptr)
+        write_presence (fc, m->member_name, true);
+      else
+        fputs ("   {\n", fc);
+      array = true;
+      break;
+  }
+  /* !ptr || zeroterm || variable -> &, else "" */
+  bool need_amp =
+    (!m->opts.is_ptr ||
+     m->opts.cardinality == CDN_ZEROTERM_ARRAY ||
+     m->opts.variable_array_size_member);
+  char *utype = codec_name (m->base_type, is_varint_member (m));
+  fprintf (fc,
+    "      int ret = cser_raw_bstore_%s ((%s*)%sval->%s%s, b);\n"
+    "      if (ret != 0)\n"
+    "        return ret;\n"
+    "   }\n"
+    "%s\n",
+    utype,
+    m->base_type,
+    need_amp ? "&" : "",
+    m->member_name,
+    array ? "[i]" : "",
+    array ? "  }" : ""
+    );
+  free (utype);
+
+  fputs (" }\n", fc);
+}
+
+
+static bool write_store_struct (const type_t *type, FILE *fh, FILE *fc)
+{
+  char *utype = make_cname (type->type_name);
+  fprintf (fh,
+    "int cser_raw_bstore_%s (const %s *val, cser_raw_buf_t *b);\n",
+    utype, type->type_name);
+
+  fprintf (fc,
+    "int cser_raw_bstore_%s (const %s *val, cser_raw_buf_t *b)\n"
+    "{\n",
+    utype, type->type_name);
+  if (is_pod (type))
+    fprintf (fc,
+      "  if (CSER_RAW_POD_%s)\n"
+      "    return cser_raw_bput_ref (b, (const uint8_t *)val, sizeof (*val));\n",
+      utype);
+
+  free (utype);
+  utype = 0;
+
+  if (!check_tagged (type))
+    return false;
+  bool tagged = is_tagged (type);
+  const member_t *link = list_link (type);
+  if (link)
+    fputs ("  for (;;)\n  {\n", fc);
+
+  for (member_t *m = type->composite; m; m = m->next)
+  {
+    if (m == link)
+      break;
+    if (!check_shared (type, m) || !check_shuffle (type, m) ||
+        !check_index (type, m))
+      return false;
+    if (tagged)
+    {
+      fputs (" {\n  size_t size = 0;\n", fc);
+      if (!write_size_member (m, fc))
+        return false;
+      fprintf (fc,
+        "  int ret = cser_raw_bput_tag (b, %uu, size);\n"
+        "  if (ret != 0)\n"
+        "    return ret;\n"
+        " }\n",
+        member_id (m));
+    }
+    write_store_member (m, fc);
+  }
+
+  // Tagged structs end with a zero id
+  if (tagged)
+    fputs (
+      " {\n"
+      "  int ret = cser_raw_bput_varint (b, 0);\n"
+      "  if (ret != 0)\n"
+      "    return ret;\n"
+      " }\n", fc);
+
+  // Lists are walked rather than recursed into, to keep stack use constant
+  if (link)
+    fprintf (fc,
+      "   uint8_t present = (val->%s != 0);\n"
+      "   int ret = cser_raw_bput (b, &present, sizeof (present));\n"
+      "   if (ret != 0)\n"
+      "     return ret;\n"
+      "   if (!present)\n"
+      "     break;\n"
+      "   val = val->%s;\n"
+      "  }\n",
+      link->member_name, link->member_name);
+
+  fputs ("  return 0;\n}\n", fc);
+
+  return !ferror (fh) && !ferror (fc);
+}
+
+// Mirrors write_store_struct, adding up the bytes instead of writing them
+static bool write_size_struct (const type_t *type, FILE *fh, FILE *fc)
+{
+  char *utype = make_cname (type->type_name);
+  fprintf (fh,
+    "size_t cser_raw_bsize_%s (const %s *val);\n",
+    utype, type->type_name);
+
+  // Fixed size structs never look at val
+  fprintf (fc,
+    "size_t cser_raw_bsize_%s (const %s *val)\n"
+    "{\n"
+    "  (void)val;\n",
+    utype, type->type_name);
+  if (is_pod (type))
+    fprintf (fc,
+      "  if (CSER_RAW_POD_%s)\n"
+      "    return sizeof (*val);\n",
+      utype);
+
+  // Which objects get written in full depends on what has been seen
+  // before, so here the store is simply run with a counting sink.
+  if (reaches_shared (type))
+  {
+    fprintf (fc,
+      "  size_t size = 0;\n"
+      "  uint8_t mem[256];\n"
+      "  cser_raw_buf_t b = { .p = mem, .end = mem + sizeof (mem), .mem = mem, .w = cser_raw_count_fn, .q = &size };\n"
+      "  int ret = cser_raw_bstore_%s (val, &b);\n"
+      "  if (ret == 0)\n"
+      "    ret = cser_raw_buf_flush (&b);\n"
+      "  cser_raw_refs_release (&b);\n"
+      "  return ret == 0 ? size : SIZE_MAX;\n"
+      "}\n",
+      utype);
+    free (utype);
+    return !ferror (fh) && !ferror (fc);
+  }
+  free (utype);
+  fputs ("  size_t size = 0;\n", fc);
+
+  bool tagged = is_tagged (type);
+  const member_t *link = list_link (type);
+  if (link)
+    fputs ("  for (;;)\n  {\n", fc);
+
+  for (const member_t *m = type->composite; m; m = m->next)
+  {
+    if (m == link)
+      break;
+    if (tagged)
+      fputs ("  {\n  const size_t before = size;\n", fc);
+    if (!write_size_member (m, fc))
+      return false;
+    if (tagged)
+      fprintf (fc,
+        "  size += cser_raw_bsize_tag (%uu, size - before);\n"
+        "  }\n",
+        member_id (m));
+  }
+  if (tagged)
+    fputs ("  size += 1;\n  (void)val;\n", fc);
+
+  if (link)
+    fprintf (fc,
+      "  size += 1;\n"
+      "  if (!val->%s)\n"
+      "    break;\n"
+      "  val = val->%s;\n"
+      "  }\n",
+      link->member_name, link->member_name);
+
+  fputs ("  return size;\n}\n", fc);
+
+  return !ferror (fh) && !ferror (fc);
+}
+
+
+// Returns a constant expression for the most bytes a value of the given
+// type can take up, or null if that is unbounded, i.e. the type graph has
+// variable length or zero-terminated arrays, or refers back to itself.
+static char *max_size_expr (const type_t *t)
+{
+  static const type_t *visiting[64];
+  static size_t depth;
+
+  if (!t)
+    return 0;
+
+  char *expr = 0;
+  if (t->csfn == TYPE_NATIVE)
+  {
+    if (asprintf (&expr, "sizeof (%s)", t->type_name) < 0)
+      abort ();
+    return expr;
+  }
+  if (t->csfn != TYPE_COMPOSITE || is_tagged (t) ||
+      depth == sizeof (visiting) / sizeof (visiting[0]))
+    return 0;
+  for (size_t i = 0; i < depth; ++i)
+    if (visiting[i] == t)
+      return 0;
+  visiting[depth++] = t;
+
+  if (asprintf (&expr, "(0") < 0)
+    abort ();
+  for (const member_t *m = t->composite; m && expr; m = m->next)
+  {
+    char *item = 0, *sum = 0;
+    if (m->opts.cardinality == CDN_VAR_ARRAY ||
+        m->opts.cardinality == CDN_ZEROTERM_ARRAY ||
+        m->opts.is_ptr > 1 ||
+        m->opts.shared)
+      ;
+    else if (is_varint_member (m))
+    {
+      if (asprintf (&item, "((sizeof (%s) * 8 + 6) / 7)", m->base_type) < 0)
+        abort ();
+    }
+    else
+    {
+      const type_t *mt = lookup_type (m->base_type);
+      if (mt && mt->csfn == TYPE_COMPOSITE)
+      {
+        // Only check for boundedness here, the macro covers the rest
+        char *nested = max_size_expr (mt);
+        char *umember = make_cname (m->base_type);
+        if (nested && asprintf (&item, "CSER_RAW_MAX_BSIZE_%s", umember) < 0)
+          abort ();
+        free (nested);
+        free (umember);
+      }
+      else
+        item = max_size_expr (mt);
+    }
+
+    if (item &&
+        asprintf (&sum, "%s + %s%s%s%s%s%s", expr,
+          m->opts.cardinality == CDN_FIXED_ARRAY ? "(" : "",
+          m->opts.cardinality == CDN_FIXED_ARRAY ? m->opts.arr_sz : "",
+          m->opts.cardinality == CDN_FIXED_ARRAY ? ") * " : "",
+          m->opts.is_ptr ? "(1 + " : "",
+          item,
+          m->opts.is_ptr ? ")" : "") < 0)
+      abort ();
+    free (item);
+    free (expr);
+    expr = sum;
+  }
+  --depth;
+
+  if (!expr)
+    return 0;
+  char *res;
+  if (asprintf (&res, "%s)", expr) < 0)
+    abort ();
+  free (expr);
+  return res;
+}
+
+
+// The size macros of nested types may be needed by any prototype, so these
+// are all emitted up front.
+static void write_bounded_size (const type_t *type, FILE *fh)
+{
+  if (type->csfn != TYPE_COMPOSITE)
+    return;
+  char *expr = max_size_expr (type);
+  if (!expr)
+    return;
+  char *utype = make_cname (type->type_name);
+  fprintf (fh,
+    "#define CSER_RAW_MAX_BSIZE_%s %s\n"
+    "#define CSER_RAW_MAX_SIZE_%s (%sCSER_RAW_HEADER_SIZE + CSER_RAW_MAX_BSIZE_%s)\n",
+    utype, expr,
+    utype, options->prefixed ? "CSER_RAW_FINGERPRINT_SIZE + " : "", utype);
+  free (utype);
+  free (expr);
+}
+
+
+// Types of bounded size get a compile time worst case size, and store and
+// load variants working directly on a buffer of that size. The buffer is
+// known to be large enough, so storing needs no callback and can not fail.
+static bool write_bounded (const type_t *type, FILE *fh, FILE *fc)
+{
+  char *expr = max_size_expr (type);
+  if (!expr)
+    return true;
+
+  char *utype = make_cname (type->type_name);
+  fprintf (fh,
+    "size_t cser_raw_store_bounded_%s (const %s *val, uint8_t buf[CSER_RAW_MAX_SIZE_%s]);\n"
+    "int cser_raw_load_bounded_%s (%s *val, const uint8_t *buf, size_t len);\n",
+    utype, type->type_name, utype,
+    utype, type->type_name);
+
+  // These work on memory, so with -I the bytes are counted on the way out
+  bool stats = is_instrumented (type);
+  fprintf (fc,
+    "size_t cser_raw_store_bounded_%s (const %s *val, uint8_t buf[CSER_RAW_MAX_SIZE_%s])\n"
+    "{\n",
+    utype, type->type_name, utype);
+  if (stats)
+    fprintf (fc,
+      "  cser_stats_call_t call;\n"
+      "  cser_stats_enter (&call, &cser_raw_stats_%s.store);\n",
+      utype);
+  fprintf (fc,
+    "  cser_raw_buf_t b = { .p = buf, .end = buf + CSER_RAW_MAX_SIZE_%s, .mem = buf };\n",
+    utype);
+  if (options->prefixed)
+    fprintf (fc, "  cser_raw_bstore_fingerprint (&b, CSER_RAW_FINGERPRINT_%s);\n", utype);
+  fprintf (fc,
+    "  cser_raw_bstore_header (&b);\n"
+    "  cser_raw_bstore_%s (val, &b);\n",
+    utype);
+  if (stats)
+    fputs (
+      "  call.bytes = (size_t)(b.p - buf);\n"
+      "  cser_stats_leave (&call, 0);\n", fc);
+  fprintf (fc,
+    "  return (size_t)(b.p - buf);\n"
+    "}\n"
+    "int cser_raw_load_bounded_%s (%s *val, const uint8_t *buf, size_t len)\n"
+    "{\n",
+    utype, type->type_name);
+  if (stats)
+    fprintf (fc,
+      "  cser_stats_call_t call;\n"
+      "  cser_stats_enter (&call, &cser_raw_stats_%s.load);\n",
+      utype);
+  fputs (
+    "  cser_raw_buf_t b = { .p = (uint8_t *)buf, .end = (uint8_t *)buf + len, .mem = (uint8_t *)buf };\n",
+    fc);
+  if (stats)
+    fputs ("  b.alloc = cser_stats_allocator (&call, 0);\n", fc);
+  write_header_load (utype, fc);
+  if (stats)
+    fprintf (fc,
+      "  if (ret == 0)\n"
+      "    ret = cser_raw_bload_%s (val, &b);\n"
+      "  call.bytes = (size_t)(b.p - buf);\n"
+      "  return cser_stats_leave (&call, ret);\n"
+      "}\n",
+      utype);
+  else
+    fprintf (fc,
+      "  if (ret != 0)\n"
+      "    return ret;\n"
+      "  return cser_raw_bload_%s (val, &b);\n"
+      "}\n",
+      utype);
+
+  free (utype);
+  free (expr);
+  return !ferror (fh) && !ferror (fc);
+}
+
+
+static void write_load_item (
+  const char *target, const char *base_type, const char *indent, bool pointer,
+  bool varint, FILE *fc)
+{
+  char *utype = codec_name (base_type, varint);
+
+  if (pointer)
+  {
+    fprintf (fc,
+      "%s%s *tmp_item = cser_alloc (b->alloc, 1, sizeof (%s));\n"
+      "%sif (!tmp_item)\n"
+      "%s  return -ENOMEM;\n"
+      "%sint ret = cser_raw_bload_%s (tmp_item, b);\n"
+      "%sif (ret == 0)\n"
+      "%s  %s = tmp_item;\n"
+      "%selse\n"
+      "%s  cser_free (b->alloc, tmp_item, sizeof (%s));\n",
+      indent, base_type, base_type,
+      indent,
+      indent,
+      indent, utype,
+      indent,
+      indent, target,
+      indent,
+      indent, base_type
+      );
+  }
+  else
+    fprintf (fc,
+      "%sint ret = cser_raw_bload_%s ((%s*)&%s, b);\n",
+      indent, utype, base_type, target
+      );
+
+  free (utype);
+}
+
+
+static void write_presence_check (FILE *fc)
+{
+  fprintf (fc,
+    "  uint8_t present;\n"
+    "  int ret = cser_raw_bget (b, &present, sizeof (present));\n"
+    "  if (ret != 0)\n"
+    "    return ret;\n"
+    "  if (present)\n"
+    "  {\n"
+    );
+}
+
+
+// Counted arrays are loaded with a single exact size allocation, which
+// includes room for the terminator.
+static void write_load_counted (const member_t *m, FILE *fc)
+{
+  write_presence_check (fc);
+  fprintf (fc,
+    "    uint64_t n = 0;\n"
+    "    ret = cser_raw_bget_varint (b, &n);\n"
+    "    if (ret != 0)\n"
+    "      return ret;\n"
+    "    if (n >= SIZE_MAX / sizeof (%s))\n"
+    "      return -EOVERFLOW;\n"
+    "    %s *items = cser_alloc (b->alloc, (size_t)n + 1, sizeof (%s));\n"
+    "    if (!items)\n"
+    "      return -ENOMEM;\n",
+    m->base_type,
+    m->base_type, m->base_type);
+  if (is_bulk_native (m->base_type) && !is_varint_member (m))
+  {
+    fputs ("    ret = ", fc);
+    write_bulk_call ("bload", m, "items", "(size_t)n", fc);
+    fputs (";\n", fc);
+  }
+  else
+  {
+    char *utype = codec_name (m->base_type, is_varint_member (m));
+    fprintf (fc,
+      "    for (size_t i = 0; ret == 0 && i < n; ++i)\n"
+      "      ret = cser_raw_bload_%s (&items[i], b);\n",
+      utype);
+    free (utype);
+  }
+  fprintf (fc,
+    "    if (ret != 0)\n"
+    "    {\n"
+    "      cser_free (b->alloc, items, ((size_t)n + 1) * sizeof (%s));\n"
+    "      return ret;\n"
+    "    }\n"
+    "    val->%s = items;\n"
+    "  }\n",
+    m->base_type,
+    m->member_name);
+}
+
+
+// A newly seen shared object is registered before its contents are loaded,
+// so that references to it from within itself resolve. Once registered it
+// may be referenced from elsewhere, so it is not freed on failure.
+static void write_load_shared (const member_t *m, FILE *fc)
+{
+  bool arr = (m->opts.cardinality == CDN_FIXED_ARRAY);
+  char *utype = codec_name (m->base_type, is_varint_member (m));
+  unsigned kind = type_kind (m->base_type);
+  if (arr)
+    fprintf (fc, "  for (size_t i = 0; i < (%s); ++i)\n", m->opts.arr_sz);
+  fprintf (fc,
+    "  {\n"
+    "    uint8_t tag;\n"
+    "    void *obj = 0;\n"
+    "    int ret = cser_raw_ref_get (b, %u, &tag, &obj);\n"
+    "    if (ret != 0)\n"
+    "      return ret;\n"
+    "    if (tag == CSER_RAW_REF_NEW)\n"
+    "    {\n"
+    "      %s *item = cser_alloc (b->alloc, 1, sizeof (%s));\n"
+    "      if (!item)\n"
+    "        return -ENOMEM;\n"
+    "      ret = cser_raw_ref_add (b, %u, item);\n"
+    "      if (ret == 0)\n"
+    "        ret = cser_raw_bload_%s (item, b);\n"
+    "      if (ret != 0)\n"
+    "        return ret;\n"
+    "      obj = item;\n"
+    "    }\n"
+    "    val->%s%s = obj;\n"
+    "  }\n",
+    kind,
+    m->base_type, m->base_type,
+    kind,
+    utype,
+    m->member_name, arr ? "[i]" : "");
+  free (utype);
+}
+
+
+static void write_load_bulk (const member_t *m, FILE *fc)
+{
+  if (m->opts.cardinality == CDN_VAR_ARRAY)
+  {
+    char *count;
+    if (asprintf (&count, "val->%s", m->opts.variable_array_size_member) < 0)
+      abort ();
+    write_presence_check (fc);
+    fprintf (fc,
+      "    %s *items = cser_alloc (b->alloc, val->%s, sizeof (%s));\n"
+      "    if (!items)\n"
+      "      return -ENOMEM;\n"
+      "    ret = ",
+      m->base_type, m->opts.variable_array_size_member, m->base_type);
+    write_bulk_call ("bload", m, "items", count, fc);
+    fprintf (fc,
+      ";\n"
+      "    if (ret != 0)\n"
+      "    {\n"
+      "      cser_free (b->alloc, items, val->%s * sizeof (%s));\n"
+      "      return ret;\n"
+      "    }\n"
+      "    val->%s = items;\n"
+      "  }\n",
+      m->opts.variable_array_size_member, m->base_type,
+      m->member_name);
+    free (count);
+  }
+  else
+  {
+    char *items, *count;
+    if (asprintf (&items, "val->%s", m->member_name) < 0 ||
+        asprintf (&count, "(%s)", m->opts.arr_sz) < 0)
+      abort ();
+    fputs ("    int ret = ", fc);
+    write_bulk_call ("bload", m, items, count, fc);
+    fputs (
+      ";\n"
+      "    if (ret != 0)\n"
+      "      return ret;\n", fc);
+    free (items);
+    free (count);
+  }
+}
+
+
+static bool write_load_member (const member_t *m, FILE *fc)
+{
+  fputs (" {\n", fc);
+  if (m->opts.shared)
+  {
+    write_load_shared (m, fc);
+    fputs (" }\n", fc);
+    return true;
+  }
+  if (is_bulk_member (m) || is_par_member (m))
+  {
+    write_load_bulk (m, fc);
+    fputs (" }\n", fc);
+    return true;
+  }
+  if (options->counted && m->opts.cardinality == CDN_ZEROTERM_ARRAY)
+  {
+    write_load_counted (m, fc);
+    fputs (" }\n", fc);
+    return true;
+  }
+  switch (m->opts.cardinality)
+  {
+    case CDN_VAR_ARRAY:
+      write_presence_check (fc);
+      // The offset table is only of use when loading single elements
+      if (m->opts.index)
+        fprintf (fc,
+          "    uint8_t width;\n"
+          "    ret = cser_raw_bget (b, &width, sizeof (width));\n"
+          "    if (ret == 0 && width != 0 && width != 4 && width != 8)\n"
+          "      ret = -EPROTO;\n"
+          "    if (ret == 0)\n"
+          "      ret = cser_raw_bskip (b, (uint64_t)width * val->%s);\n"
+          "    if (ret != 0)\n"
+          "      return ret;\n",
+          m->opts.variable_array_size_member);
+      fprintf (fc,
+        "    %s *items = cser_alloc (b->alloc, val->%s, sizeof (%s));\n"
+        "    if (!items)\n"
+        "      return -ENOMEM;\n",
+        m->base_type, m->opts.variable_array_size_member, m->base_type
+        );
+      fprintf (fc,
+        "    for (unsigned i = 0; i < val->%s; ++i)\n"
+        "    {\n",
+        m->opts.variable_array_size_member
+        );
+      write_load_item ("items[i]", m->base_type, "      ", false, is_varint_member (m), fc);
+      fprintf (fc,
+        "      if (ret != 0)\n"
+        "      {\n"
+        "        cser_free (b->alloc, items, val->%s * sizeof (%s));\n"
+        "        return ret;\n"
+        "      }\n"
+        "    }\n"
+        "    val->%s = items;\n"
+        "  }\n",
+        m->opts.variable_array_size_member, m->base_type,
+        m->member_name
+        );
+      break;
+    case CDN_ZEROTERM_ARRAY:
+      // This looks nothing like a normal array load, as it needs to
+      // incrementally load until it finds the end marker. A bog standard
+      // 2*n alloc/copy/retry approach is used for now.
+
+      write_presence_check (fc);
+      fprintf (fc,
+        "    %s *tmp = 0;\n"
+        "    size_t n = 0;\n"
+        "    size_t offs = 0;\n"
+        "    do {\n"
+        "      if (offs >= n)\n"
+        "      {\n"
+        "        size_t was = n;\n"
+        "        n = n ? 2 * n : 16;\n"
+        "        %s *grown = cser_realloc (b->alloc, tmp, was, n, sizeof (%s));\n"
+        "        if (!grown)\n"
+        "        {\n"
+        "          cser_free (b->alloc, tmp, was * sizeof (%s));\n"
+        "          return -ENOMEM;\n"
+        "        }\n"
+        "        tmp = grown;\n"
+        "        memset (tmp + offs, 0, (n - offs) * sizeof (%s));\n"
+        "      }\n"
+        , m->base_type
+        , m->base_type, m->base_type
+        , m->base_type
+        , m->base_type
+        );
+      write_load_item (
+        "tmp[offs++]", m->base_type, "      ", false, is_varint_member (m), fc);
+      fprintf (fc,
+        "      if (ret != 0)\n"
+        "      {\n"
+        "        cser_free (b->alloc, tmp, n * sizeof (%s));\n"
+        "        return ret;\n"
+        "      }\n"
+        "    } while (tmp[offs - 1]);\n"
+        "    val->%s = tmp;\n"
+        "  }\n",
+        m->base_type,
+        m->member_name
+        );
+      break;
+    case CDN_SINGLE:
+    {
+      if (m->opts.is_ptr)
+        write_presence_check (fc);
+      char *target;
+      if (asprintf (&target, "val->%s", m->member_name) < 0)
+        return false;
+      write_load_item (target, m->base_type, "      ", m->opts.is_ptr, is_varint_member (m), fc);
+      free (target);
+      fprintf (fc,
+        "    if (ret != 0)\n"
+        "      return ret;\n"
+        );
+      if (m->opts.is_ptr)
+        fputs ("  }\n", fc); // close presence check scope
+      break;
+    }
+    default:
+    {
+      fprintf (fc,
+        "  for (unsigned i = 0; i < (%s); ++i)\n"
+        "  {\n",
+        m->opts.arr_sz
+        );
+      if (m->opts.is_ptr)
+        write_presence_check (fc);
+      char *target;
+      if (asprintf (&target, "%sval->%s[i]",
+                    /*m->opts.is_ptr ? "" : "&"*/"", m->member_name) < 0)
+        return false;
+      write_load_item (target, m->base_type, "    ", m->opts.is_ptr, is_varint_member (m), fc);
+      free (target);
+      fprintf (fc,
+        "    if (ret != 0)\n"
+        "      return ret;\n"
+        );
+      if (m->opts.is_ptr)
+        fputs ("  }\n", fc); // close presence check scope
+      fputs ("  }\n", fc); // close loop scope
+      break;
+    }
+  }
+
+  fputs (" }\n", fc);
+  return true;
+}
+
+
+// Members past the 64th can not be selected, and are always loaded, as are
+// those needed to load the others: array sizes, shared objects (which may
+// be referred to later on) and the links of lists.
+static bool is_skippable (const type_t *type, const member_t *m, unsigned k)
+{
+  if (k >= 64 || m->opts.shared || m == list_link (type) ||
+      reaches_shared (lookup_type (m->base_type)))
+    return false;
+  for (const member_t *o = type->composite; o; o = o->next)
+    if (o->opts.variable_array_size_member &&
+        strcmp (o->opts.variable_array_size_member, m->member_name) == 0)
+      return false;
+  return true;
+}
+
+
+// Composites are passed over by a function of their own, unless they have
+// a fixed size on the wire.
+static bool needs_skip (const type_t *t)
+{
+  return
+    t && t->csfn == TYPE_COMPOSITE && !is_fixed_wire (t) && !reaches_shared (t);
+}
+
+
+// Passing over values is needed for -S, and to load single elements of
+// indexed arrays too short to have an offset table.
+static bool writes_skip (void)
+{
+  bool any = options->masked;
+  for (const type_list_t *l = all_types; l && !any; l = l->next)
+    any = has_index (&l->def);
+  return any;
+}
+
+
+// Passes over count items of the member's type, setting "ret"
+static void write_skip_items (
+  const member_t *m, const char *count, const char *indent, FILE *fc)
+{
+  const type_t *t = lookup_type (m->base_type);
+  if (t && t->csfn == TYPE_NATIVE &&
+      (is_varint_member (m) || is_varint_native (m->base_type)))
+    fprintf (fc,
+      "%sfor (uint64_t i = 0; ret == 0 && i < (uint64_t)(%s); ++i)\n"
+      "%s{\n"
+      "%s  uint64_t v;\n"
+      "%s  ret = cser_raw_bget_varint (b, &v);\n"
+      "%s}\n",
+      indent, count,
+      indent,
+      indent,
+      indent,
+      indent);
+  else if (t && t->csfn == TYPE_NATIVE)
+    fprintf (fc, "%sret = cser_raw_bskip (b, (uint64_t)(%s) * sizeof (%s));\n",
+      indent, count, m->base_type);
+  else
+  {
+    char *utype = make_cname (m->base_type);
+    if (is_fixed_wire (t))
+      fprintf (fc, "%sret = cser_raw_bskip (b, (uint64_t)(%s) * CSER_RAW_MAX_BSIZE_%s);\n",
+        indent, count, utype);
+    else
+      fprintf (fc,
+        "%sfor (uint64_t i = 0; ret == 0 && i < (uint64_t)(%s); ++i)\n"
+        "%s  ret = cser_raw_bskip_%s (b);\n",
+        indent, count,
+        indent, utype);
+    free (utype);
+  }
+}
+
+
+// Passes over a member, without allocating anything for it. Array sizes
+// are taken from "val", as when loading.
+static void write_skip_member (const member_t *m, FILE *fc)
+{
+  fputs (
+    " {\n"
+    "  int ret = 0;\n", fc);
+  bool presence =
+    m->opts.cardinality == CDN_VAR_ARRAY ||
+    m->opts.cardinality == CDN_ZEROTERM_ARRAY ||
+    (m->opts.cardinality == CDN_SINGLE && m->opts.is_ptr);
+  if (m->opts.cardinality == CDN_FIXED_ARRAY && m->opts.is_ptr)
+    fprintf (fc,
+      "  for (size_t j = 0; ret == 0 && j < (%s); ++j)\n"
+      "  {\n"
+      "   uint8_t present;\n"
+      "   ret = cser_raw_bget (b, &present, sizeof (present));\n"
+      "   if (ret == 0 && present)\n"
+      "   {\n",
+      m->opts.arr_sz);
+  else if (presence)
+    fputs (
+      "  uint8_t present;\n"
+      "  ret = cser_raw_bget (b, &present, sizeof (present));\n"
+      "  if (ret == 0 && present)\n"
+      "  {\n", fc);
+
+  switch (m->opts.cardinality)
+  {
+    case CDN_SINGLE:
+      write_skip_items (m, "1", "    ", fc);
+      break;
+    case CDN_FIXED_ARRAY:
+      if (m->opts.is_ptr)
+        write_skip_items (m, "1", "     ", fc);
+      else
+        write_skip_items (m, m->opts.arr_sz, "  ", fc);
+      break;
+    case CDN_VAR_ARRAY:
+    {
+      char *count;
+      if (asprintf (&count, "val->%s", m->opts.variable_array_size_member) < 0)
+        abort ();
+      if (m->opts.index)
+        fprintf (fc,
+          "    uint8_t width;\n"
+          "    ret = cser_raw_bget (b, &width, sizeof (width));\n"
+          "    if (ret == 0 && width != 0 && width != 4 && width != 8)\n"
+          "      ret = -EPROTO;\n"
+          "    if (ret == 0)\n"
+          "      ret = cser_raw_bskip (b, (uint64_t)width * %s);\n"
+          "    if (ret == 0)\n"
+          "    {\n",
+          count);
+      write_skip_items (m, count, m->opts.index ? "      " : "    ", fc);
+      if (m->opts.index)
+        fputs ("    }\n", fc);
+      free (count);
+      break;
+    }
+    case CDN_ZEROTERM_ARRAY:
+      if (options->counted)
+      {
+        fputs (
+          "    uint64_t n = 0;\n"
+          "    ret = cser_raw_bget_varint (b, &n);\n"
+          "    if (ret == 0)\n"
+          "    {\n", fc);
+        write_skip_items (m, "n", "      ", fc);
+        fputs ("    }\n", fc);
+      }
+      else if (is_char_native (m->base_type))
+        fputs ("    ret = cser_raw_bskip_string (b);\n", fc);
+      else
+      {
+        char *utype = codec_name (m->base_type, is_varint_member (m));
+        fprintf (fc,
+          "    %s item;\n"
+          "    do\n"
+          "      ret = cser_raw_bload_%s (&item, b);\n"
+          "    while (ret == 0 && item);\n",
+          m->base_type,
+          utype);
+        free (utype);
+      }
+      break;
+  }
+
+  if (m->opts.cardinality == CDN_FIXED_ARRAY && m->opts.is_ptr)
+    fputs ("   }\n  }\n", fc);
+  else if (presence)
+    fputs ("  }\n", fc);
+  fputs (
+    "  if (ret != 0)\n"
+    "    return ret;\n"
+    " }\n", fc);
+}
+
+
+// With "masked" set, this writes the loader of selected members only,
+// which passes over the others and leaves them zeroed.
+static bool write_load_struct (
+  const type_t *type, bool masked, FILE *fh, FILE *fc)
+{
+  char *utype = make_cname (type->type_name);
+  const char *fields = masked ? "fields_" : "";
+  const char *param = masked ? ", uint64_t fields" : "";
+
+  fprintf (fh,
+    "int cser_raw_bload_%s%s (%s *val%s, cser_raw_buf_t *b);\n",
+    fields, utype, type->type_name, param);
+
+  fprintf (fc,
+    "int cser_raw_bload_%s%s (%s *val%s, cser_raw_buf_t *b)\n"
+    "{\n",
+    fields, utype, type->type_name, param);
+  if (is_pod (type) && !masked)
+    fprintf (fc,
+      "  if (CSER_RAW_POD_%s)\n"
+      "    return cser_raw_bget (b, (uint8_t *)val, sizeof (*val));\n",
+      utype);
+
+  free (utype);
+  utype = 0;
+
+  // Members of tagged structs may come in any order, or not at all, and
+  // any not known here are skipped
+  bool tagged = is_tagged (type);
+  const member_t *link = list_link (type);
+  if (masked && !tagged)
+    fputs ("  memset (val, 0, sizeof (*val));\n", fc);
+  if (link)
+    fputs ("  for (;;)\n  {\n", fc);
+  if (tagged)
+    fputs (
+      "  memset (val, 0, sizeof (*val));\n"
+      "  for (;;)\n"
+      "  {\n"
+      "   uint64_t id = 0, len = 0;\n"
+      "   int ret = cser_raw_bget_tag (b, &id, &len);\n"
+      "   if (ret != 0)\n"
+      "     return ret;\n"
+      "   if (id == 0)\n"
+      "     break;\n"
+      "   switch (id)\n"
+      "   {\n", fc);
+
+  unsigned k = 0;
+  for (member_t *m = type->composite; m; m = m->next, ++k)
+  {
+    if (m == link)
+      break;
+    if (tagged)
+      fprintf (fc, "%s   case %uu:\n",
+        m == type->composite ? "" : "   break;\n", member_id (m));
+    bool skippable = masked && is_skippable (type, m, k);
+    if (skippable && tagged)
+      fprintf (fc,
+        "  if (!(fields & CSER_RAW_FIELD_BIT (%u)))\n"
+        "  {\n"
+        "    ret = cser_raw_bskip (b, len);\n"
+        "    if (ret != 0)\n"
+        "      return ret;\n"
+        "    break;\n"
+        "  }\n",
+        k);
+    else if (skippable)
+      fprintf (fc, "  if (fields & CSER_RAW_FIELD_BIT (%u))\n", k);
+    if (!write_load_member (m, fc))
+      return false;
+    if (skippable && !tagged)
+    {
+      fputs ("  else\n", fc);
+      write_skip_member (m, fc);
+    }
+  }
+
+  if (tagged)
+    fputs (
+      "   break;\n"
+      "   default:\n"
+      "     ret = cser_raw_bskip (b, len);\n"
+      "     if (ret != 0)\n"
+      "       return ret;\n"
+      "   }\n"
+      "  }\n", fc);
+
+  // Each new list item is appended at the tail, and then loaded in turn
+  if (link)
+    fprintf (fc,
+      "   uint8_t present;\n"
+      "   int ret = cser_raw_bget (b, &present, sizeof (present));\n"
+      "   if (ret != 0)\n"
+      "     return ret;\n"
+      "   if (!present)\n"
+      "   {\n"
+      "     val->%s = 0;\n"
+      "     break;\n"
+      "   }\n"
+      "   %s *item = cser_alloc (b->alloc, 1, sizeof (%s));\n"
+      "   if (!item)\n"
+      "     return -ENOMEM;\n"
+      "   val->%s = item;\n"
+      "   val = item;\n"
+      "  }\n",
+      link->member_name,
+      type->type_name, type->type_name,
+      link->member_name);
+
+  fputs ("  return 0;\n}\n", fc);
+
+  return !ferror (fh) && !ferror (fc);
+}
+
+
+// Passes over a value of the type, unless that is a matter of a fixed
+// number of bytes (see needs_skip ()).
+static bool write_skip_struct (const type_t *type, FILE *fc)
+{
+  if (!needs_skip (type))
+    return true;
+  char *utype = make_cname (type->type_name);
+  fprintf (fc,
+    "static inline int cser_raw_bskip_%s (cser_raw_buf_t *b)\n"
+    "{\n",
+    utype);
+  const member_t *link = list_link (type);
+  if (is_tagged (type))
+    fputs (
+      "  for (;;)\n"
+      "  {\n"
+      "    uint64_t id = 0, len = 0;\n"
+      "    int ret = cser_raw_bget_tag (b, &id, &len);\n"
+      "    if (ret != 0 || id == 0)\n"
+      "      return ret;\n"
+      "    ret = cser_raw_bskip (b, len);\n"
+      "    if (ret != 0)\n"
+      "      return ret;\n"
+      "  }\n"
+      "}\n", fc);
+  else
+  {
+    // Array sizes are loaded as usual, to know how much to pass over
+    fprintf (fc,
+      "  %s tmp;\n"
+      "  %s *val = &tmp;\n"
+      "  memset (val, 0, sizeof (*val));\n",
+      type->type_name,
+      type->type_name);
+    if (link)
+      fputs ("  for (;;)\n  {\n", fc);
+    for (const member_t *m = type->composite; m != link; m = m->next)
+    {
+      if (is_skippable (type, m, 0))
+        write_skip_member (m, fc);
+      else if (!write_load_member (m, fc))
+        return false;
+    }
+    if (link)
+      fputs (
+        "   uint8_t present;\n"
+        "   int ret = cser_raw_bget (b, &present, sizeof (present));\n"
+        "   if (ret != 0)\n"
+        "     return ret;\n"
+        "   if (!present)\n"
+        "     break;\n"
+        "  }\n", fc);
+    fputs (
+      "  return 0;\n"
+      "}\n", fc);
+  }
+  free (utype);
+  return !ferror (fc);
+}
+
+
+// Member selection, for -S. Each struct gets an enum of its member ids,
+// and loaders taking a mask of the members wanted.
+static bool write_fields (const type_t *type, FILE *fh, FILE *fc)
+{
+  char *utype = make_cname (type->type_name);
+
+  fputs ("enum\n{\n", fh);
+  unsigned k = 0;
+  for (const member_t *m = type->composite; m && k < 64; m = m->next, ++k)
+    fprintf (fh, "  CSER_RAW_FIELD_%s_%s = %u,\n", utype, m->member_name, k);
+  fprintf (fh,
+    "};\n"
+    "int cser_raw_load_fields_%s (%s *val, uint64_t fields, cser_raw_read_fn r, void *q, const cser_alloc_t *alloc);\n",
+    utype, type->type_name);
+
+  if (!write_load_struct (type, true, fh, fc))
+    return false;
+
+  fprintf (fc,
+    "int cser_raw_load_fields_%s (%s *val, uint64_t fields, cser_raw_read_fn r, void *q, const cser_alloc_t *alloc)\n"
+    "{\n",
+    utype, type->type_name);
+  write_stats_enter (type, "load", "r", "read", true, fc);
+  fputs ("  cser_raw_buf_t b = { .r = r, .q = q, .alloc = alloc };\n", fc);
+  write_header_load (utype, fc);
+  fprintf (fc,
+    "  if (ret == 0)\n"
+    "    ret = cser_raw_bload_fields_%s (val, fields, &b);\n"
+    "  cser_raw_refs_release (&b);\n",
+    utype);
+  write_stats_return (type, fc);
+  fputs ("}\n", fc);
+
+  free (utype);
+  return !ferror (fh) && !ferror (fc);
+}
+
+
+// Comparison of single items, or of those pointed to, as an expression
+static char *item_equal (
+  const member_t *m, const char *x, const char *y, bool pointed)
+{
+  char *expr;
+  const type_t *t = lookup_type (m->base_type);
+  if (t && t->csfn == TYPE_COMPOSITE)
+  {
+    char *utype = make_cname (m->base_type);
+    if (asprintf (&expr, "cser_raw_equal_%s (%s%s, %s%s)", utype,
+          pointed ? "" : "&", x, pointed ? "" : "&", y) < 0)
+      abort ();
+    free (utype);
+  }
+  else if (asprintf (&expr, "%s%s == %s%s",
+             pointed ? "*" : "", x, pointed ? "*" : "", y) < 0)
+    abort ();
+  return expr;
+}
+
+
+// Sets "same" according to whether a member holds the same in x and y.
+// Pointers to the same place are taken to point to the same values.
+static void write_equal_member (
+  const member_t *m, const char *x, const char *y, FILE *fc)
+{
+  const char *name = m->member_name;
+  const type_t *t = lookup_type (m->base_type);
+  bool native = !t || t->csfn != TYPE_COMPOSITE;
+  char *ix, *iy, *eq;
+  switch (m->opts.cardinality)
+  {
+    case CDN_SINGLE:
+      if (asprintf (&ix, "%s->%s", x, name) < 0 ||
+          asprintf (&iy, "%s->%s", y, name) < 0)
+        abort ();
+      eq = item_equal (m, ix, iy, m->opts.is_ptr);
+      if (m->opts.is_ptr)
+        fprintf (fc,
+          "  same = %s->%s == %s->%s || (%s->%s && %s->%s && %s);\n",
+          x, name, y, name, x, name, y, name, eq);
+      else
+        fprintf (fc, "  same = %s;\n", eq);
+      break;
+    case CDN_FIXED_ARRAY:
+      if (asprintf (&ix, "%s->%s[i]", x, name) < 0 ||
+          asprintf (&iy, "%s->%s[i]", y, name) < 0)
+        abort ();
+      eq = item_equal (m, ix, iy, m->opts.is_ptr);
+      if (native && !m->opts.is_ptr)
+        fprintf (fc,
+          "  same = memcmp (%s->%s, %s->%s, sizeof (%s->%s)) == 0;\n",
+          x, name, y, name, y, name);
+      else if (m->opts.is_ptr)
+        fprintf (fc,
+          "  same = true;\n"
+          "  for (size_t i = 0; same && i < (%s); ++i)\n"
+          "    same = %s->%s[i] == %s->%s[i] || (%s->%s[i] && %s->%s[i] && %s);\n",
+          m->opts.arr_sz,
+          x, name, y, name, x, name, y, name, eq);
+      else
+        fprintf (fc,
+          "  same = true;\n"
+          "  for (size_t i = 0; same && i < (%s); ++i)\n"
+          "    same = %s;\n",
+          m->opts.arr_sz,
+          eq);
+      break;
+    case CDN_VAR_ARRAY:
+      if (asprintf (&ix, "%s->%s[i]", x, name) < 0 ||
+          asprintf (&iy, "%s->%s[i]", y, name) < 0)
+        abort ();
+      eq = item_equal (m, ix, iy, false);
+      fprintf (fc,
+        "  same = %s->%s == %s->%s && (%s->%s == %s->%s || (%s->%s && %s->%s));\n"
+        "  if (same && %s->%s != %s->%s)\n",
+        x, m->opts.variable_array_size_member, y, m->opts.variable_array_size_member,
+        x, name, y, name, x, name, y, name,
+        x, name, y, name);
+      if (native)
+        fprintf (fc,
+          "    same = memcmp (%s->%s, %s->%s, (size_t)%s->%s * sizeof (*%s->%s)) == 0;\n",
+          x, name, y, name, y, m->opts.variable_array_size_member, y, name);
+      else
+        fprintf (fc,
+          "    for (size_t i = 0; same && i < (size_t)%s->%s; ++i)\n"
+          "      same = %s;\n",
+          y, m->opts.variable_array_size_member,
+          eq);
+      break;
+    case CDN_ZEROTERM_ARRAY:
+    default:
+      ix = iy = 0;
+      eq = 0;
+      if (is_char_native (m->base_type))
+        fprintf (fc,
+          "  same = %s->%s == %s->%s || (%s->%s && %s->%s && strcmp ((const char *)%s->%s, (const char *)%s->%s) == 0);\n",
+          x, name, y, name, x, name, y, name, x, name, y, name);
+      else
+        fprintf (fc,
+          "  same = %s->%s == %s->%s || (%s->%s && %s->%s);\n"
+          "  for (size_t i = 0; same && %s->%s != %s->%s; ++i)\n"
+          "  {\n"
+          "    same = %s->%s[i] == %s->%s[i];\n"
+          "    if (!%s->%s[i])\n"
+          "      break;\n"
+          "  }\n",
+          x, name, y, name, x, name, y, name,
+          x, name, y, name,
+          x, name, y, name,
+          x, name);
+      break;
+  }
+  free (ix);
+  free (iy);
+  free (eq);
+}
+
+
+static bool write_equal_struct (const type_t *type, FILE *fh, FILE *fc)
+{
+  char *utype = make_cname (type->type_name);
+  fprintf (fh,
+    "bool cser_raw_equal_%s (const %s *x, const %s *y);\n",
+    utype, type->type_name, type->type_name);
+  fprintf (fc,
+    "bool cser_raw_equal_%s (const %s *x, const %s *y)\n"
+    "{\n"
+    "  bool same;\n",
+    utype, type->type_name, type->type_name);
+  free (utype);
+
+  // Lists are walked, as when storing them
+  const member_t *link = list_link (type);
+  if (link)
+    fputs ("  for (;;)\n  {\n", fc);
+  for (const member_t *m = type->composite; m != link; m = m->next)
+  {
+    write_equal_member (m, "x", "y", fc);
+    fputs (
+      "  if (!same)\n"
+      "    return false;\n", fc);
+  }
+  if (link)
+    fprintf (fc,
+      "  if (x->%s == y->%s)\n"
+      "    return true;\n"
+      "  if (!x->%s || !y->%s)\n"
+      "    return false;\n"
+      "  x = x->%s;\n"
+      "  y = y->%s;\n"
+      "  }\n"
+      "}\n",
+      link->member_name, link->member_name,
+      link->member_name, link->member_name,
+      link->member_name,
+      link->member_name);
+  else
+    fputs ("  return true;\n}\n", fc);
+  return !ferror (fh) && !ferror (fc);
+}
+
+
+typedef enum
+{
+  DELTA_FULL,   // the member is written out in full
+  DELTA_NESTED, // the delta of a struct
+  DELTA_RUNS,   // runs of changed elements of an array
+} delta_kind_t;
+
+
+static delta_kind_t delta_kind (const member_t *m)
+{
+  const type_t *t = lookup_type (m->base_type);
+  bool composite = t && t->csfn == TYPE_COMPOSITE;
+  switch (m->opts.cardinality)
+  {
+    case CDN_SINGLE:
+      return composite ? DELTA_NESTED : DELTA_FULL;
+    case CDN_FIXED_ARRAY:
+      return m->opts.is_ptr ? DELTA_FULL : DELTA_RUNS;
+    case CDN_VAR_ARRAY:
+      return m->opts.is_ptr == 1 ? DELTA_RUNS : DELTA_FULL;
+    default:
+      return DELTA_FULL;
+  }
+}
+
+
+// Both sides use the same state to tell whether the delta of a struct or
+// array follows, or the member in full: a pointer present before and
+// after, or an array of unchanged size.
+static const char *delta_mode (const member_t *m, char *buf, size_t len)
+{
+  if (m->opts.cardinality == CDN_VAR_ARRAY)
+    snprintf (buf, len, "base->%s == val->%s && base->%s && val->%s",
+      m->opts.variable_array_size_member, m->opts.variable_array_size_member,
+      m->member_name, m->member_name);
+  else if (m->opts.is_ptr)
+    snprintf (buf, len, "base->%s && val->%s", m->member_name, m->member_name);
+  else
+    return 0;
+  return buf;
+}
+
+
+// Runs of changed elements go out as the number of unchanged ones before
+// the run, the number in the run, and the elements (or their deltas),
+// ending with an empty run.
+static void write_delta_runs (const member_t *m, const char *count, FILE *fc)
+{
+  const type_t *t = lookup_type (m->base_type);
+  char *utype = codec_name (m->base_type, is_varint_member (m));
+  char *ix, *iy, *eq;
+  if (asprintf (&ix, "base->%s[i]", m->member_name) < 0 ||
+      asprintf (&iy, "val->%s[i]", m->member_name) < 0)
+    abort ();
+  eq = item_equal (m, ix, iy, false);
+  fprintf (fc,
+    "   size_t i = 0;\n"
+    "   for (;;)\n"
+    "   {\n"
+    "    size_t from = i;\n"
+    "    while (i < (size_t)(%s) && %s)\n"
+    "      ++i;\n"
+    "    size_t start = i;\n"
+    "    while (i < (size_t)(%s) && !(%s))\n"
+    "      ++i;\n"
+    "    ret = cser_raw_bput_varint (b, start - from);\n"
+    "    if (ret == 0)\n"
+    "      ret = cser_raw_bput_varint (b, i - start);\n"
+    "    for (size_t j = start; ret == 0 && j < i; ++j)\n",
+    count, eq,
+    count, eq);
+  if (t && t->csfn == TYPE_COMPOSITE)
+    fprintf (fc,
+      "      ret = cser_raw_bstore_delta_%s (&base->%s[j], &val->%s[j], b);\n",
+      utype, m->member_name, m->member_name);
+  else
+    fprintf (fc,
+      "      ret = cser_raw_bstore_%s (&val->%s[j], b);\n",
+      utype, m->member_name);
+  fputs (
+    "    if (ret != 0)\n"
+    "      return ret;\n"
+    "    if (i == start)\n"
+    "      break;\n"
+    "   }\n", fc);
+  free (ix);
+  free (iy);
+  free (eq);
+  free (utype);
+}
+
+
+static void write_apply_runs (const member_t *m, const char *count, FILE *fc)
+{
+  const type_t *t = lookup_type (m->base_type);
+  char *utype = codec_name (m->base_type, is_varint_member (m));
+  fprintf (fc,
+    "   size_t i = 0;\n"
+    "   for (;;)\n"
+    "   {\n"
+    "    uint64_t gap = 0, len = 0;\n"
+    "    ret = cser_raw_bget_varint (b, &gap);\n"
+    "    if (ret == 0)\n"
+    "      ret = cser_raw_bget_varint (b, &len);\n"
+    "    if (ret == 0 && (gap > (size_t)(%s) - i || len > (size_t)(%s) - i - gap))\n"
+    "      ret = -EPROTO;\n"
+    "    if (ret != 0)\n"
+    "      return ret;\n"
+    "    if (len == 0)\n"
+    "      break;\n"
+    "    i += gap;\n"
+    "    for (size_t j = i; ret == 0 && j < i + len; ++j)\n",
+    count, count);
+  if (t && t->csfn == TYPE_COMPOSITE)
+    fprintf (fc,
+      "      ret = cser_raw_bapply_delta_%s (&val->%s[j], b);\n",
+      utype, m->member_name);
+  else
+    fprintf (fc,
+      "      ret = cser_raw_bload_%s (&val->%s[j], b);\n",
+      utype, m->member_name);
+  fputs (
+    "    if (ret != 0)\n"
+    "      return ret;\n"
+    "    i += len;\n"
+    "   }\n", fc);
+  free (utype);
+}
+
+
+static void write_delta_member (const member_t *m, FILE *fc)
+{
+  char buf[512];
+  const char *mode = delta_mode (m, buf, sizeof (buf));
+  delta_kind_t kind = delta_kind (m);
+  if (kind == DELTA_FULL)
+  {
+    write_store_member (m, fc);
+    return;
+  }
+
+  fputs ("  {\n", fc);
+  if (mode)
+    fprintf (fc,
+      "   uint8_t mode = (%s);\n"
+      "   int ret = cser_raw_bput (b, &mode, sizeof (mode));\n"
+      "   if (ret != 0)\n"
+      "     return ret;\n"
+      "   if (!mode)\n",
+      mode);
+  else
+    fputs ("   int ret = 0;\n", fc);
+  if (mode)
+  {
+    write_store_member (m, fc);
+    fputs ("   else\n   {\n", fc);
+  }
+  if (kind == DELTA_NESTED)
+  {
+    char *utype = make_cname (m->base_type);
+    fprintf (fc,
+      "   ret = cser_raw_bstore_delta_%s (%sbase->%s, %sval->%s, b);\n"
+      "   if (ret != 0)\n"
+      "     return ret;\n",
+      utype,
+      m->opts.is_ptr ? "" : "&", m->member_name,
+      m->opts.is_ptr ? "" : "&", m->member_name);
+    free (utype);
+  }
+  else
+  {
+    char *count;
+    if (asprintf (&count, "%s%s",
+          mode ? "val->" : "",
+          mode ? m->opts.variable_array_size_member : m->opts.arr_sz) < 0)
+      abort ();
+    write_delta_runs (m, count, fc);
+    free (count);
+  }
+  if (mode)
+    fputs ("   }\n", fc);
+  fputs ("  }\n", fc);
+}
+
+
+// Hands back what a member of x points to, as loaded with the allocator
+// "alloc". Varlen arrays hold "count" elements.
+static void write_release_member (
+  const member_t *m, const char *x, const char *count, const char *alloc,
+  FILE *fc)
+{
+  const char *name = m->member_name;
+  const type_t *t = lookup_type (m->base_type);
+  char *utype = 0;
+  if (t && t->csfn == TYPE_COMPOSITE)
+    utype = make_cname (m->base_type);
+  switch (m->opts.cardinality)
+  {
+    case CDN_SINGLE:
+      if (!m->opts.is_ptr)
+      {
+        if (utype)
+          fprintf (fc, "  cser_raw_release_%s (&%s->%s, %s);\n",
+            utype, x, name, alloc);
+        break;
+      }
+      fprintf (fc, "  if (%s->%s)\n  {\n", x, name);
+      if (utype)
+        fprintf (fc, "    cser_raw_release_%s (%s->%s, %s);\n",
+          utype, x, name, alloc);
+      fprintf (fc,
+        "    cser_free (%s, %s->%s, sizeof (%s));\n"
+        "  }\n",
+        alloc, x, name, m->base_type);
+      break;
+    case CDN_FIXED_ARRAY:
+      if (!m->opts.is_ptr && !utype)
+        break;
+      fprintf (fc, "  for (size_t i = 0; i < (%s); ++i)\n  {\n", m->opts.arr_sz);
+      if (!m->opts.is_ptr)
+        fprintf (fc, "    cser_raw_release_%s (&%s->%s[i], %s);\n",
+          utype, x, name, alloc);
+      else
+      {
+        fprintf (fc, "    if (%s->%s[i])\n    {\n", x, name);
+        if (utype)
+          fprintf (fc, "      cser_raw_release_%s (%s->%s[i], %s);\n",
+            utype, x, name, alloc);
+        fprintf (fc,
+          "      cser_free (%s, %s->%s[i], sizeof (%s));\n"
+          "    }\n",
+          alloc, x, name, m->base_type);
+      }
+      fputs ("  }\n", fc);
+      break;
+    case CDN_VAR_ARRAY:
+      fprintf (fc, "  if (%s->%s)\n  {\n", x, name);
+      if (utype)
+        fprintf (fc,
+          "    for (size_t i = 0; i < (size_t)(%s); ++i)\n"
+          "      cser_raw_release_%s (&%s->%s[i], %s);\n",
+          count,
+          utype, x, name, alloc);
+      fprintf (fc,
+        "    cser_free (%s, %s->%s, (size_t)(%s) * sizeof (%s));\n"
+        "  }\n",
+        alloc, x, name, count, m->base_type);
+      break;
+    case CDN_ZEROTERM_ARRAY:
+    default:
+      // At least this much was allocated, up to and including the terminator
+      fprintf (fc, "  if (%s->%s)\n  {\n", x, name);
+      if (is_char_native (m->base_type))
+        fprintf (fc, "    size_t n = strlen ((const char *)%s->%s);\n", x, name);
+      else
+        fprintf (fc,
+          "    size_t n = 0;\n"
+          "    while (%s->%s[n])\n"
+          "      ++n;\n",
+          x, name);
+      fprintf (fc,
+        "    cser_free (%s, %s->%s, (n + 1) * sizeof (%s));\n"
+        "  }\n",
+        alloc, x, name, m->base_type);
+      break;
+  }
+  free (utype);
+}
+
+
+// Releases everything a value owns, though not the value itself, for the
+// members replaced when applying deltas. The nodes of a list are released
+// in turn rather than recursively.
+static bool write_release (const type_t *type, FILE *fc)
+{
+  char *utype = make_cname (type->type_name);
+  const member_t *link = list_link (type);
+  fprintf (fc,
+    "static inline void cser_raw_release_%s (%s *val, const cser_alloc_t *alloc)\n"
+    "{\n"
+    "  (void)val;\n"
+    "  (void)alloc;\n",
+    utype, type->type_name);
+  free (utype);
+  const char *x = "val";
+  if (link)
+  {
+    fprintf (fc,
+      "  for (%s *node = val, *next; node; node = next)\n"
+      "  {\n"
+      "  next = node->%s;\n",
+      type->type_name, link->member_name);
+    x = "node";
+  }
+  for (const member_t *m = type->composite; m != link; m = m->next)
+  {
+    char *count = 0;
+    if (m->opts.cardinality == CDN_VAR_ARRAY &&
+        asprintf (&count, "%s->%s", x, m->opts.variable_array_size_member) < 0)
+      return false;
+    write_release_member (m, x, count, "alloc", fc);
+    free (count);
+  }
+  if (link)
+    fputs (
+      "  if (node != val)\n"
+      "    cser_free (alloc, node, sizeof (*node));\n"
+      "  }\n", fc);
+  fputs ("}\n", fc);
+  return !ferror (fc);
+}
+
+
+// Members replaced in full are released and zeroed first, as loads expect
+static void write_replace_member (const member_t *m, FILE *fc)
+{
+  char *count = 0;
+  if (m->opts.cardinality == CDN_VAR_ARRAY &&
+      asprintf (&count, "count_%s", m->member_name) < 0)
+    abort ();
+  write_release_member (m, "val", count, "b->alloc", fc);
+  fprintf (fc, "  memset (&val->%s, 0, sizeof (val->%s));\n",
+    m->member_name, m->member_name);
+  write_load_member (m, fc);
+  free (count);
+}
+
+
+// Runs of a varlen array are checked against its count from before the
+// delta, which a valid one never changes along with them (see
+// write_apply_counts ()).
+static void write_apply_member (const member_t *m, const char *size_changed, FILE *fc)
+{
+  char buf[512];
+  const char *mode = delta_mode (m, buf, sizeof (buf));
+  delta_kind_t kind = delta_kind (m);
+  if (kind == DELTA_FULL)
+  {
+    write_replace_member (m, fc);
+    return;
+  }
+
+  fputs ("  {\n", fc);
+  if (mode)
+  {
+    fputs (
+      "   uint8_t mode;\n"
+      "   int ret = cser_raw_bget (b, &mode, sizeof (mode));\n"
+      "   if (ret != 0)\n"
+      "     return ret;\n"
+      "   if (!mode)\n"
+      "   {\n", fc);
+    write_replace_member (m, fc);
+    fprintf (fc,
+      "   }\n"
+      "   else\n"
+      "   {\n"
+      "   if (!val->%s%s%s)\n"
+      "     return -EPROTO;\n",
+      m->member_name,
+      size_changed ? " || " : "", size_changed ? size_changed : "");
+  }
+  else
+    fputs ("   int ret = 0;\n", fc);
+  if (kind == DELTA_NESTED)
+  {
+    char *utype = make_cname (m->base_type);
+    fprintf (fc,
+      "   ret = cser_raw_bapply_delta_%s (%sval->%s, b);\n"
+      "   if (ret != 0)\n"
+      "     return ret;\n",
+      utype,
+      m->opts.is_ptr ? "" : "&", m->member_name);
+    free (utype);
+  }
+  else
+  {
+    char *count;
+    if (asprintf (&count, "%s%s",
+          mode ? "count_" : "",
+          mode ? m->member_name : m->opts.arr_sz) < 0)
+      abort ();
+    write_apply_runs (m, count, fc);
+    free (count);
+  }
+  if (mode)
+    fputs ("   }\n", fc);
+  fputs ("  }\n", fc);
+}
+
+
+// The counts of varlen arrays are saved before any member is applied, as
+// the count member may come first and be replaced. They bound the runs,
+// and tell how much to release of arrays replaced in full.
+static void write_apply_counts (const type_t *type, const member_t *link, FILE *fc)
+{
+  for (const member_t *m = type->composite; m != link; m = m->next)
+    if (m->opts.cardinality == CDN_VAR_ARRAY)
+      fprintf (fc, "  size_t count_%s = (size_t)val->%s;\n",
+        m->member_name, m->opts.variable_array_size_member);
+}
+
+
+// The changed bit of the count member of a varlen array, as a condition
+static char *count_changed (const type_t *type, const member_t *m)
+{
+  if (m->opts.cardinality != CDN_VAR_ARRAY || delta_kind (m) != DELTA_RUNS)
+    return 0;
+  unsigned k = 0;
+  for (const member_t *c = type->composite; c; c = c->next, ++k)
+  {
+    if (strcmp (c->member_name, m->opts.variable_array_size_member) != 0)
+      continue;
+    char *cond;
+    if (asprintf (&cond, "(changed[%u] & 0x%02x)", k / 8, 1u << (k % 8)) < 0)
+      abort ();
+    return cond;
+  }
+  return 0;
+}
+
+
+// Deltas, for -D. A struct's delta is a bitmap of the members changed
+// from the base value, followed by those members. Lists are walked, with
+// the link deemed changed unless it is the same pointer in both, so each
+// node is only compared once.
+static bool write_delta (const type_t *type, FILE *fh, FILE *fc)
+{
+  if (!write_equal_struct (type, fh, fc) || !write_release (type, fc))
+    return false;
+
+  char *utype = make_cname (type->type_name);
+  const member_t *link = list_link (type);
+  unsigned n = 0;
+  for (const member_t *m = type->composite; m; m = m->next)
+    ++n;
+
+  fprintf (fh,
+    "int cser_raw_bstore_delta_%s (const %s *base, const %s *val, cser_raw_buf_t *b);\n"
+    "int cser_raw_bapply_delta_%s (%s *val, cser_raw_buf_t *b);\n"
+    "int cser_raw_store_delta_%s (const %s *base, const %s *val, cser_raw_write_fn w, void *q);\n"
+    "int cser_raw_apply_delta_%s (%s *val, cser_raw_read_fn r, void *q, const cser_alloc_t *alloc);\n",
+    utype, type->type_name, type->type_name,
+    utype, type->type_name,
+    utype, type->type_name, type->type_name,
+    utype, type->type_name);
+
+  fprintf (fc,
+    "int cser_raw_bstore_delta_%s (const %s *base, const %s *val, cser_raw_buf_t *b)\n"
+    "{\n",
+    utype, type->type_name, type->type_name);
+  if (link)
+    fputs ("  for (;;)\n  {\n", fc);
+  fprintf (fc,
+    "  uint8_t changed[%u] = { 0 };\n"
+    "  bool same;\n",
+    (n + 7) / 8);
+  unsigned k = 0;
+  for (const member_t *m = type->composite; m; m = m->next, ++k)
+  {
+    if (m == link)
+      fprintf (fc, "  same = base->%s == val->%s;\n",
+        m->member_name, m->member_name);
+    else
+      write_equal_member (m, "base", "val", fc);
+    fprintf (fc,
+      "  if (!same)\n"
+      "    changed[%u] |= 0x%02x;\n",
+      k / 8, 1u << (k % 8));
+  }
+  fputs (
+    "  int ret = cser_raw_bput (b, changed, sizeof (changed));\n"
+    "  if (ret != 0)\n"
+    "    return ret;\n", fc);
+  k = 0;
+  for (const member_t *m = type->composite; m != link; m = m->next, ++k)
+  {
+    fprintf (fc, "  if (changed[%u] & 0x%02x)\n", k / 8, 1u << (k % 8));
+    write_delta_member (m, fc);
+  }
+  if (link)
+  {
+    fprintf (fc,
+      "  if (!(changed[%u] & 0x%02x))\n"
+      "    break;\n"
+      "  uint8_t mode = (base->%s && val->%s);\n"
+      "  ret = cser_raw_bput (b, &mode, sizeof (mode));\n"
+      "  if (ret != 0)\n"
+      "    return ret;\n"
+      "  if (!mode)\n"
+      "  {\n",
+      k / 8, 1u << (k % 8),
+      link->member_name, link->member_name);
+    write_store_member (link, fc);
+    fprintf (fc,
+      "   break;\n"
+      "  }\n"
+      "  base = base->%s;\n"
+      "  val = val->%s;\n"
+      "  }\n",
+      link->member_name,
+      link->member_name);
+  }
+  fputs ("  return 0;\n}\n", fc);
+
+  fprintf (fc,
+    "int cser_raw_bapply_delta_%s (%s *val, cser_raw_buf_t *b)\n"
+    "{\n",
+    utype, type->type_name);
+  if (link)
+    fputs ("  for (;;)\n  {\n", fc);
+  fprintf (fc,
+    "  uint8_t changed[%u];\n"
+    "  int ret = cser_raw_bget (b, changed, sizeof (changed));\n"
+    "  if (ret != 0)\n"
+    "    return ret;\n",
+    (n + 7) / 8);
+  write_apply_counts (type, link, fc);
+  k = 0;
+  for (const member_t *m = type->composite; m != link; m = m->next, ++k)
+  {
+    char *cond = count_changed (type, m);
+    fprintf (fc, "  if (changed[%u] & 0x%02x)\n  {\n", k / 8, 1u << (k % 8));
+    write_apply_member (m, cond, fc);
+    fputs ("  }\n", fc);
+    free (cond);
+  }
+  if (link)
+  {
+    fprintf (fc,
+      "  if (!(changed[%u] & 0x%02x))\n"
+      "    break;\n"
+      "  uint8_t mode;\n"
+      "  ret = cser_raw_bget (b, &mode, sizeof (mode));\n"
+      "  if (ret != 0)\n"
+      "    return ret;\n"
+      "  if (!mode)\n"
+      "  {\n",
+      k / 8, 1u << (k % 8));
+    write_replace_member (link, fc);
+    fprintf (fc,
+      "   break;\n"
+      "  }\n"
+      "  if (!val->%s)\n"
+      "    return -EPROTO;\n"
+      "  val = val->%s;\n"
+      "  }\n",
+      link->member_name,
+      link->member_name);
+  }
+  fputs ("  return 0;\n}\n", fc);
+
+  fprintf (fc,
+    "int cser_raw_store_delta_%s (const %s *base, const %s *val, cser_raw_write_fn w, void *q)\n"
+    "{\n",
+    utype, type->type_name, type->type_name);
+  write_stats_enter (type, "store", "w", "write", false, fc);
+  fputs (
+    "  uint8_t mem[CSER_RAW_BUFSZ];\n"
+    "  cser_raw_buf_t b = { .p = mem, .end = mem + sizeof (mem), .mem = mem, .w = w, .q = q };\n",
+    fc);
+  write_header_store (utype, fc);
+  fprintf (fc,
+    "  if (ret == 0)\n"
+    "    ret = cser_raw_bstore_delta_%s (base, val, &b);\n"
+    "  if (ret == 0)\n"
+    "    ret = cser_raw_buf_flush (&b);\n"
+    "  cser_raw_refs_release (&b);\n",
+    utype);
+  write_stats_return (type, fc);
+  fprintf (fc,
+    "}\n"
+    "int cser_raw_apply_delta_%s (%s *val, cser_raw_read_fn r, void *q, const cser_alloc_t *alloc)\n"
+    "{\n",
+    utype, type->type_name);
+  write_stats_enter (type, "load", "r", "read", true, fc);
+  fputs ("  cser_raw_buf_t b = { .r = r, .q = q, .alloc = alloc };\n", fc);
+  write_header_load (utype, fc);
+  fprintf (fc,
+    "  if (ret == 0)\n"
+    "    ret = cser_raw_bapply_delta_%s (val, &b);\n"
+    "  cser_raw_refs_release (&b);\n",
+    utype);
+  write_stats_return (type, fc);
+  fputs ("}\n", fc);
+
+  free (utype);
+  return !ferror (fh) && !ferror (fc);
+}
+
+
+// Loads element i of an indexed array member straight out of a stored
+// stream. The members ahead of the array are loaded into scratch space to
+// get there, and the elements before i passed over if the array is too
+// short to have an offset table.
+static bool write_index_at (const type_t *type, FILE *fh, FILE *fc)
+{
+  char *utype = make_cname (type->type_name);
+  for (const member_t *m = type->composite; m; m = m->next)
+  {
+    if (!m->opts.index)
+      continue;
+    char *umember = make_cname (m->member_name);
+    char *uelem = make_cname (m->base_type);
+    const char *n = m->opts.variable_array_size_member;
+
+    fprintf (fh,
+      "int cser_raw_load_%s_%s_at (%s *val, size_t i, cser_raw_pread_fn pr, void *q, const cser_alloc_t *alloc);\n",
+      utype, umember, m->base_type);
+
+    fprintf (fc,
+      "static int cser_raw_bload_%s_%s_head (%s *val, cser_raw_buf_t *b)\n"
+      "{\n",
+      utype, umember, type->type_name);
+    for (const member_t *h = type->composite; h != m; h = h->next)
+      if (!write_load_member (h, fc))
+        return false;
+    fprintf (fc,
+      "  return 0;\n"
+      "}\n"
+      "static int cser_raw_bskip_%s_%s_items (cser_raw_buf_t *b, size_t count)\n"
+      "{\n"
+      "  int ret = 0;\n",
+      utype, umember);
+    write_skip_items (m, "count", "  ", fc);
+    fprintf (fc,
+      "  return ret;\n"
+      "}\n"
+      "int cser_raw_load_%s_%s_at (%s *val, size_t i, cser_raw_pread_fn pr, void *q, const cser_alloc_t *alloc)\n"
+      "{\n",
+      utype, umember, m->base_type);
+    write_stats_enter (type, "load", "pr", "pread", true, fc);
+    fprintf (fc,
+      "  cser_arena_t arena;\n"
+      "  cser_arena_init (&arena, 0);\n"
+      "  cser_alloc_t scratch = cser_arena_allocator (&arena);\n"
+      "  cser_raw_at_t at = { pr, q, 0 };\n"
+      "  cser_raw_buf_t b = { .r = cser_raw_at_read, .q = &at, .alloc = &scratch };\n"
+      "  %s head;\n"
+      "  memset (&head, 0, sizeof (head));\n",
+      type->type_name);
+    write_header_load (utype, fc);
+    fprintf (fc,
+      "  if (ret == 0)\n"
+      "    ret = cser_raw_bload_%s_%s_head (&head, &b);\n"
+      "  uint8_t present = 0, width = 0;\n"
+      "  if (ret == 0)\n"
+      "    ret = cser_raw_bget (&b, &present, sizeof (present));\n"
+      "  if (ret == 0 && (!present || i >= (size_t)head.%s))\n"
+      "    ret = -ERANGE;\n"
+      "  if (ret == 0)\n"
+      "    ret = cser_raw_bget (&b, &width, sizeof (width));\n"
+      "  if (ret == 0 && width)\n"
+      "    ret = cser_raw_index_seek (&at, width, i, head.%s);\n"
+      "  if (ret == 0 && !width)\n"
+      "    ret = cser_raw_bskip_%s_%s_items (&b, i);\n"
+      "  b.alloc = alloc;\n"
+      "  memset (val, 0, sizeof (*val));\n"
+      "  if (ret == 0)\n"
+      "    ret = cser_raw_bload_%s (val, &b);\n"
+      "  cser_raw_refs_release (&b);\n"
+      "  cser_arena_destroy (&arena);\n",
+      utype, umember,
+      n,
+      n,
+      utype, umember,
+      uelem);
+    write_stats_return (type, fc);
+    fputs ("}\n", fc);
+
+    free (umember);
+    free (uelem);
+  }
+  free (utype);
+  return !ferror (fh) && !ferror (fc);
+}
+
+
+// The stream header is written/checked by the callback based entry points
+// only. Users of the buffer cursor API call these explicitly.
+static void write_stream_header (FILE *fh, FILE *fc)
+{
+  fprintf (fh,
+    "#define CSER_RAW_HEADER_SIZE %d\n"
+    "int cser_raw_bstore_header (cser_raw_buf_t *b);\n"
+    "int cser_raw_bload_header (cser_raw_buf_t *b);\n"
+    "size_t cser_raw_bsize_header (void);\n\n",
+    options->byte_order != ORDER_DEFAULT ? 1 : 0);
+
+  fputs (
+    "size_t cser_raw_bsize_header (void)\n"
+    "{\n"
+    "  return CSER_RAW_HEADER_SIZE;\n"
+    "}\n\n", fc);
+
+  fputs (
+    "int cser_raw_bstore_header (cser_raw_buf_t *b)\n"
+    "{\n", fc);
+  if (options->byte_order != ORDER_DEFAULT)
+    fputs (
+      "  const uint8_t order = CSER_RAW_WIRE_BE ? 'B' : 'L';\n"
+      "  int ret = cser_raw_bput (b, &order, sizeof (order));\n"
+      "  if (ret != 0)\n"
+      "    return ret;\n", fc);
+  fputs (
+    "  (void)b;\n"
+    "  return 0;\n"
+    "}\n\n"
+    "int cser_raw_bload_header (cser_raw_buf_t *b)\n"
+    "{\n", fc);
+  if (options->byte_order != ORDER_DEFAULT)
+    fputs (
+      "  uint8_t order;\n"
+      "  int ret = cser_raw_bget (b, &order, sizeof (order));\n"
+      "  if (ret != 0)\n"
+      "    return ret;\n"
+      "  if (order != (CSER_RAW_WIRE_BE ? 'B' : 'L'))\n"
+      "    return -EPROTO;\n", fc);
+  fputs (
+    "  (void)b;\n"
+    "  return 0;\n"
+    "}\n\n", fc);
+
+  if (!options->prefixed)
+    return;
+
+  // The fingerprint is always big endian, so that it reads the same
+  // whatever the byte order of the rest.
+  fputs (
+    "#define CSER_RAW_FINGERPRINT_SIZE 8\n"
+    "int cser_raw_bstore_fingerprint (cser_raw_buf_t *b, uint64_t fingerprint);\n"
+    "int cser_raw_bload_fingerprint (cser_raw_buf_t *b, uint64_t fingerprint);\n\n",
+    fh);
+
+  fputs (
+    "int cser_raw_bstore_fingerprint (cser_raw_buf_t *b, uint64_t fingerprint)\n"
+    "{\n"
+    "  uint8_t fp[CSER_RAW_FINGERPRINT_SIZE];\n"
+    "  for (int i = 0; i < CSER_RAW_FINGERPRINT_SIZE; ++i)\n"
+    "    fp[i] = (uint8_t)(fingerprint >> (56 - 8 * i));\n"
+    "  return cser_raw_bput (b, fp, sizeof (fp));\n"
+    "}\n\n"
+    "int cser_raw_bload_fingerprint (cser_raw_buf_t *b, uint64_t fingerprint)\n"
+    "{\n"
+    "  uint8_t fp[CSER_RAW_FINGERPRINT_SIZE];\n"
+    "  int ret = cser_raw_bget (b, fp, sizeof (fp));\n"
+    "  if (ret != 0)\n"
+    "    return ret;\n"
+    "  uint64_t got = 0;\n"
+    "  for (int i = 0; i < CSER_RAW_FINGERPRINT_SIZE; ++i)\n"
+    "    got = (got << 8) | fp[i];\n"
+    "  return got == fingerprint ? 0 : -EPROTO;\n"
+    "}\n\n", fc);
+}
+
+
+// Framing support, for -F. The CRC32C uses the SSE4.2 or ARMv8 CRC
+// instructions where the target has them, and otherwise the slice-by-8
+// tables, which are worked out here rather than at run time.
+static void write_frame_support (FILE *fc)
+{
+  uint32_t table[8][256];
+  for (unsigned i = 0; i < 256; ++i)
+  {
+    uint32_t c = i;
+    for (int k = 0; k < 8; ++k)
+      c = (c >> 1) ^ (0x82f63b78u & -(c & 1));
+    table[0][i] = c;
+  }
+  for (unsigned i = 0; i < 256; ++i)
+    for (int t = 1; t < 8; ++t)
+      table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xff];
+
+  fputs (
+"/* A framed stream is a header of magic, version and type fingerprint,  */\n"
+"/* then chunks of a 32 bit length, that many bytes and a CRC32C of both */\n"
+"/* (all big endian), ending with an empty chunk. Chunks are checked as  */\n"
+"/* they are read, before any of their contents is used.                 */\n"
+"#define CSER_RAW_FRAME_VERSION 1\n"
+"\n"
+"#if defined(__SSE4_2__)\n"
+"# include <nmmintrin.h>\n"
+"#elif defined(__ARM_FEATURE_CRC32) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__\n"
+"# include <arm_acle.h>\n"
+"# define CSER_RAW_CRC32C_ARM 1\n"
+"#else\n"
+"static const uint32_t cser_raw_crc32c_table[8][256] =\n"
+"{\n", fc);
+  for (int t = 0; t < 8; ++t)
+  {
+    fputs ("  {\n", fc);
+    for (unsigned i = 0; i < 256; i += 6)
+    {
+      fputs ("   ", fc);
+      for (unsigned j = i; j < i + 6 && j < 256; ++j)
+        fprintf (fc, " 0x%08lx,", (unsigned long)table[t][j]);
+      fputs ("\n", fc);
+    }
+    fputs ("  },\n", fc);
+  }
+  fputs (
+"};\n"
+"#endif\n"
+"\n"
+"static uint32_t cser_raw_crc32c (uint32_t crc, const uint8_t *p, size_t n)\n"
+"{\n"
+"  crc = ~crc;\n"
+"#if defined(__SSE4_2__) && defined(__x86_64__)\n"
+"  for (; n >= 8; n -= 8, p += 8)\n"
+"  {\n"
+"    uint64_t v;\n"
+"    memcpy (&v, p, 8);\n"
+"    crc = (uint32_t)_mm_crc32_u64 (crc, v);\n"
+"  }\n"
+"#elif defined(__SSE4_2__)\n"
+"  for (; n >= 4; n -= 4, p += 4)\n"
+"  {\n"
+"    uint32_t v;\n"
+"    memcpy (&v, p, 4);\n"
+"    crc = _mm_crc32_u32 (crc, v);\n"
+"  }\n"
+"#elif defined(CSER_RAW_CRC32C_ARM)\n"
+"  for (; n >= 8; n -= 8, p += 8)\n"
+"  {\n"
+"    uint64_t v;\n"
+"    memcpy (&v, p, 8);\n"
+"    crc = __crc32cd (crc, v);\n"
+"  }\n"
+"#else\n"
+"  const uint32_t (*t)[256] = cser_raw_crc32c_table;\n"
+"  for (; n >= 8; n -= 8, p += 8)\n"
+"  {\n"
+"    uint32_t lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);\n"
+"    uint32_t hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 | (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;\n"
+"    crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^\n"
+"          t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];\n"
+"  }\n"
+"#endif\n"
+"  for (; n; --n, ++p)\n"
+"  {\n"
+"#if defined(__SSE4_2__)\n"
+"    crc = _mm_crc32_u8 (crc, *p);\n"
+"#elif defined(CSER_RAW_CRC32C_ARM)\n"
+"    crc = __crc32cb (crc, *p);\n"
+"#else\n"
+"    crc = t[0][(crc ^ *p) & 0xff] ^ (crc >> 8);\n"
+"#endif\n"
+"  }\n"
+"  return ~crc;\n"
+"}\n"
+"\n"
+"/* Storing, the chunk is built in place: its length goes in the 4 bytes */\n"
+"/* reserved at mem, and its CRC in the 4 reserved beyond end.           */\n"
+"static int cser_raw_frame_flush (cser_raw_buf_t *b)\n"
+"{\n"
+"  size_t len = (size_t)(b->p - b->mem) - 4;\n"
+"  if (len == 0)\n"
+"    return 0;\n"
+"  if (!b->w)\n"
+"    return -ENOSPC;\n"
+"  cser_raw_put32 (b->mem, (uint32_t)len);\n"
+"  cser_raw_put32 (b->p, cser_raw_crc32c (0, b->mem, len + 4));\n"
+"  int ret = b->w (b->mem, len + 8, b->q);\n"
+"  if (ret != 0)\n"
+"    return ret;\n"
+"  b->p = b->mem + 4;\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"static int cser_raw_frame_put (cser_raw_buf_t *b, const uint8_t *bytes, size_t n)\n"
+"{\n"
+"  for (;;)\n"
+"  {\n"
+"    size_t k = (size_t)(b->end - b->p);\n"
+"    if (k > n)\n"
+"      k = n;\n"
+"    memcpy (b->p, bytes, k);\n"
+"    b->p += k;\n"
+"    bytes += k;\n"
+"    n -= k;\n"
+"    if (n == 0)\n"
+"      return 0;\n"
+"    int ret = cser_raw_frame_flush (b);\n"
+"    if (ret != 0)\n"
+"      return ret;\n"
+"  }\n"
+"}\n"
+"\n"
+"/* Loading, each chunk is read into mem and checked before it is used */\n"
+"static int cser_raw_frame_next (cser_raw_buf_t *b)\n"
+"{\n"
+"  uint8_t head[4];\n"
+"  if (!b->r)\n"
+"    return -ENODATA;\n"
+"  int ret = b->r (head, sizeof (head), b->q);\n"
+"  if (ret != 0)\n"
+"    return ret;\n"
+"  size_t len = cser_raw_get32 (head);\n"
+"  if (len > (size_t)(b->lim - b->mem) - 4)\n"
+"    return -EMSGSIZE;\n"
+"  ret = b->r (b->mem, len + 4, b->q);\n"
+"  if (ret != 0)\n"
+"    return ret;\n"
+"  uint32_t crc = cser_raw_crc32c (cser_raw_crc32c (0, head, sizeof (head)), b->mem, len);\n"
+"  if (crc != cser_raw_get32 (b->mem + len))\n"
+"    return -EBADMSG;\n"
+"  b->p = b->mem;\n"
+"  b->end = b->mem + len;\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"static int cser_raw_frame_get (cser_raw_buf_t *b, uint8_t *bytes, size_t n)\n"
+"{\n"
+"  for (;;)\n"
+"  {\n"
+"    size_t k = (size_t)(b->end - b->p);\n"
+"    if (k > n)\n"
+"      k = n;\n"
+"    memcpy (bytes, b->p, k);\n"
+"    b->p += k;\n"
+"    bytes += k;\n"
+"    n -= k;\n"
+"    if (n == 0)\n"
+"      return 0;\n"
+"    int ret = cser_raw_frame_next (b);\n"
+"    if (ret != 0)\n"
+"      return ret;\n"
+"    if (b->end == b->mem)\n"
+"      return -ENODATA; /* hit the final, empty chunk */\n"
+"  }\n"
+"}\n"
+"\n"
+"static int cser_raw_frame_begin (cser_raw_buf_t *b, uint64_t fingerprint)\n"
+"{\n"
+"  uint8_t head[16] = { 'c', 's', 'f', 'r', CSER_RAW_FRAME_VERSION };\n"
+"  for (int i = 0; i < 8; ++i)\n"
+"    head[8 + i] = (uint8_t)(fingerprint >> (56 - 8 * i));\n"
+"  return b->w (head, sizeof (head), b->q);\n"
+"}\n"
+"\n"
+"static int cser_raw_frame_end (cser_raw_buf_t *b)\n"
+"{\n"
+"  int ret = cser_raw_frame_flush (b);\n"
+"  if (ret != 0)\n"
+"    return ret;\n"
+"  uint8_t tail[8] = { 0 };\n"
+"  cser_raw_put32 (tail + 4, cser_raw_crc32c (0, tail, 4));\n"
+"  return b->w (tail, sizeof (tail), b->q);\n"
+"}\n"
+"\n"
+"static int cser_raw_frame_check (cser_raw_buf_t *b, uint64_t fingerprint)\n"
+"{\n"
+"  uint8_t head[16];\n"
+"  int ret = b->r (head, sizeof (head), b->q);\n"
+"  if (ret != 0)\n"
+"    return ret;\n"
+"  static const uint8_t magic[8] = { 'c', 's', 'f', 'r', CSER_RAW_FRAME_VERSION };\n"
+"  if (memcmp (head, magic, sizeof (magic)) != 0)\n"
+"    return -EPROTO;\n"
+"  uint64_t fp = 0;\n"
+"  for (int i = 0; i < 8; ++i)\n"
+"    fp = fp << 8 | head[8 + i];\n"
+"  return fp == fingerprint ? 0 : -EPROTO;\n"
+"}\n"
+"\n"
+"/* The object must have used up the data, with nothing but the final */\n"
+"/* empty chunk left.                                                  */\n"
+"static int cser_raw_frame_done (cser_raw_buf_t *b)\n"
+"{\n"
+"  if (b->p != b->end)\n"
+"    return -EPROTO;\n"
+"  int ret = cser_raw_frame_next (b);\n"
+"  if (ret != 0)\n"
+"    return ret;\n"
+"  return b->end == b->mem ? 0 : -EPROTO;\n"
+"}\n"
+"\n", fc);
+}
+
+
+static void write_buffer_support (FILE *fh, FILE *fc)
+{
+  fputs (
+"/* Buffer cursor used by all the raw (de)serializers. When storing, bytes */\n"
+"/* are placed at p until end is reached, at which point everything from */\n"
+"/* mem up to p is handed to w (if any) and the buffer is reused. When   */\n"
+"/* loading, bytes are taken from p until end is reached, after which    */\n"
+"/* the remainder is requested directly from r (if any). Plain memory can */\n"
+"/* thus be used by leaving w/r null, and the callbacks are only invoked */\n"
+"/* on overflow/underflow. Loading through rs instead of r refills the   */\n"
+"/* buffer from mem to cap, so that r is not called for every value.    */\n"
+"/* Setting iov turns a store into a gather: runs of at least            */\n"
+"/* CSER_RAW_IOV_MIN bytes taken straight from the object are listed in  */\n"
+"/* iov rather than copied, with everything else going into the buffer   */\n"
+"/* (then scratch space, which the list points into) from seg on. A full */\n"
+"/* buffer or list is handed to wv and reused, and without wv, the list  */\n"
+"/* is left for the caller once complete. iovmax must be 3 or more.      */\n"
+"/* Setting lim (the end of mem) frames the stream: the buffer then holds */\n"
+"/* one checksummed chunk at a time, with end marking where it stops.    */\n"
+"#ifndef CSER_RAW_BUFSZ\n"
+"# define CSER_RAW_BUFSZ 4096\n"
+"#endif\n"
+"#ifndef CSER_RAW_IOV_MIN\n"
+"# define CSER_RAW_IOV_MIN 256\n"
+"#endif\n"
+"#ifndef CSER_RAW_IOVMAX\n"
+"# define CSER_RAW_IOVMAX 64\n"
+"#endif\n"
+"typedef struct cser_raw_buf\n"
+"{\n"
+"  uint8_t *p;\n"
+"  uint8_t *end;\n"
+"  uint8_t *mem;\n"
+"  cser_raw_write_fn w;\n"
+"  cser_raw_read_fn r;\n"
+"  void *q;\n"
+"  const cser_alloc_t *alloc; /* for loading; null selects the C library */\n"
+"  struct cser_raw_refs *refs; /* shared objects seen so far */\n"
+"  struct iovec *iov;\n"
+"  int iovcnt;\n"
+"  int iovmax;\n"
+"  uint8_t *seg;\n"
+"  cser_raw_writev_fn wv;\n"
+"  uint8_t *lim; /* framed: end of mem, with end marking the chunk */\n"
+"  cser_raw_readsome_fn rs; /* loading: reads ahead into mem, up to cap */\n"
+"  uint8_t *cap;\n"
+"} cser_raw_buf_t;\n"
+"\n"
+"int cser_raw_buf_overflow (cser_raw_buf_t *b, const uint8_t *bytes, size_t n);\n"
+"int cser_raw_buf_underflow (cser_raw_buf_t *b, uint8_t *bytes, size_t n);\n"
+"int cser_raw_buf_flush (cser_raw_buf_t *b);\n"
+"/* Forgets the shared objects seen, after a store or load of a whole */\n"
+"/* object graph using the cursor directly.                            */\n"
+"void cser_raw_refs_release (cser_raw_buf_t *b);\n"
+"\n"
+"static inline int cser_raw_bput (cser_raw_buf_t *b, const uint8_t *bytes, size_t n)\n"
+"{\n"
+"  if ((size_t)(b->end - b->p) < n)\n"
+"    return cser_raw_buf_overflow (b, bytes, n);\n"
+"  memcpy (b->p, bytes, n);\n"
+"  b->p += n;\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"static inline int cser_raw_bget (cser_raw_buf_t *b, uint8_t *bytes, size_t n)\n"
+"{\n"
+"  if ((size_t)(b->end - b->p) < n)\n"
+"    return cser_raw_buf_underflow (b, bytes, n);\n"
+"  memcpy (bytes, b->p, n);\n"
+"  b->p += n;\n"
+"  return 0;\n"
+"}\n\n"
+, fh);
+
+  static const char *wire_be[] =
+  {
+    [ORDER_DEFAULT] = "1",
+    [ORDER_BIG] = "1",
+    [ORDER_LITTLE] = "0",
+    [ORDER_NATIVE] = "CSER_RAW_HOST_BE",
+  };
+  fprintf (fc,
+"#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__)\n"
+"# define CSER_RAW_HOST_BE (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)\n"
+"#else\n"
+"# define CSER_RAW_HOST_BE (*(const uint8_t *)&(const uint16_t){ 1 } == 0)\n"
+"#endif\n"
+"#define CSER_RAW_WIRE_BE %s\n"
+"#define CSER_RAW_SWAP (CSER_RAW_WIRE_BE != CSER_RAW_HOST_BE)\n"
+"\n"
+"static inline void cser_raw_swap (uint8_t *bytes, size_t width)\n"
+"{\n"
+"#if defined(__GNUC__)\n"
+"  switch (width)\n"
+"  {\n"
+"    case 2: { uint16_t v; memcpy (&v, bytes, 2); v = __builtin_bswap16 (v); memcpy (bytes, &v, 2); return; }\n"
+"    case 4: { uint32_t v; memcpy (&v, bytes, 4); v = __builtin_bswap32 (v); memcpy (bytes, &v, 4); return; }\n"
+"    case 8: { uint64_t v; memcpy (&v, bytes, 8); v = __builtin_bswap64 (v); memcpy (bytes, &v, 8); return; }\n"
+"  }\n"
+"#endif\n"
+"  for (size_t i = 0; i < width / 2; ++i)\n"
+"  {\n"
+"    uint8_t tmp = bytes[i];\n"
+"    bytes[i] = bytes[width - 1 - i];\n"
+"    bytes[width - 1 - i] = tmp;\n"
+"  }\n"
+"}\n"
+"\n"
+"/* Big endian 32 bit fields, as used by the framing and compression */\n"
+"static inline void cser_raw_put32 (uint8_t *p, uint32_t v)\n"
+"{\n"
+"  p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16); p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v;\n"
+"}\n"
+"\n"
+"static inline uint32_t cser_raw_get32 (const uint8_t *p)\n"
+"{\n"
+"  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];\n"
+"}\n"
+"\n"
+, wire_be[options->byte_order]);
+
+  if (options->framed)
+    write_frame_support (fc);
+
+  fprintf (fc,
+"/* Lists the bytes placed in the buffer since the last entry */\n"
+"static int cser_raw_iov_seal (cser_raw_buf_t *b)\n"
+"{\n"
+"  if (b->p == b->seg)\n"
+"    return 0;\n"
+"  if (b->iovcnt == b->iovmax)\n"
+"    return -ENOSPC;\n"
+"  b->iov[b->iovcnt].iov_base = b->seg;\n"
+"  b->iov[b->iovcnt++].iov_len = (size_t)(b->p - b->seg);\n"
+"  b->seg = b->p;\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"static int cser_raw_buf_flushv (cser_raw_buf_t *b)\n"
+"{\n"
+"  int ret = cser_raw_iov_seal (b);\n"
+"  if (ret != 0 || !b->wv || b->iovcnt == 0)\n"
+"    return ret;\n"
+"  ret = b->wv (b->iov, b->iovcnt, b->q);\n"
+"  if (ret != 0)\n"
+"    return ret;\n"
+"  b->iovcnt = 0;\n"
+"  b->p = b->seg = b->mem;\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"/* Lists bytes of the object being stored, keeping a slot spare for */\n"
+"/* the buffer contents following them.                                */\n"
+"static int cser_raw_buf_reference (cser_raw_buf_t *b, const uint8_t *bytes, size_t n)\n"
+"{\n"
+"  if (b->iovcnt + 3 > b->iovmax)\n"
+"  {\n"
+"    int ret = cser_raw_buf_flushv (b);\n"
+"    if (ret != 0)\n"
+"      return ret;\n"
+"    if (b->iovcnt + 3 > b->iovmax)\n"
+"      return -ENOSPC;\n"
+"  }\n"
+"  cser_raw_iov_seal (b);\n"
+"  b->iov[b->iovcnt].iov_base = (void *)bytes;\n"
+"  b->iov[b->iovcnt++].iov_len = n;\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"int cser_raw_buf_flush (cser_raw_buf_t *b)\n"
+"{\n"
+"  if (b->iov)\n"
+"    return cser_raw_buf_flushv (b);\n"
+"%s"
+"  if (b->p == b->mem)\n"
+"    return 0;\n"
+"  if (!b->w)\n"
+"    return -ENOSPC;\n"
+"  int ret = b->w (b->mem, (size_t)(b->p - b->mem), b->q);\n"
+"  if (ret != 0)\n"
+"    return ret;\n"
+"  b->p = b->mem;\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"int cser_raw_buf_overflow (cser_raw_buf_t *b, const uint8_t *bytes, size_t n)\n"
+"{\n"
+"  int ret = cser_raw_buf_flush (b);\n"
+"  if (ret != 0)\n"
+"    return ret;\n"
+"  if ((size_t)(b->end - b->p) >= n)\n"
+"  {\n"
+"    memcpy (b->p, bytes, n);\n"
+"    b->p += n;\n"
+"    return 0;\n"
+"  }\n"
+"%s"
+"  if (!b->w)\n"
+"    return -ENOSPC;\n"
+"  return b->w (bytes, n, b->q);\n"
+"}\n"
+"\n"
+"/* Reads ahead, unless what is wanted would not fit in the buffer */\n"
+"static int cser_raw_buf_refill (cser_raw_buf_t *b, uint8_t *bytes, size_t n)\n"
+"{\n"
+"  for (;;)\n"
+"  {\n"
+"    size_t avail = (size_t)(b->end - b->p);\n"
+"    if (avail > n)\n"
+"      avail = n;\n"
+"    memcpy (bytes, b->p, avail);\n"
+"    b->p += avail;\n"
+"    bytes += avail;\n"
+"    n -= avail;\n"
+"    if (n == 0)\n"
+"      return 0;\n"
+"    size_t room = (size_t)(b->cap - b->mem);\n"
+"    bool direct = n >= room;\n"
+"    ssize_t got = b->rs (direct ? bytes : b->mem, direct ? n : room, b->q);\n"
+"    if (got < 0)\n"
+"      return (int)got;\n"
+"    if (got == 0)\n"
+"      return -ENODATA;\n"
+"    if (direct)\n"
+"    {\n"
+"      bytes += got;\n"
+"      n -= (size_t)got;\n"
+"    }\n"
+"    else\n"
+"    {\n"
+"      b->p = b->mem;\n"
+"      b->end = b->mem + got;\n"
+"    }\n"
+"  }\n"
+"}\n"
+"\n"
+"int cser_raw_buf_underflow (cser_raw_buf_t *b, uint8_t *bytes, size_t n)\n"
+"{\n"
+"%s"
+"  if (b->rs)\n"
+"    return cser_raw_buf_refill (b, bytes, n);\n"
+"  size_t avail = (size_t)(b->end - b->p);\n"
+"  if (!b->r)\n"
+"    return -ENODATA;\n"
+"  if (avail)\n"
+"  {\n"
+"    memcpy (bytes, b->p, avail);\n"
+"    b->p += avail;\n"
+"  }\n"
+"  return b->r (bytes + avail, n - avail, b->q);\n"
+"}\n\n"
+, options->framed ?
+  "  if (b->lim)\n"
+  "    return cser_raw_frame_flush (b);\n" : "",
+  options->framed ?
+  "  if (b->lim)\n"
+  "    return cser_raw_frame_put (b, bytes, n);\n" : "",
+  options->framed ?
+  "  if (b->lim)\n"
+  "    return cser_raw_frame_get (b, bytes, n);\n" : "");
+
+  // Block (de)serialization of native arrays. The wire format is big
+  // endian, so on little endian hosts the elements get byte swapped on
+  // the way, using SIMD where available.
+  fputs (
+"#if defined(__AVX2__)\n"
+"# include <immintrin.h>\n"
+"#elif defined(__SSE2__)\n"
+"# include <emmintrin.h>\n"
+"#endif\n"
+"\n"
+"/* Copies count elements of the given width from src to dst, reversing */\n"
+"/* the byte order of each. src and dst may be the same.                 */\n"
+"static inline void cser_raw_swap_copy (uint8_t *dst, const uint8_t *src, size_t count, size_t width)\n"
+"{\n"
+"  size_t i = 0;\n"
+"#if defined(__AVX2__)\n"
+"  if (width == 2 || width == 4 || width == 8)\n"
+"  {\n"
+"    const __m256i mask = (width == 2) ?\n"
+"      _mm256_setr_epi8 (1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14,\n"
+"                        1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14) :\n"
+"      (width == 4) ?\n"
+"      _mm256_setr_epi8 (3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12,\n"
+"                        3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12) :\n"
+"      _mm256_setr_epi8 (7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8,\n"
+"                        7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8);\n"
+"    const size_t per = 32 / width;\n"
+"    for (; i + per <= count; i += per)\n"
+"    {\n"
+"      __m256i v = _mm256_loadu_si256 ((const __m256i *)(src + i * width));\n"
+"      _mm256_storeu_si256 ((__m256i *)(dst + i * width), _mm256_shuffle_epi8 (v, mask));\n"
+"    }\n"
+"  }\n"
+"#elif defined(__SSE2__)\n"
+"  if (width == 2 || width == 4 || width == 8)\n"
+"  {\n"
+"    const size_t per = 16 / width;\n"
+"    for (; i + per <= count; i += per)\n"
+"    {\n"
+"      __m128i v = _mm_loadu_si128 ((const __m128i *)(src + i * width));\n"
+"      if (width == 8)\n"
+"        v = _mm_shuffle_epi32 (v, _MM_SHUFFLE (2, 3, 0, 1));\n"
+"      if (width >= 4)\n"
+"      {\n"
+"        v = _mm_shufflelo_epi16 (v, _MM_SHUFFLE (2, 3, 0, 1));\n"
+"        v = _mm_shufflehi_epi16 (v, _MM_SHUFFLE (2, 3, 0, 1));\n"
+"      }\n"
+"      v = _mm_or_si128 (_mm_slli_epi16 (v, 8), _mm_srli_epi16 (v, 8));\n"
+"      _mm_storeu_si128 ((__m128i *)(dst + i * width), v);\n"
+"    }\n"
+"  }\n"
+"#endif\n"
+"  for (; i < count; ++i)\n"
+"  {\n"
+"    const uint8_t *s = src + i * width;\n"
+"    uint8_t *d = dst + i * width;\n"
+"    for (size_t j = 0; j < width / 2; ++j)\n"
+"    {\n"
+"      uint8_t tmp = s[j];\n"
+"      d[j] = s[width - 1 - j];\n"
+"      d[width - 1 - j] = tmp;\n"
+"    }\n"
+"    if (width & 1)\n"
+"      d[width / 2] = s[width / 2];\n"
+"  }\n"
+"}\n"
+"\n"
+"/* For bytes of the object itself, which a gather need not copy */\n"
+"static inline int cser_raw_bput_ref (cser_raw_buf_t *b, const uint8_t *bytes, size_t n)\n"
+"{\n"
+"  if (b->iov && n >= CSER_RAW_IOV_MIN)\n"
+"    return cser_raw_buf_reference (b, bytes, n);\n"
+"  return cser_raw_bput (b, bytes, n);\n"
+"}\n"
+"\n"
+"static inline int cser_raw_bstore_array (cser_raw_buf_t *b, const void *items, size_t count, size_t width)\n"
+"{\n"
+"  const uint8_t *src = items;\n"
+"  if (width == 1 || !CSER_RAW_SWAP)\n"
+"    return cser_raw_bput_ref (b, src, count * width);\n"
+"  while (count)\n"
+"  {\n"
+"    size_t n = (size_t)(b->end - b->p) / width;\n"
+"    if (n == 0)\n"
+"    {\n"
+"      int ret = cser_raw_buf_flush (b);\n"
+"      if (ret != 0)\n"
+"        return ret;\n"
+"      n = (size_t)(b->end - b->p) / width;\n"
+"      if (n == 0)\n"
+"      {\n"
+"        /* no usable buffer space, so go via the stack */\n"
+"        uint8_t tmp[256];\n"
+"        n = sizeof (tmp) / width;\n"
+"        if (n > count)\n"
+"          n = count;\n"
+"        cser_raw_swap_copy (tmp, src, n, width);\n"
+"        ret = cser_raw_bput (b, tmp, n * width);\n"
+"        if (ret != 0)\n"
+"          return ret;\n"
+"        src += n * width;\n"
+"        count -= n;\n"
+"        continue;\n"
+"      }\n"
+"    }\n"
+"    if (n > count)\n"
+"      n = count;\n"
+"    cser_raw_swap_copy (b->p, src, n, width);\n"
+"    b->p += n * width;\n"
+"    src += n * width;\n"
+"    count -= n;\n"
+"  }\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"static inline int cser_raw_bload_array (cser_raw_buf_t *b, void *items, size_t count, size_t width)\n"
+"{\n"
+"  if (count == 0)\n"
+"    return 0; /* items may be null, as may the buffer */\n"
+"  int ret = cser_raw_bget (b, items, count * width);\n"
+"  if (ret == 0 && width > 1 && CSER_RAW_SWAP)\n"
+"    cser_raw_swap_copy (items, items, count, width);\n"
+"  return ret;\n"
+"}\n"
+"\n"
+"/* Byte planes, for shuffle members: the first byte (in wire order) of */\n"
+"/* every element, then the second byte of every element, and so on.    */\n"
+"#define CSER_RAW_PLANE(plane, width) (CSER_RAW_SWAP ? (width) - 1 - (plane) : (plane))\n"
+"\n"
+"static inline int cser_raw_bstore_shuffled (cser_raw_buf_t *b, const void *items, size_t count, size_t width)\n"
+"{\n"
+"  const uint8_t *src = items;\n"
+"  for (size_t plane = 0; plane < width; ++plane)\n"
+"  {\n"
+"    const uint8_t *col = src + CSER_RAW_PLANE (plane, width);\n"
+"    for (size_t i = 0; i < count; )\n"
+"    {\n"
+"      uint8_t tmp[256];\n"
+"      size_t n = count - i < sizeof (tmp) ? count - i : sizeof (tmp);\n"
+"      for (size_t j = 0; j < n; ++j)\n"
+"        tmp[j] = col[(i + j) * width];\n"
+"      int ret = cser_raw_bput (b, tmp, n);\n"
+"      if (ret != 0)\n"
+"        return ret;\n"
+"      i += n;\n"
+"    }\n"
+"  }\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"static inline int cser_raw_bload_shuffled (cser_raw_buf_t *b, void *items, size_t count, size_t width)\n"
+"{\n"
+"  uint8_t *dst = items;\n"
+"  for (size_t plane = 0; plane < width; ++plane)\n"
+"  {\n"
+"    uint8_t *col = dst + CSER_RAW_PLANE (plane, width);\n"
+"    for (size_t i = 0; i < count; )\n"
+"    {\n"
+"      uint8_t tmp[256];\n"
+"      size_t n = count - i < sizeof (tmp) ? count - i : sizeof (tmp);\n"
+"      int ret = cser_raw_bget (b, tmp, n);\n"
+"      if (ret != 0)\n"
+"        return ret;\n"
+"      for (size_t j = 0; j < n; ++j)\n"
+"        col[(i + j) * width] = tmp[j];\n"
+"      i += n;\n"
+"    }\n"
+"  }\n"
+"  return 0;\n"
+"}\n\n"
+, fc);
+
+  fputs (
+"static inline int cser_raw_bput_varint (cser_raw_buf_t *b, uint64_t v)\n"
+"{\n"
+"  uint8_t bytes[10];\n"
+"  size_t n = 0;\n"
+"  while (v >= 0x80)\n"
+"  {\n"
+"    bytes[n++] = (uint8_t)(v | 0x80);\n"
+"    v >>= 7;\n"
+"  }\n"
+"  bytes[n++] = (uint8_t)v;\n"
+"  return cser_raw_bput (b, bytes, n);\n"
+"}\n"
+"\n"
+"static inline int cser_raw_bget_varint_slow (cser_raw_buf_t *b, uint64_t *v)\n"
+"{\n"
+"  uint64_t res = 0;\n"
+"  for (unsigned shift = 0; shift < 64; shift += 7)\n"
+"  {\n"
+"    uint8_t byte;\n"
+"    int ret = cser_raw_bget (b, &byte, 1);\n"
+"    if (ret != 0)\n"
+"      return ret;\n"
+"    res |= (uint64_t)(byte & 0x7f) << shift;\n"
+"    if (!(byte & 0x80))\n"
+"    {\n"
+"      *v = res;\n"
+"      return 0;\n"
+"    }\n"
+"  }\n"
+"  return -EOVERFLOW;\n"
+"}\n"
+"\n"
+"static inline size_t cser_raw_bsize_varint (uint64_t v)\n"
+"{\n"
+"  size_t n = 1;\n"
+"  while (v >= 0x80)\n"
+"  {\n"
+"    v >>= 7;\n"
+"    ++n;\n"
+"  }\n"
+"  return n;\n"
+"}\n"
+"\n"
+"static inline int cser_raw_bget_varint (cser_raw_buf_t *b, uint64_t *v)\n"
+"{\n"
+"  if (b->p < b->end && !(*b->p & 0x80))\n"
+"  {\n"
+"    *v = *b->p++;\n"
+"    return 0;\n"
+"  }\n"
+"  return cser_raw_bget_varint_slow (b, v);\n"
+"}\n\n"
+, fc);
+
+  write_stream_header (fh, fc);
+}
+
+
+// Parallel (de)serialization, for -M. Runs of fixed wire size elements are
+// cut into chunks, worked on by a pool of threads. The calling thread does
+// all of the I/O, in order, so the wire format is unaffected.
+static void write_par_support (const type_list_t *types, FILE *fc)
+{
+  bool any_par = false;
+  for (const type_list_t *t = types; t; t = t->next)
+    any_par |= is_par_element (&t->def);
+  if (!any_par)
+    return;
+
+  fputs (
+"#include <pthread.h>\n"
+"#include <unistd.h>\n"
+"\n"
+"#ifndef CSER_RAW_PAR_THREADS\n"
+"#define CSER_RAW_PAR_THREADS ((size_t)sysconf (_SC_NPROCESSORS_ONLN))\n"
+"#endif\n"
+"#ifndef CSER_RAW_PAR_BYTES\n"
+"#define CSER_RAW_PAR_BYTES (256 * 1024)\n"
+"#endif\n"
+"\n"
+"typedef int (*cser_raw_par_fn) (cser_raw_buf_t *b, void *items, size_t count);\n"
+"\n"
+"/* A run is worked on in place when it is all in the cursor's buffer.  */\n"
+"/* Otherwise chunk i goes through slot i % nslots, and fin records for  */\n"
+"/* each slot one past the last chunk finished in it.                   */\n"
+"typedef struct cser_raw_par\n"
+"{\n"
+"  pthread_mutex_t lock;\n"
+"  pthread_cond_t wake; /* for the workers, once more can be claimed */\n"
+"  pthread_cond_t done; /* for the caller, once a chunk is finished */\n"
+"  cser_raw_par_fn fn;\n"
+"  uint8_t *items;\n"
+"  size_t width;        /* in memory element size */\n"
+"  size_t wire;         /* encoded element size */\n"
+"  size_t count;\n"
+"  size_t per;          /* elements per chunk */\n"
+"  size_t nchunks;\n"
+"  uint8_t *run;\n"
+"  uint8_t *slots;\n"
+"  size_t nslots;\n"
+"  size_t *fin;\n"
+"  size_t avail;        /* chunks which may be claimed */\n"
+"  size_t claimed;\n"
+"  int stop;\n"
+"  int ret;\n"
+"} cser_raw_par_t;\n"
+"\n"
+"static inline uint8_t *cser_raw_par_bytes (const cser_raw_par_t *p, size_t i)\n"
+"{\n"
+"  if (p->run)\n"
+"    return p->run + i * p->per * p->wire;\n"
+"  return p->slots + (i % p->nslots) * p->per * p->wire;\n"
+"}\n"
+"\n"
+"static inline size_t cser_raw_par_len (const cser_raw_par_t *p, size_t i)\n"
+"{\n"
+"  size_t n = p->count - i * p->per;\n"
+"  return n < p->per ? n : p->per;\n"
+"}\n"
+"\n"
+"static void *cser_raw_par_work (void *arg)\n"
+"{\n"
+"  cser_raw_par_t *p = arg;\n"
+"  pthread_mutex_lock (&p->lock);\n"
+"  for (;;)\n"
+"  {\n"
+"    while (!p->stop && p->ret == 0 && p->claimed == p->avail && p->claimed < p->nchunks)\n"
+"      pthread_cond_wait (&p->wake, &p->lock);\n"
+"    if (p->stop || p->ret != 0 || p->claimed == p->nchunks)\n"
+"      break;\n"
+"    size_t i = p->claimed++;\n"
+"    pthread_mutex_unlock (&p->lock);\n"
+"    size_t n = cser_raw_par_len (p, i);\n"
+"    uint8_t *bytes = cser_raw_par_bytes (p, i);\n"
+"    cser_raw_buf_t c = { .p = bytes, .end = bytes + n * p->wire, .mem = bytes };\n"
+"    int ret = p->fn (&c, p->items + i * p->per * p->width, n);\n"
+"    if (ret == 0 && c.p != c.end)\n"
+"      ret = -EPROTO;\n"
+"    pthread_mutex_lock (&p->lock);\n"
+"    if (ret != 0 && p->ret == 0)\n"
+"      p->ret = ret;\n"
+"    p->fin[i % p->nslots] = i + 1;\n"
+"    pthread_cond_broadcast (&p->done);\n"
+"  }\n"
+"  pthread_mutex_unlock (&p->lock);\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"/* Waits for chunk i to be finished, or for any failure */\n"
+"static int cser_raw_par_wait (cser_raw_par_t *p, size_t i)\n"
+"{\n"
+"  pthread_mutex_lock (&p->lock);\n"
+"  while (p->fin[i % p->nslots] != i + 1 && p->ret == 0)\n"
+"    pthread_cond_wait (&p->done, &p->lock);\n"
+"  int ret = p->ret;\n"
+"  pthread_mutex_unlock (&p->lock);\n"
+"  return ret;\n"
+"}\n"
+"\n"
+"static void cser_raw_par_avail (cser_raw_par_t *p, size_t avail)\n"
+"{\n"
+"  pthread_mutex_lock (&p->lock);\n"
+"  p->avail = avail < p->nchunks ? avail : p->nchunks;\n"
+"  pthread_cond_broadcast (&p->wake);\n"
+"  pthread_mutex_unlock (&p->lock);\n"
+"}\n"
+"\n"
+"/* Runs below two chunks, or with nowhere to put them, are done serially */\n"
+"static int cser_raw_par_run (\n"
+"  cser_raw_buf_t *b, void *items, size_t count, size_t width, size_t wire,\n"
+"  cser_raw_par_fn fn, int load)\n"
+"{\n"
+"  size_t per = CSER_RAW_PAR_BYTES / wire ? CSER_RAW_PAR_BYTES / wire : 1;\n"
+"  if (count / per < 2 || b->iov)\n"
+"    return fn (b, items, count);\n"
+"  /* only asked for now, as sysconf () can cost more than a small run */\n"
+"  size_t threads = CSER_RAW_PAR_THREADS;\n"
+"  if (threads < 2)\n"
+"    return fn (b, items, count);\n"
+"\n"
+"  cser_raw_par_t p;\n"
+"  memset (&p, 0, sizeof (p));\n"
+"  p.fn = fn;\n"
+"  p.items = items;\n"
+"  p.width = width;\n"
+"  p.wire = wire;\n"
+"  p.count = count;\n"
+"  p.per = per;\n"
+"  p.nchunks = (count + per - 1) / per;\n"
+"  if (threads > p.nchunks)\n"
+"    threads = p.nchunks;\n"
+"  if ((size_t)(b->end - b->p) >= count * wire)\n"
+"  {\n"
+"    p.run = b->p;\n"
+"    p.nslots = 1;\n"
+"    p.avail = p.nchunks;\n"
+"  }\n"
+"  else\n"
+"  {\n"
+"    p.nslots = 2 * threads < p.nchunks ? 2 * threads : p.nchunks;\n"
+"    p.slots = malloc (p.nslots * per * wire);\n"
+"    p.avail = load ? 0 : p.nslots;\n"
+"  }\n"
+"  p.fin = calloc (p.nslots, sizeof (*p.fin));\n"
+"  pthread_t *tid = calloc (threads, sizeof (*tid));\n"
+"  size_t started = 0;\n"
+"  if (p.fin && tid && (p.run || p.slots) &&\n"
+"      pthread_mutex_init (&p.lock, 0) == 0)\n"
+"  {\n"
+"    if (pthread_cond_init (&p.wake, 0) == 0)\n"
+"    {\n"
+"      if (pthread_cond_init (&p.done, 0) == 0)\n"
+"      {\n"
+"        /* in place, the calling thread makes up the numbers */\n"
+"        while (started < threads - (p.run ? 1 : 0) &&\n"
+"               pthread_create (&tid[started], 0, cser_raw_par_work, &p) == 0)\n"
+"          ++started;\n"
+"        if (!started)\n"
+"          pthread_cond_destroy (&p.done);\n"
+"      }\n"
+"      if (!started)\n"
+"        pthread_cond_destroy (&p.wake);\n"
+"    }\n"
+"    if (!started)\n"
+"      pthread_mutex_destroy (&p.lock);\n"
+"  }\n"
+"  if (!started)\n"
+"  {\n"
+"    free (tid);\n"
+"    free (p.fin);\n"
+"    free (p.slots);\n"
+"    return fn (b, items, count);\n"
+"  }\n"
+"\n"
+"  int ret = 0;\n"
+"  if (p.run)\n"
+"    cser_raw_par_work (&p);\n"
+"  else if (load)\n"
+"  {\n"
+"    for (size_t i = 0; ret == 0 && i < p.nchunks; ++i)\n"
+"    {\n"
+"      if (i >= p.nslots)\n"
+"        ret = cser_raw_par_wait (&p, i - p.nslots);\n"
+"      if (ret == 0)\n"
+"        ret = cser_raw_bget (b, cser_raw_par_bytes (&p, i), cser_raw_par_len (&p, i) * wire);\n"
+"      if (ret == 0)\n"
+"        cser_raw_par_avail (&p, i + 1);\n"
+"    }\n"
+"  }\n"
+"  else\n"
+"  {\n"
+"    for (size_t i = 0; ret == 0 && i < p.nchunks; ++i)\n"
+"    {\n"
+"      ret = cser_raw_par_wait (&p, i);\n"
+"      if (ret == 0)\n"
+"        ret = cser_raw_bput (b, cser_raw_par_bytes (&p, i), cser_raw_par_len (&p, i) * wire);\n"
+"      cser_raw_par_avail (&p, i + 1 + p.nslots);\n"
+"    }\n"
+"  }\n"
+"\n"
+"  pthread_mutex_lock (&p.lock);\n"
+"  if (ret != 0)\n"
+"    p.stop = 1;\n"
+"  pthread_cond_broadcast (&p.wake);\n"
+"  pthread_mutex_unlock (&p.lock);\n"
+"  while (started)\n"
+"    pthread_join (tid[--started], 0);\n"
+"  if (ret == 0)\n"
+"    ret = p.ret;\n"
+"  if (ret == 0 && p.run)\n"
+"    b->p += count * wire;\n"
+"  pthread_cond_destroy (&p.done);\n"
+"  pthread_cond_destroy (&p.wake);\n"
+"  pthread_mutex_destroy (&p.lock);\n"
+"  free (tid);\n"
+"  free (p.fin);\n"
+"  free (p.slots);\n"
+"  return ret;\n"
+"}\n"
+"\n"
+"static inline int cser_raw_par_store (\n"
+"  cser_raw_buf_t *b, void *items, size_t count, size_t width, size_t wire, cser_raw_par_fn fn)\n"
+"{\n"
+"  return cser_raw_par_run (b, items, count, width, wire, fn, 0);\n"
+"}\n"
+"\n"
+"static inline int cser_raw_par_load (\n"
+"  cser_raw_buf_t *b, void *items, size_t count, size_t width, size_t wire, cser_raw_par_fn fn)\n"
+"{\n"
+"  return cser_raw_par_run (b, items, count, width, wire, fn, 1);\n"
+"}\n\n"
+, fc);
+}
+
+
+// The chunk workers of the parallel functions, see write_par_support
+static void write_par_items (const type_t *type, FILE *fc)
+{
+  char *utype = make_cname (type->type_name);
+  fprintf (fc,
+    "static int cser_raw_pstore_%s (cser_raw_buf_t *b, void *items, size_t count)\n"
+    "{\n"
+    "  const %s *val = items;\n"
+    "  for (size_t i = 0; i < count; ++i)\n"
+    "  {\n"
+    "    int ret = cser_raw_bstore_%s (&val[i], b);\n"
+    "    if (ret != 0)\n"
+    "      return ret;\n"
+    "  }\n"
+    "  return 0;\n"
+    "}\n"
+    "static int cser_raw_pload_%s (cser_raw_buf_t *b, void *items, size_t count)\n"
+    "{\n"
+    "  %s *val = items;\n"
+    "  for (size_t i = 0; i < count; ++i)\n"
+    "  {\n"
+    "    int ret = cser_raw_bload_%s (&val[i], b);\n"
+    "    if (ret != 0)\n"
+    "      return ret;\n"
+    "  }\n"
+    "  return 0;\n"
+    "}\n\n",
+    utype,
+    type->type_name,
+    utype,
+    utype,
+    type->type_name,
+    utype);
+  free (utype);
+}
+
+
+// Field tags, for tagged structs: each member goes out as its field id and
+// length, followed by the usual encoding, and a zero id ends the struct.
+static void write_tag_support (const type_list_t *types, FILE *fc)
+{
+  bool any_tagged = false;
+  for (const type_list_t *t = types; t; t = t->next)
+    any_tagged |= is_tagged (&t->def);
+  if (!any_tagged)
+    return;
+
+  fputs (
+"static inline size_t cser_raw_bsize_tag (uint64_t id, uint64_t len)\n"
+"{\n"
+"  return cser_raw_bsize_varint (id) + cser_raw_bsize_varint (len);\n"
+"}\n"
+"\n"
+"static inline int cser_raw_bput_tag (cser_raw_buf_t *b, uint64_t id, uint64_t len)\n"
+"{\n"
+"  int ret = cser_raw_bput_varint (b, id);\n"
+"  return ret != 0 ? ret : cser_raw_bput_varint (b, len);\n"
+"}\n"
+"\n"
+"/* The zero id at the end has no length */\n"
+"static inline int cser_raw_bget_tag (cser_raw_buf_t *b, uint64_t *id, uint64_t *len)\n"
+"{\n"
+"  int ret = cser_raw_bget_varint (b, id);\n"
+"  if (ret != 0 || *id == 0)\n"
+"    return ret;\n"
+"  return cser_raw_bget_varint (b, len);\n"
+"}\n\n", fc);
+}
+
+
+// Tagged structs, indexed arrays and loads of selected members all have
+// parts which a load may need to pass over unread.
+static void write_skip_support (const type_list_t *types, FILE *fc)
+{
+  bool any = false;
+  for (const type_list_t *t = types; t; t = t->next)
+    any |= is_tagged (&t->def) || has_index (&t->def);
+  if (!any && !options->masked)
+    return;
+
+  fputs (
+"/* Passes over n bytes of input, e.g. a member not known to this */\n"
+"/* version of a tagged struct, or the offset table of an array.   */\n"
+"static int cser_raw_bskip (cser_raw_buf_t *b, uint64_t n)\n"
+"{\n"
+"  if (n == 0)\n"
+"    return 0;\n"
+"  size_t avail = (size_t)(b->end - b->p);\n"
+"  if (avail >= n)\n"
+"  {\n"
+"    b->p += n;\n"
+"    return 0;\n"
+"  }\n"
+"  b->p += avail;\n"
+"  n -= avail;\n"
+"  while (n)\n"
+"  {\n"
+"    uint8_t tmp[256];\n"
+"    size_t k = n < sizeof (tmp) ? (size_t)n : sizeof (tmp);\n"
+"    int ret = cser_raw_bget (b, tmp, k);\n"
+"    if (ret != 0)\n"
+"      return ret;\n"
+"    n -= k;\n"
+"  }\n"
+"  return 0;\n"
+"}\n\n", fc);
+
+  // Strings are passed over by looking for the terminator in what has been
+  // read in already, if anything
+  fputs (
+"static inline int cser_raw_bskip_string (cser_raw_buf_t *b)\n"
+"{\n"
+"  for (;;)\n"
+"  {\n"
+"    if (b->p != b->end)\n"
+"    {\n"
+"      const uint8_t *nul = memchr (b->p, 0, (size_t)(b->end - b->p));\n"
+"      if (nul)\n"
+"      {\n"
+"        b->p = (uint8_t *)nul + 1;\n"
+"        return 0;\n"
+"      }\n"
+"      b->p = b->end;\n"
+"    }\n"
+"    uint8_t c;\n"
+"    int ret = cser_raw_bget (b, &c, sizeof (c));\n"
+"    if (ret != 0 || c == 0)\n"
+"      return ret;\n"
+"  }\n"
+"}\n\n", fc);
+}
+
+
+// Random access into indexed arrays goes through a positioned read, as
+// for pread(2), wrapped up as an ordinary read function for the cursor.
+static void write_index_support (const type_list_t *types, FILE *fh, FILE *fc)
+{
+  bool any = false;
+  for (const type_list_t *t = types; t; t = t->next)
+    any |= has_index (&t->def);
+  if (!any)
+    return;
+
+  fputs (
+"/* Reads n bytes at the given offset from the start of a stream, for */\n"
+"/* the _at loaders of indexed arrays. Returns zero on success.       */\n"
+"typedef int (*cser_raw_pread_fn) (uint8_t *bytes, size_t n, uint64_t offset, void *q);\n"
+"\n"
+"/* A stream held in memory, e.g. a mapped file */\n"
+"typedef struct cser_raw_mem\n"
+"{\n"
+"  const uint8_t *bytes;\n"
+"  size_t len;\n"
+"} cser_raw_mem_t;\n"
+"\n"
+"static inline int cser_raw_pread_mem (uint8_t *bytes, size_t n, uint64_t offset, void *q)\n"
+"{\n"
+"  const cser_raw_mem_t *mem = q;\n"
+"  if (offset > mem->len || n > mem->len - offset)\n"
+"    return -ENODATA;\n"
+"  memcpy (bytes, mem->bytes + offset, n);\n"
+"  return 0;\n"
+"}\n\n", fh);
+
+  fputs (
+"/* Arrays shorter than this are stored without offset table */\n"
+"#ifndef CSER_RAW_INDEX_MIN\n"
+"# define CSER_RAW_INDEX_MIN 64\n"
+"#endif\n"
+"\n"
+"static inline uint8_t cser_raw_index_width (uint64_t n, uint64_t total)\n"
+"{\n"
+"  if (n < CSER_RAW_INDEX_MIN)\n"
+"    return 0;\n"
+"  return total <= UINT32_MAX ? 4 : 8;\n"
+"}\n"
+"\n"
+"/* Table entries are big endian regardless of the byte order in use */\n"
+"static inline int cser_raw_bput_offset (cser_raw_buf_t *b, uint64_t offset, uint8_t width)\n"
+"{\n"
+"  uint8_t entry[8];\n"
+"  for (unsigned k = width; k > 0; --k, offset >>= 8)\n"
+"    entry[k - 1] = (uint8_t)offset;\n"
+"  return cser_raw_bput (b, entry, width);\n"
+"}\n"
+"\n"
+"typedef struct cser_raw_at\n"
+"{\n"
+"  cser_raw_pread_fn pr;\n"
+"  void *q;\n"
+"  uint64_t off;\n"
+"} cser_raw_at_t;\n"
+"\n"
+"static int cser_raw_at_read (uint8_t *bytes, size_t n, void *q)\n"
+"{\n"
+"  cser_raw_at_t *at = q;\n"
+"  int ret = at->pr (bytes, n, at->off, at->q);\n"
+"  if (ret == 0)\n"
+"    at->off += n;\n"
+"  return ret;\n"
+"}\n"
+"\n"
+"/* Moves from the start of the offset table of an n element array to */\n"
+"/* the start of element i.                                            */\n"
+"static int cser_raw_index_seek (cser_raw_at_t *at, uint8_t width, uint64_t i, uint64_t n)\n"
+"{\n"
+"  if (width != 4 && width != 8)\n"
+"    return -EPROTO;\n"
+"  uint8_t entry[8];\n"
+"  int ret = at->pr (entry, width, at->off + width * i, at->q);\n"
+"  if (ret != 0)\n"
+"    return ret;\n"
+"  uint64_t offset = 0;\n"
+"  for (unsigned k = 0; k < width; ++k)\n"
+"    offset = (offset << 8) | entry[k];\n"
+"  at->off += width * n + offset;\n"
+"  return 0;\n"
+"}\n\n", fc);
+
+  if (options->instrument)
+    fputs (
+"typedef struct cser_raw_stats_pio\n"
+"{\n"
+"  cser_stats_call_t call;\n"
+"  cser_raw_pread_fn pr;\n"
+"  void *q;\n"
+"} cser_raw_stats_pio_t;\n"
+"\n"
+"static int cser_raw_stats_pread (uint8_t *bytes, size_t n, uint64_t offset, void *q)\n"
+"{\n"
+"  cser_raw_stats_pio_t *io = q;\n"
+"  io->call.bytes += n;\n"
+"  return io->pr (bytes, n, offset, io->q);\n"
+"}\n\n", fc);
+}
+
+
+static void write_fields_support (FILE *fh)
+{
+  fputs (
+"/* Member selection for cser_raw_load_fields_*, e.g.                  */\n"
+"/* CSER_RAW_FIELD_BIT (CSER_RAW_FIELD_foo_a) | CSER_RAW_FIELD_BIT (...) */\n"
+"#define CSER_RAW_FIELD_BIT(id) (UINT64_C(1) << (id))\n\n", fh);
+}
+
+// Identity tracking for shared objects. The store side maps each object
+// (and its kind) to the id it was first written under, using an open
+// addressing hash table; the load side simply keeps the objects by id.
+static void write_ref_support (const type_list_t *types, FILE *fc)
+{
+  fputs (
+"#define CSER_RAW_REF_NULL 0\n"
+"#define CSER_RAW_REF_NEW  1\n"
+"#define CSER_RAW_REF_SEEN 2\n"
+"\n"
+"/* A cursor is used either for storing or loading, never both, and the */\n"
+"/* kinds and capacity are shared between the two uses accordingly.    */\n"
+"struct cser_raw_refs\n"
+"{\n"
+"  const void **keys; /* store: hash table of objects seen */\n"
+"  uint64_t *ids;     /* store: ids of those objects */\n"
+"  void **objs;       /* load: objects by id */\n"
+"  uint32_t *kinds;\n"
+"  size_t cap;\n"
+"  uint64_t count;    /* ids handed out */\n"
+"};\n"
+"\n"
+"void cser_raw_refs_release (cser_raw_buf_t *b)\n"
+"{\n"
+"  if (!b->refs)\n"
+"    return;\n"
+"  free (b->refs->keys);\n"
+"  free (b->refs->kinds);\n"
+"  free (b->refs->ids);\n"
+"  free (b->refs->objs);\n"
+"  free (b->refs);\n"
+"  b->refs = 0;\n"
+"}\n"
+"\n"
+"static inline int cser_raw_count_fn (const uint8_t *bytes, size_t n, void *q)\n"
+"{\n"
+"  (void)bytes;\n"
+"  *(size_t *)q += n;\n"
+"  return 0;\n"
+"}\n\n"
+, fc);
+
+  bool any_shared = false;
+  for (const type_list_t *t = types; t; t = t->next)
+    for (const member_t *m = t->def.csfn == TYPE_COMPOSITE ? t->def.composite : 0; m; m = m->next)
+      any_shared |= m->opts.shared;
+  if (!any_shared)
+    return;
+
+  fputs (
+"static inline size_t cser_raw_ref_slot (const void *obj, uint32_t kind, size_t cap)\n"
+"{\n"
+"  uint64_t h = ((uint64_t)(uintptr_t)obj ^ kind) * 0x9e3779b97f4a7c15ull;\n"
+"  return (size_t)(h ^ (h >> 32)) & (cap - 1);\n"
+"}\n"
+"\n"
+"static int cser_raw_ref_grow (struct cser_raw_refs *r)\n"
+"{\n"
+"  size_t cap = r->cap ? 2 * r->cap : 64;\n"
+"  const void **keys = calloc (cap, sizeof (*keys));\n"
+"  uint32_t *kinds = malloc (cap * sizeof (*kinds));\n"
+"  uint64_t *ids = malloc (cap * sizeof (*ids));\n"
+"  if (!keys || !kinds || !ids)\n"
+"  {\n"
+"    free (keys);\n"
+"    free (kinds);\n"
+"    free (ids);\n"
+"    return -ENOMEM;\n"
+"  }\n"
+"  for (size_t i = 0; i < r->cap; ++i)\n"
+"  {\n"
+"    if (!r->keys[i])\n"
+"      continue;\n"
+"    size_t j = cser_raw_ref_slot (r->keys[i], r->kinds[i], cap);\n"
+"    while (keys[j])\n"
+"      j = (j + 1) & (cap - 1);\n"
+"    keys[j] = r->keys[i];\n"
+"    kinds[j] = r->kinds[i];\n"
+"    ids[j] = r->ids[i];\n"
+"  }\n"
+"  free (r->keys);\n"
+"  free (r->kinds);\n"
+"  free (r->ids);\n"
+"  r->keys = keys;\n"
+"  r->kinds = kinds;\n"
+"  r->ids = ids;\n"
+"  r->cap = cap;\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"/* Writes the reference tag for a shared object: null, new (fresh is */\n"
+"/* set, and the caller writes the object out next), or seen followed */\n"
+"/* by the id of the earlier copy.                                      */\n"
+"static int cser_raw_ref_put (cser_raw_buf_t *b, const void *obj, uint32_t kind, bool *fresh)\n"
+"{\n"
+"  uint8_t tag = CSER_RAW_REF_NULL;\n"
+"  *fresh = false;\n"
+"  if (!obj)\n"
+"    return cser_raw_bput (b, &tag, sizeof (tag));\n"
+"  if (!b->refs && !(b->refs = calloc (1, sizeof (*b->refs))))\n"
+"    return -ENOMEM;\n"
+"  struct cser_raw_refs *r = b->refs;\n"
+"  if (2 * (r->count + 1) > r->cap)\n"
+"  {\n"
+"    int ret = cser_raw_ref_grow (r);\n"
+"    if (ret != 0)\n"
+"      return ret;\n"
+"  }\n"
+"  size_t i = cser_raw_ref_slot (obj, kind, r->cap);\n"
+"  for (; r->keys[i]; i = (i + 1) & (r->cap - 1))\n"
+"  {\n"
+"    if (r->keys[i] == obj && r->kinds[i] == kind)\n"
+"    {\n"
+"      tag = CSER_RAW_REF_SEEN;\n"
+"      int ret = cser_raw_bput (b, &tag, sizeof (tag));\n"
+"      return ret != 0 ? ret : cser_raw_bput_varint (b, r->ids[i]);\n"
+"    }\n"
+"  }\n"
+"  r->keys[i] = obj;\n"
+"  r->kinds[i] = kind;\n"
+"  r->ids[i] = r->count++;\n"
+"  tag = CSER_RAW_REF_NEW;\n"
+"  *fresh = true;\n"
+"  return cser_raw_bput (b, &tag, sizeof (tag));\n"
+"}\n"
+"\n"
+"/* Reads a reference tag, resolving references to earlier objects. New */\n"
+"/* objects are to be registered with cser_raw_ref_add.                  */\n"
+"static int cser_raw_ref_get (cser_raw_buf_t *b, uint32_t kind, uint8_t *tag, void **obj)\n"
+"{\n"
+"  int ret = cser_raw_bget (b, tag, sizeof (*tag));\n"
+"  if (ret != 0 || *tag == CSER_RAW_REF_NULL || *tag == CSER_RAW_REF_NEW)\n"
+"    return ret;\n"
+"  if (*tag != CSER_RAW_REF_SEEN)\n"
+"    return -EPROTO;\n"
+"  uint64_t id = 0;\n"
+"  ret = cser_raw_bget_varint (b, &id);\n"
+"  if (ret != 0)\n"
+"    return ret;\n"
+"  const struct cser_raw_refs *r = b->refs;\n"
+"  if (!r || id >= r->count || r->kinds[id] != kind)\n"
+"    return -EPROTO;\n"
+"  *obj = r->objs[id];\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"static int cser_raw_ref_add (cser_raw_buf_t *b, uint32_t kind, void *obj)\n"
+"{\n"
+"  if (!b->refs && !(b->refs = calloc (1, sizeof (*b->refs))))\n"
+"    return -ENOMEM;\n"
+"  struct cser_raw_refs *r = b->refs;\n"
+"  if (r->count == r->cap)\n"
+"  {\n"
+"    size_t cap = r->cap ? 2 * r->cap : 64;\n"
+"    void **objs = realloc (r->objs, cap * sizeof (*objs));\n"
+"    if (!objs)\n"
+"      return -ENOMEM;\n"
+"    r->objs = objs;\n"
+"    uint32_t *kinds = realloc (r->kinds, cap * sizeof (*kinds));\n"
+"    if (!kinds)\n"
+"      return -ENOMEM;\n"
+"    r->kinds = kinds;\n"
+"    r->cap = cap;\n"
+"  }\n"
+"  r->objs[r->count] = obj;\n"
+"  r->kinds[r->count++] = kind;\n"
+"  return 0;\n"
+"}\n\n"
+, fc);
+}
+
+
+// Resumable (de)serialization. The state of a run is a stack of frames,
+// each recording an object, the state reached within it and an array
+// index. Bytes move through small resumable primitives which keep their
+// progress in the context, so that any of them can give up when the
+// callback would block, and be called again later to carry on.
+static void write_resumable_support (const type_list_t *types, FILE *fh, FILE *fc)
+{
+  fputs (
+"/* Resumable (de)serialization, for use with non-blocking I/O. The  */\n"
+"/* callbacks follow write(2)/read(2): they return the number of      */\n"
+"/* bytes moved, which may be fewer than asked for, or a negative     */\n"
+"/* errno value. A read of zero bytes marks the end of the input. An  */\n"
+"/* error (typically -EAGAIN) suspends the run, which keeps its       */\n"
+"/* position in the cser_raw_nb_t, and cser_raw_nb_resume carries on */\n"
+"/* from there. Errors found in the data itself end the run.          */\n"
+"typedef ssize_t (*cser_raw_nb_write_fn) (const uint8_t *bytes, size_t n, void *q);\n"
+"typedef ssize_t (*cser_raw_nb_read_fn) (uint8_t *bytes, size_t n, void *q);\n"
+"\n"
+"#ifndef CSER_RAW_NB_DEPTH\n"
+"# define CSER_RAW_NB_DEPTH 32\n"
+"#endif\n"
+"struct cser_raw_nb;\n"
+"typedef struct cser_raw_nb_frame\n"
+"{\n"
+"  int (*step) (struct cser_raw_nb *s, struct cser_raw_nb_frame *f);\n"
+"  void *val;       /* object being (de)serialized */\n"
+"  unsigned member; /* state reached within it */\n"
+"  size_t i;        /* array index */\n"
+"  size_t n;        /* array length or capacity, if not in the object */\n"
+"} cser_raw_nb_frame_t;\n"
+"\n"
+"typedef struct cser_raw_nb\n"
+"{\n"
+"  cser_raw_nb_write_fn w;\n"
+"  cser_raw_nb_read_fn r;\n"
+"  void *q;\n"
+"  const cser_alloc_t *alloc; /* for loading; null selects the C library */\n"
+"  cser_raw_nb_frame_t stack[CSER_RAW_NB_DEPTH];\n"
+"  unsigned depth;\n"
+"  size_t part;     /* bytes of the current item moved so far */\n"
+"  uint64_t v;      /* varint being loaded */\n"
+"  unsigned shift;\n"
+"  uint8_t tmp[10]; /* varint being stored */\n"
+"  size_t head;\n"
+"  size_t tail;\n"
+"  uint8_t buf[CSER_RAW_BUFSZ]; /* stored bytes not yet taken by w */\n"
+"} cser_raw_nb_t;\n"
+"\n"
+"/* Returns 0 once the whole object has been moved. */\n"
+"int cser_raw_nb_resume (cser_raw_nb_t *s);\n\n"
+, fh);
+
+  fputs (
+"#define CSER_RAW_NB_CALL 1\n"
+"\n"
+"typedef int (*cser_raw_nb_step_fn) (cser_raw_nb_t *s, cser_raw_nb_frame_t *f);\n"
+"\n"
+"static inline int cser_raw_nb_push (cser_raw_nb_t *s, cser_raw_nb_step_fn step, const void *val)\n"
+"{\n"
+"  if (s->depth == CSER_RAW_NB_DEPTH)\n"
+"    return -EOVERFLOW;\n"
+"  cser_raw_nb_frame_t *f = &s->stack[s->depth++];\n"
+"  f->step = step;\n"
+"  f->val = (void *)val;\n"
+"  f->member = 0;\n"
+"  f->i = 0;\n"
+"  f->n = 0;\n"
+"  return CSER_RAW_NB_CALL;\n"
+"}\n"
+"\n"
+"/* Descends into a nested object, continuing with the given state of */\n"
+"/* the current one once that is done.                                 */\n"
+"static inline int cser_raw_nb_call (cser_raw_nb_t *s, cser_raw_nb_frame_t *f, unsigned next, cser_raw_nb_step_fn step, const void *val)\n"
+"{\n"
+"  f->member = next;\n"
+"  return cser_raw_nb_push (s, step, val);\n"
+"}\n"
+"\n"
+"static int cser_raw_nb_flush (cser_raw_nb_t *s)\n"
+"{\n"
+"  while (s->head < s->tail)\n"
+"  {\n"
+"    if (!s->w)\n"
+"      return -ENOSPC;\n"
+"    ssize_t n = s->w (s->buf + s->head, s->tail - s->head, s->q);\n"
+"    if (n < 0)\n"
+"      return (int)n;\n"
+"    if (n == 0)\n"
+"      return -EIO;\n"
+"    s->head += (size_t)n;\n"
+"  }\n"
+"  s->head = s->tail = 0;\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"static inline int cser_raw_nput (cser_raw_nb_t *s, const uint8_t *bytes, size_t n, int swap)\n"
+"{\n"
+"  while (s->part < n)\n"
+"  {\n"
+"    if (s->tail == sizeof (s->buf))\n"
+"    {\n"
+"      int ret = cser_raw_nb_flush (s);\n"
+"      if (ret != 0)\n"
+"        return ret;\n"
+"    }\n"
+"    size_t k = n - s->part;\n"
+"    if (k > sizeof (s->buf) - s->tail)\n"
+"      k = sizeof (s->buf) - s->tail;\n"
+"    if (swap)\n"
+"      for (size_t j = 0; j < k; ++j)\n"
+"        s->buf[s->tail + j] = bytes[n - 1 - s->part - j];\n"
+"    else\n"
+"      memcpy (s->buf + s->tail, bytes + s->part, k);\n"
+"    s->tail += k;\n"
+"    s->part += k;\n"
+"  }\n"
+"  s->part = 0;\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"static inline int cser_raw_nput_array (cser_raw_nb_t *s, const void *items, size_t count, size_t width)\n"
+"{\n"
+"  const uint8_t *src = items;\n"
+"  size_t total = count * width;\n"
+"  if (width == 1 || !CSER_RAW_SWAP)\n"
+"    return cser_raw_nput (s, src, total, 0);\n"
+"  while (s->part < total)\n"
+"  {\n"
+"    if (s->tail == sizeof (s->buf))\n"
+"    {\n"
+"      int ret = cser_raw_nb_flush (s);\n"
+"      if (ret != 0)\n"
+"        return ret;\n"
+"    }\n"
+"    size_t room = sizeof (s->buf) - s->tail;\n"
+"    size_t at = s->part % width;\n"
+"    if (at == 0 && room >= width)\n"
+"    {\n"
+"      size_t k = room / width;\n"
+"      if (k > (total - s->part) / width)\n"
+"        k = (total - s->part) / width;\n"
+"      cser_raw_swap_copy (s->buf + s->tail, src + s->part, k, width);\n"
+"      s->tail += k * width;\n"
+"      s->part += k * width;\n"
+"    }\n"
+"    else\n"
+"    {\n"
+"      /* an element straddling a flush goes byte by byte */\n"
+"      s->buf[s->tail++] = src[s->part - at + width - 1 - at];\n"
+"      ++s->part;\n"
+"    }\n"
+"  }\n"
+"  s->part = 0;\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"static inline int cser_raw_nput_varint (cser_raw_nb_t *s, uint64_t v)\n"
+"{\n"
+"  size_t n = 0;\n"
+"  while (v >= 0x80)\n"
+"  {\n"
+"    s->tmp[n++] = (uint8_t)(v | 0x80);\n"
+"    v >>= 7;\n"
+"  }\n"
+"  s->tmp[n++] = (uint8_t)v;\n"
+"  return cser_raw_nput (s, s->tmp, n, 0);\n"
+"}\n"
+"\n"
+"static inline int cser_raw_nget (cser_raw_nb_t *s, uint8_t *bytes, size_t n)\n"
+"{\n"
+"  while (s->part < n)\n"
+"  {\n"
+"    if (!s->r)\n"
+"      return -ENODATA;\n"
+"    ssize_t got = s->r (bytes + s->part, n - s->part, s->q);\n"
+"    if (got < 0)\n"
+"      return (int)got;\n"
+"    if (got == 0)\n"
+"      return -ENODATA;\n"
+"    s->part += (size_t)got;\n"
+"  }\n"
+"  s->part = 0;\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"static inline int cser_raw_nget_array (cser_raw_nb_t *s, void *items, size_t count, size_t width)\n"
+"{\n"
+"  int ret = cser_raw_nget (s, items, count * width);\n"
+"  if (ret == 0 && width > 1 && CSER_RAW_SWAP)\n"
+"    cser_raw_swap_copy (items, items, count, width);\n"
+"  return ret;\n"
+"}\n"
+"\n"
+"/* The shuffled transfers keep their place as a byte count in part */\n"
+"static inline int cser_raw_nput_shuffled (cser_raw_nb_t *s, const void *items, size_t count, size_t width)\n"
+"{\n"
+"  const uint8_t *src = items;\n"
+"  while (s->part < count * width)\n"
+"  {\n"
+"    if (s->tail == sizeof (s->buf))\n"
+"    {\n"
+"      int ret = cser_raw_nb_flush (s);\n"
+"      if (ret != 0)\n"
+"        return ret;\n"
+"    }\n"
+"    size_t at = s->part % count;\n"
+"    const uint8_t *col = src + CSER_RAW_PLANE (s->part / count, width);\n"
+"    size_t k = count - at;\n"
+"    if (k > sizeof (s->buf) - s->tail)\n"
+"      k = sizeof (s->buf) - s->tail;\n"
+"    for (size_t j = 0; j < k; ++j)\n"
+"      s->buf[s->tail + j] = col[(at + j) * width];\n"
+"    s->tail += k;\n"
+"    s->part += k;\n"
+"  }\n"
+"  s->part = 0;\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"/* Loading does not otherwise use buf, so it holds the plane bytes read */\n"
+"static inline int cser_raw_nget_shuffled (cser_raw_nb_t *s, void *items, size_t count, size_t width)\n"
+"{\n"
+"  uint8_t *dst = items;\n"
+"  while (s->part < count * width)\n"
+"  {\n"
+"    if (!s->r)\n"
+"      return -ENODATA;\n"
+"    size_t at = s->part % count;\n"
+"    uint8_t *col = dst + CSER_RAW_PLANE (s->part / count, width);\n"
+"    size_t k = count - at;\n"
+"    if (k > sizeof (s->buf))\n"
+"      k = sizeof (s->buf);\n"
+"    ssize_t got = s->r (s->buf, k, s->q);\n"
+"    if (got < 0)\n"
+"      return (int)got;\n"
+"    if (got == 0)\n"
+"      return -ENODATA;\n"
+"    for (size_t j = 0; j < (size_t)got; ++j)\n"
+"      col[(at + j) * width] = s->buf[j];\n"
+"    s->part += (size_t)got;\n"
+"  }\n"
+"  s->part = 0;\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"static inline int cser_raw_nget_varint (cser_raw_nb_t *s, uint64_t *v)\n"
+"{\n"
+"  for (;;)\n"
+"  {\n"
+"    if (s->shift >= 64)\n"
+"      return -EOVERFLOW;\n"
+"    uint8_t byte;\n"
+"    int ret = cser_raw_nget (s, &byte, 1);\n"
+"    if (ret != 0)\n"
+"      return ret;\n"
+"    s->v |= (uint64_t)(byte & 0x7f) << s->shift;\n"
+"    s->shift += 7;\n"
+"    if (!(byte & 0x80))\n"
+"    {\n"
+"      *v = s->v;\n"
+"      s->v = 0;\n"
+"      s->shift = 0;\n"
+"      return 0;\n"
+"    }\n"
+"  }\n"
+"}\n"
+"\n"
+"int cser_raw_nb_resume (cser_raw_nb_t *s)\n"
+"{\n"
+"  while (s->depth)\n"
+"  {\n"
+"    cser_raw_nb_frame_t *f = &s->stack[s->depth - 1];\n"
+"    int ret = f->step (s, f);\n"
+"    if (ret < 0)\n"
+"      return ret;\n"
+"    if (ret != CSER_RAW_NB_CALL)\n"
+"      --s->depth;\n"
+"  }\n"
+"  return cser_raw_nb_flush (s);\n"
+"}\n"
+"\n", fc);
+
+  // The rest is only used by the entry points of resumable types
+  bool any = false;
+  for (const type_list_t *t = types; t; t = t->next)
+    any = any || (t->def.csfn == TYPE_COMPOSITE && !reaches_unresumable (&t->def));
+  if (!any)
+    return;
+
+  fputs (
+"/* The stream header is run as a frame of its own, on top of the root */\n"
+"static int cser_raw_nb_start (\n"
+"  cser_raw_nb_t *s, cser_raw_nb_step_fn header, cser_raw_nb_step_fn step, const void *val,\n"
+"  cser_raw_nb_write_fn w, cser_raw_nb_read_fn r, void *q, const cser_alloc_t *alloc", fc);
+  // With -P the header frame is handed the fingerprint to store or check
+  fputs (options->prefixed ? ",\n  const uint64_t *fingerprint)\n" : ")\n", fc);
+  fputs (
+"{\n"
+"  s->w = w;\n"
+"  s->r = r;\n"
+"  s->q = q;\n"
+"  s->alloc = alloc;\n"
+"  s->depth = 0;\n"
+"  s->part = 0;\n"
+"  s->v = 0;\n"
+"  s->shift = 0;\n"
+"  s->head = s->tail = 0;\n"
+"  cser_raw_nb_push (s, step, val);\n", fc);
+  fputs (options->prefixed ?
+    "  cser_raw_nb_push (s, header, fingerprint);\n" :
+    "  cser_raw_nb_push (s, header, 0);\n", fc);
+  fputs (
+"  return cser_raw_nb_resume (s);\n"
+"}\n\n"
+, fc);
+
+  fputs (
+    "static int cser_raw_nstore_step_header (cser_raw_nb_t *s, cser_raw_nb_frame_t *f)\n"
+    "{\n", fc);
+  if (options->prefixed)
+    fputs (
+      "  if (f->member == 0)\n"
+      "  {\n"
+      "    const uint64_t fingerprint = *(const uint64_t *)f->val;\n"
+      "    for (int i = 0; i < CSER_RAW_FINGERPRINT_SIZE; ++i)\n"
+      "      s->tmp[i] = (uint8_t)(fingerprint >> (56 - 8 * i));\n"
+      "    int ret = cser_raw_nput (s, s->tmp, CSER_RAW_FINGERPRINT_SIZE, 0);\n"
+      "    if (ret != 0)\n"
+      "      return ret;\n"
+      "    f->member = 1;\n"
+      "  }\n", fc);
+  else
+    fputs ("  (void)f;\n", fc);
+  if (options->byte_order != ORDER_DEFAULT)
+    fputs (
+      "  const uint8_t order = CSER_RAW_WIRE_BE ? 'B' : 'L';\n"
+      "  return cser_raw_nput (s, &order, sizeof (order), 0);\n", fc);
+  else
+    fputs (
+      "  (void)s;\n"
+      "  return 0;\n", fc);
+  fputs (
+    "}\n\n"
+    "static int cser_raw_nload_step_header (cser_raw_nb_t *s, cser_raw_nb_frame_t *f)\n"
+    "{\n", fc);
+  if (options->prefixed)
+    fputs (
+      "  if (f->member == 0)\n"
+      "  {\n"
+      "    int ret = cser_raw_nget (s, s->tmp, CSER_RAW_FINGERPRINT_SIZE);\n"
+      "    if (ret != 0)\n"
+      "      return ret;\n"
+      "    uint64_t got = 0;\n"
+      "    for (int i = 0; i < CSER_RAW_FINGERPRINT_SIZE; ++i)\n"
+      "      got = (got << 8) | s->tmp[i];\n"
+      "    if (got != *(const uint64_t *)f->val)\n"
+      "      return -EPROTO;\n"
+      "    f->member = 1;\n"
+      "  }\n", fc);
+  else
+    fputs ("  (void)f;\n", fc);
+  if (options->byte_order != ORDER_DEFAULT)
+    fputs (
+      "  uint8_t order;\n"
+      "  int ret = cser_raw_nget (s, &order, sizeof (order));\n"
+      "  if (ret == 0 && order != (CSER_RAW_WIRE_BE ? 'B' : 'L'))\n"
+      "    ret = -EPROTO;\n"
+      "  return ret;\n", fc);
+  else
+    fputs (
+      "  (void)s;\n"
+      "  return 0;\n", fc);
+  fputs ("}\n\n", fc);
+}
+
+
+static bool write_resumable_native (const type_t *type, FILE *fc)
+{
+  char *utype = make_cname (type->type_name);
+
+  if (is_integer_native (type->type_name))
+    fprintf (fc,
+      "static inline int cser_raw_nstore_varint_%s (cser_raw_nb_t *s, const %s *val)\n"
+      "{\n"
+      "  if ((%s)-1 < (%s)1)\n"
+      "  {\n"
+      "    int64_t v = (int64_t)*val;\n"
+      "    return cser_raw_nput_varint (s, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));\n"
+      "  }\n"
+      "  return cser_raw_nput_varint (s, (uint64_t)*val);\n"
+      "}\n"
+      "static inline int cser_raw_nload_varint_%s (cser_raw_nb_t *s, %s *val)\n"
+      "{\n"
+      "  uint64_t v = 0;\n"
+      "  int ret = cser_raw_nget_varint (s, &v);\n"
+      "  if (ret != 0)\n"
+      "    return ret;\n"
+      "  if ((%s)-1 < (%s)1)\n"
+      "  {\n"
+      "    int64_t sv = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);\n"
+      "    *val = (%s)sv;\n"
+      "    if ((int64_t)*val != sv)\n"
+      "      return -ERANGE;\n"
+      "  }\n"
+      "  else\n"
+      "  {\n"
+      "    *val = (%s)v;\n"
+      "    if ((uint64_t)*val != v)\n"
+      "      return -ERANGE;\n"
+      "  }\n"
+      "  return 0;\n"
+      "}\n",
+      utype, type->type_name,
+      type->type_name, type->type_name,
+      utype, type->type_name,
+      type->type_name, type->type_name,
+      type->type_name,
+      type->type_name);
+
+  if (is_varint_native (type->type_name))
+    fprintf (fc,
+      "static inline int cser_raw_nstore_%s (cser_raw_nb_t *s, const %s *val)\n"
+      "{ return cser_raw_nstore_varint_%s (s, val); }\n"
+      "static inline int cser_raw_nload_%s (cser_raw_nb_t *s, %s *val)\n"
+      "{ return cser_raw_nload_varint_%s (s, val); }\n",
+      utype, type->type_name, utype,
+      utype, type->type_name, utype);
+  else
+  {
+    fprintf (fc,
+      "static inline int cser_raw_nstore_%s (cser_raw_nb_t *s, const %s *val)\n"
+      "{ return cser_raw_nput (s, (const uint8_t *)val, sizeof (%s), CSER_RAW_SWAP); }\n"
+      "static inline int cser_raw_nload_%s (cser_raw_nb_t *s, %s *val)\n"
+      "{\n",
+      utype, type->type_name, type->type_name,
+      utype, type->type_name);
+    if (strcmp (type->type_name, "_Bool") == 0)
+      fputs (
+        "  uint8_t byte;\n"
+        "  int ret = cser_raw_nget (s, &byte, 1);\n"
+        "  if (ret == 0)\n"
+        "    *val = (byte != 0);\n", fc);
+    else
+      fprintf (fc,
+        "  int ret = cser_raw_nget (s, (uint8_t *)val, sizeof (%s));\n"
+        "  if (ret == 0 && CSER_RAW_SWAP)\n"
+        "    cser_raw_swap ((uint8_t *)val, sizeof (%s));\n",
+        type->type_name,
+        type->type_name);
+    fputs (
+      "  return ret;\n"
+      "}\n", fc);
+  }
+
   free (utype);
-  return !ferror (fh) && !ferror (fc);
+  return !ferror (fc);
 }
 
 
-static void write_presence (FILE *fc, const char *name, bool arr)
+// The states a member takes up in its step function
+static unsigned nb_states (const member_t *m)
 {
-  fprintf (fc,
-    "   uint8_t present = (val->%s%s != 0);\n"
-    "   int ret = w (&present, sizeof (present), q);\n"
-    "   if (ret != 0)\n"
-    "     return ret;\n"
-    "   if (present)\n"
-    "   {\n",
-    name, arr ? "[i]" : ""
-    );
+  if (options->counted && m->opts.cardinality == CDN_ZEROTERM_ARRAY)
+    return 3; // presence, count, items
+  switch (m->opts.cardinality)
+  {
+    case CDN_SINGLE:
+    case CDN_FIXED_ARRAY:
+      return m->opts.is_ptr ? 2 : 1;
+    default:
+      return 2; // presence, items
+  }
 }
 
 
-static bool write_store_struct (const type_t *type, FILE *fh, FILE *fc)
+static void nb_goto (const char *indent, unsigned state, FILE *fc)
 {
-  char *utype = make_cname (type->type_name);
-  fprintf (fh,
-    "int cser_raw_store_%s (const %s *val, cser_raw_write_fn w, void *q);\n",
-    utype, type->type_name);
-
   fprintf (fc,
-    "int cser_raw_store_%s (const %s *val, cser_raw_write_fn w, void *q)\n"
-    "{\n",
-    utype, type->type_name);
+    "%sf->i = 0;\n"
+    "%sf->member = %u;\n"
+    "%sbreak;\n",
+    indent, indent, state, indent);
+}
 
-  free (utype);
-  utype = 0;
 
-  for (member_t *m = type->composite; m; m = m->next)
-  {
-    fputs (" {\n", fc);
-    bool array = false;
-    if (m->opts.variable_array_size_member)
-    {
-      if (!m->opts.is_ptr)
-        abort ();
-      write_presence (fc, m->member_name, false);
-      fprintf (fc,
-        "    for (size_t i = 0; (val->%s) && (i < val->%s); ++i)\n"
-        "    {\n",
-        m->member_name, m->opts.variable_array_size_member
-        );
-      array = true;
-    }
-    else switch (m->opts.cardinality)
-    {
-      case CDN_ZEROTERM_ARRAY:
-        write_presence (fc, m->member_name, false);
-        fprintf (fc,
-          "    for (size_t i = 0; (val->%s) && ((i == 0) || (val->%s[i-1])); ++i)\n"
-          "    {\n",
-          m->member_name, m->member_name
-          );
-        array = true;
-        break;
-      case CDN_SINGLE:
-        if (m->opts.is_ptr)
-          write_presence (fc, m->member_name, false);
-        else
-          fputs ("    {\n", fc);
-        break;
-      default:
-        fprintf (fc,
-          "  for (size_t i = 0; i < (%s); ++i)\n"
-          "  {\n",
-          m->opts.arr_sz);
-        if (m->opts.is_ptr)
-          write_presence (fc, m->member_name, true);
-        else
-          fputs ("   {\n", fc);
-        array = true;
-        break;
-    }
-    /* !ptr || zeroterm || variable -> &, else "" */
-    bool need_amp =
-      (!m->opts.is_ptr ||
-       m->opts.cardinality == CDN_ZEROTERM_ARRAY ||
-       m->opts.variable_array_size_member);
-    utype = make_cname (m->base_type);
+// Emits the presence flag of a pointer. Past a null pointer the member is
+// done, or for arrays of pointers, the element.
+static void nb_presence (
+  const member_t *m, bool load, bool arr, unsigned after, FILE *fc)
+{
+  if (load)
+    fputs (
+      "      {\n"
+      "        uint8_t present;\n"
+      "        int ret = cser_raw_nget (s, &present, 1);\n", fc);
+  else
     fprintf (fc,
-      "      int ret = cser_raw_store_%s ((%s*)%sval->%s%s, w, q);\n"
-      "      if (ret != 0)\n"
-      "        return ret;\n"
-      "   }\n"
-      "%s\n",
-      utype,
-      m->base_type,
-      need_amp ? "&" : "",
-      m->member_name,
-      array ? "[i]" : "",
-      array ? "  }" : ""
-      );
-    free (utype);
-
-    fputs (" }\n", fc);
-  }
-
-  fputs ("  return 0;\n}\n", fc);
-
-  return !ferror (fh) && !ferror (fc);
+      "      {\n"
+      "        uint8_t present = (val->%s%s != 0);\n"
+      "        int ret = cser_raw_nput (s, &present, 1, 0);\n",
+      m->member_name, arr ? "[f->i]" : "");
+  fputs (
+    "        if (ret != 0)\n"
+    "          return ret;\n"
+    "        if (!present)\n"
+    "        {\n", fc);
+  if (arr)
+    fputs (
+      "          ++f->i;\n"
+      "          break;\n", fc);
+  else
+    nb_goto ("          ", after, fc);
+  fputs (
+    "        }\n"
+    "      }\n", fc);
 }
 
-static void write_load_item (
-  const char *target, const char *base_type, const char *indent, bool pointer,
+
+// Emits the transfer of a single item of the member, optionally indexed
+// by the array index. Nested objects move on to the next element right
+// away, as the item is then done by the time this state comes around
+// again.
+static void nb_item (
+  const member_t *m, bool load, bool amp, bool indexed, unsigned next,
   FILE *fc)
 {
-  char *utype = make_cname (base_type);
-
-  if (pointer)
-  {
+  const type_t *t = lookup_type (m->base_type);
+  char *utype = codec_name (m->base_type, is_varint_member (m));
+  bool nested = t && t->csfn == TYPE_COMPOSITE;
+  char *addr;
+  if (asprintf (&addr, "%sval->%s%s", amp ? "&" : "", m->member_name,
+        !indexed ? "" : nested ? "[f->i++]" : "[f->i]") < 0)
+    abort ();
+  if (nested)
     fprintf (fc,
-      "%s%s *tmp_item = calloc (1, sizeof (%s));\n"
-      "%sif (!tmp_item)\n"
-      "%s  return -ENOMEM;\n"
-      "%sint ret = cser_raw_load_%s (tmp_item, r, q);\n"
-      "%sif (ret == 0)\n"
-      "%s  %s = tmp_item;\n"
-      "%selse\n"
-      "%s  free (tmp_item);\n",
-      indent, base_type, base_type,
-      indent,
-      indent,
-      indent, utype,
-      indent,
-      indent, target,
-      indent,
-      indent
-      );
-  }
+      "      return cser_raw_nb_call (s, f, %u, cser_raw_n%s_step_%s, %s);\n",
+      next, load ? "load" : "store", utype, addr);
   else
+  {
     fprintf (fc,
-      "%sint ret = cser_raw_load_%s ((%s*)&%s, r, q);\n",
-      indent, utype, base_type, target
-      );
-
+      "      {\n"
+      "        int ret = cser_raw_n%s_%s (s, (%s%s *)%s);\n"
+      "        if (ret != 0)\n"
+      "          return ret;\n"
+      "      }\n",
+      load ? "load" : "store", utype, load ? "" : "const ", m->base_type,
+      addr);
+    if (indexed)
+      fprintf (fc,
+        "      ++f->i;\n"
+        "      f->member = %u;\n"
+        "      break;\n",
+        next);
+    else
+      nb_goto ("      ", next, fc);
+  }
+  free (addr);
   free (utype);
 }
 
 
-static void write_presence_check (FILE *fc)
+// Emits the transfer of count items, in bulk where possible
+static void nb_items (
+  const member_t *m, bool load, const char *items, const char *count,
+  unsigned state, unsigned after, FILE *fc)
 {
+  const type_t *t = lookup_type (m->base_type);
+  if (is_bulk_native (m->base_type) && !is_varint_member (m))
+  {
+    fprintf (fc,
+      "      {\n"
+      "        int ret = cser_raw_n%s_%s (s, %s, %s, sizeof (%s));\n"
+      "        if (ret != 0)\n"
+      "          return ret;\n"
+      "      }\n",
+      load ? "get" : "put", m->opts.shuffle ? "shuffled" : "array",
+      items, count, m->base_type);
+    nb_goto ("      ", after, fc);
+    return;
+  }
+  if (is_pod (t))
+  {
+    char *utype = make_cname (m->base_type);
+    fprintf (fc,
+      "      if (CSER_RAW_POD_%s)\n"
+      "      {\n"
+      "        int ret = cser_raw_n%s (s, (%suint8_t *)%s, (%s) * sizeof (%s)%s);\n"
+      "        if (ret != 0)\n"
+      "          return ret;\n"
+      "        f->i = (%s);\n"
+      "      }\n",
+      utype,
+      load ? "get" : "put", load ? "" : "const ", items, count, m->base_type,
+      load ? "" : ", 0",
+      count);
+    free (utype);
+  }
   fprintf (fc,
-    "  uint8_t present;\n"
-    "  int ret = r (&present, sizeof (present), q);\n"
-    "  if (ret != 0)\n"
-    "    return ret;\n"
-    "  if (present)\n"
-    "  {\n"
-    );
+    "      if (f->i >= (size_t)(%s))\n"
+    "      {\n",
+    count);
+  nb_goto ("        ", after, fc);
+  fputs ("      }\n", fc);
+  nb_item (m, load, true, true, state, fc);
 }
 
 
-static bool write_load_struct (const type_t *type, FILE *fh, FILE *fc)
+// Allocation of pointed to items happens as soon as they are known to be
+// present, and they are hooked up right away, so that nothing is lost
+// while a load is suspended.
+static void nb_alloc (const char *target, const char *base_type, const char *count, FILE *fc)
 {
-  char *utype = make_cname (type->type_name);
-
-  fprintf (fh,
-    "int cser_raw_load_%s (%s *val, cser_raw_read_fn r, void *q);\n",
-    utype, type->type_name);
-
   fprintf (fc,
-    "int cser_raw_load_%s (%s *val, cser_raw_read_fn r, void *q)\n"
-    "{\n",
-    utype, type->type_name);
+    "      {\n"
+    "        %s *items = cser_alloc (s->alloc, %s, sizeof (%s));\n"
+    "        if (!items)\n"
+    "          return -ENOMEM;\n"
+    "        %s = items;\n"
+    "      }\n",
+    base_type, count, base_type,
+    target);
+}
 
-  free (utype);
-  utype = 0;
 
-  for (member_t *m = type->composite; m; m = m->next)
+static void nb_member (const member_t *m, bool load, unsigned k, FILE *fc)
+{
+  unsigned after = k + nb_states (m);
+  const char *name = m->member_name;
+  const char *type = m->base_type;
+  char *items;
+  if (asprintf (&items, "val->%s", name) < 0)
+    abort ();
+
+  fprintf (fc, "      case %u: /* %s */\n", k, name);
+  if (options->counted && m->opts.cardinality == CDN_ZEROTERM_ARRAY)
   {
-    fputs (" {\n", fc);
-    switch (m->opts.cardinality)
+    nb_presence (m, load, false, after, fc);
+    if (!load && is_char_native (type))
+      fprintf (fc, "      f->n = strlen ((const char *)val->%s);\n", name);
+    else if (!load)
+      fprintf (fc,
+        "      f->n = 0;\n"
+        "      while (val->%s[f->n])\n"
+        "        ++f->n;\n",
+        name);
+    nb_goto ("      ", k + 1, fc);
+    fprintf (fc, "      case %u:\n", k + 1);
+    if (load)
+      fprintf (fc,
+        "      {\n"
+        "        uint64_t n = 0;\n"
+        "        int ret = cser_raw_nget_varint (s, &n);\n"
+        "        if (ret != 0)\n"
+        "          return ret;\n"
+        "        if (n >= SIZE_MAX / sizeof (%s))\n"
+        "          return -EOVERFLOW;\n"
+        "        %s *items = cser_alloc (s->alloc, (size_t)n + 1, sizeof (%s));\n"
+        "        if (!items)\n"
+        "          return -ENOMEM;\n"
+        "        val->%s = items;\n"
+        "        f->n = (size_t)n;\n"
+        "      }\n",
+        type,
+        type, type,
+        name);
+    else
+      fputs (
+        "      {\n"
+        "        int ret = cser_raw_nput_varint (s, f->n);\n"
+        "        if (ret != 0)\n"
+        "          return ret;\n"
+        "      }\n", fc);
+    nb_goto ("      ", k + 2, fc);
+    fprintf (fc, "      case %u:\n", k + 2);
+    nb_items (m, load, items, "f->n", k + 2, after, fc);
+  }
+  else switch (m->opts.cardinality)
+  {
+    case CDN_VAR_ARRAY:
     {
-      case CDN_VAR_ARRAY:
-        write_presence_check (fc);
-        fprintf (fc,
-          "    %s *items = calloc (val->%s, sizeof (%s));\n"
-          "    if (!items)\n"
-          "      return -ENOMEM;\n",
-          m->base_type, m->opts.variable_array_size_member, m->base_type
-          );
-        fprintf (fc,
-          "    for (unsigned i = 0; i < val->%s; ++i)\n"
-          "    {\n",
-          m->opts.variable_array_size_member
-          );
-        write_load_item ("items[i]", m->base_type, "      ", false, fc);
+      char *count;
+      if (asprintf (&count, "val->%s", m->opts.variable_array_size_member) < 0)
+        abort ();
+      nb_presence (m, load, false, after, fc);
+      if (load)
+        nb_alloc (items, type, count, fc);
+      nb_goto ("      ", k + 1, fc);
+      fprintf (fc, "      case %u:\n", k + 1);
+      nb_items (m, load, items, count, k + 1, after, fc);
+      free (count);
+      break;
+    }
+    case CDN_ZEROTERM_ARRAY:
+      // Loads grow the array as they go, as in write_load_struct
+      nb_presence (m, load, false, after, fc);
+      if (load)
         fprintf (fc,
-          "      if (ret != 0)\n"
-          "        return ret;\n"
-          "      val->%s = items;\n"
-          "    }\n"
-          "  }\n",
-          m->member_name
-          );
-        break;
-      case CDN_ZEROTERM_ARRAY:
-        // This looks nothing like a normal array load, as it needs to
-        // incrementally load until it finds the end marker. A bog standard
-        // 2*n alloc/copy/retry approach is used for now.
-
-        write_presence_check (fc);
+          "      val->%s = 0;\n"
+          "      f->n = 0;\n",
+          name);
+      nb_goto ("      ", k + 1, fc);
+      fprintf (fc,
+        "      case %u:\n"
+        "      if (f->i > 0 && !val->%s[f->i - 1])\n"
+        "      {\n",
+        k + 1, name);
+      nb_goto ("        ", after, fc);
+      fputs ("      }\n", fc);
+      if (load)
         fprintf (fc,
-          "    %s *tmp = 0;\n"
-          "    size_t n = 0;\n"
-          "    size_t offs = 0;\n"
-          "    do {\n"
-          "      if (offs >= n)\n"
+          "      if (f->i == f->n)\n"
           "      {\n"
-          "        if (n == 0)\n"
-          "          n = 2 * sizeof(%s);\n"
-          "        tmp = (%s *)realloc (tmp, n *= 2);\n"
-          "        if (!tmp)\n"
+          "        size_t n = f->n ? 2 * f->n : 16;\n"
+          "        %s *grown = cser_realloc (s->alloc, (void *)val->%s, f->n, n, sizeof (%s));\n"
+          "        if (!grown)\n"
           "          return -ENOMEM;\n"
-          "        memset ((char *)tmp + n/2, n/2, 0);\n"
-          "      }\n"
-          , m->base_type
-          , m->base_type
-          , m->base_type
-          );
-        write_load_item (
-          "tmp[offs++]", m->base_type, "      ", false, fc);
-        fprintf (fc,
-          "      if (ret != 0)\n"
-          "      {\n"
-          "        free (tmp);\n"
-          "        return ret;\n"
-          "      }\n"
-          "    } while (tmp[offs - 1]);\n"
-          "    val->%s = tmp;\n"
-          "  }\n",
-          m->member_name
-          );
-        break;
-      case CDN_SINGLE:
+          "        memset (grown + f->n, 0, (n - f->n) * sizeof (%s));\n"
+          "        val->%s = grown;\n"
+          "        f->n = n;\n"
+          "      }\n",
+          type, name, type,
+          type,
+          name);
+      nb_item (m, load, true, true, k + 1, fc);
+      break;
+    case CDN_SINGLE:
+      if (m->opts.is_ptr)
       {
-        if (m->opts.is_ptr)
-          write_presence_check (fc);
-        char *target;
-        if (asprintf (&target, "val->%s", m->member_name) < 0)
-          return false;
-        write_load_item (target, m->base_type, "      ", m->opts.is_ptr, fc);
-        free (target);
-        fprintf (fc,
-          "    if (ret != 0)\n"
-          "      return ret;\n"
-          );
-        if (m->opts.is_ptr)
-          fputs ("  }\n", fc); // close presence check scope
-        break;
+        nb_presence (m, load, false, after, fc);
+        if (load)
+          nb_alloc (items, type, "1", fc);
+        nb_goto ("      ", k + 1, fc);
+        fprintf (fc, "      case %u:\n", k + 1);
+        nb_item (m, load, false, false, after, fc);
       }
-      default:
+      else
+        nb_item (m, load, true, false, after, fc);
+      break;
+    default:
+      if (m->opts.is_ptr)
       {
         fprintf (fc,
-          "  for (unsigned i = 0; i < (%s); ++i)\n"
-          "  {\n",
-          m->opts.arr_sz
-          );
-        if (m->opts.is_ptr)
-          write_presence_check (fc);
-        char *target;
-        if (asprintf (&target, "%sval->%s[i]",
-                      /*m->opts.is_ptr ? "" : "&"*/"", m->member_name) < 0)
-          return false;
-        write_load_item (target, m->base_type, "    ", m->opts.is_ptr, fc);
-        free (target);
+          "      if (f->i >= (size_t)(%s))\n"
+          "      {\n",
+          m->opts.arr_sz);
+        nb_goto ("        ", after, fc);
+        fputs ("      }\n", fc);
+        nb_presence (m, load, true, after, fc);
+        if (load)
+        {
+          char *target;
+          if (asprintf (&target, "val->%s[f->i]", name) < 0)
+            abort ();
+          nb_alloc (target, type, "1", fc);
+          free (target);
+        }
         fprintf (fc,
-          "    if (ret != 0)\n"
-          "      return ret;\n"
-          );
-        if (m->opts.is_ptr)
-          fputs ("  }\n", fc); // close presence check scope
-        fputs ("  }\n", fc); // close loop scope
-        break;
+          "      f->member = %u;\n"
+          "      break;\n"
+          "      case %u:\n",
+          k + 1, k + 1);
+        nb_item (m, load, false, true, k, fc);
       }
-    }
+      else
+      {
+        char *count;
+        if (asprintf (&count, "(%s)", m->opts.arr_sz) < 0)
+          abort ();
+        nb_items (m, load, items, count, k, after, fc);
+        free (count);
+      }
+      break;
+  }
+  free (items);
+}
 
-    fputs (" }\n", fc);
+
+// Lists continue in the same frame, as the blocking versions loop
+static void nb_link (const type_t *type, const member_t *link, bool load, unsigned k, FILE *fc)
+{
+  fprintf (fc, "      case %u: /* %s */\n", k, link->member_name);
+  if (load)
+    fprintf (fc,
+      "      {\n"
+      "        uint8_t present;\n"
+      "        int ret = cser_raw_nget (s, &present, 1);\n"
+      "        if (ret != 0)\n"
+      "          return ret;\n"
+      "        if (!present)\n"
+      "        {\n"
+      "          val->%s = 0;\n"
+      "          return 0;\n"
+      "        }\n"
+      "        %s *item = cser_alloc (s->alloc, 1, sizeof (%s));\n"
+      "        if (!item)\n"
+      "          return -ENOMEM;\n"
+      "        val->%s = item;\n"
+      "        f->val = item;\n"
+      "      }\n",
+      link->member_name,
+      type->type_name, type->type_name,
+      link->member_name);
+  else
+    fprintf (fc,
+      "      {\n"
+      "        uint8_t present = (val->%s != 0);\n"
+      "        int ret = cser_raw_nput (s, &present, 1, 0);\n"
+      "        if (ret != 0)\n"
+      "          return ret;\n"
+      "        if (!present)\n"
+      "          return 0;\n"
+      "      }\n"
+      "      f->val = (void *)val->%s;\n",
+      link->member_name,
+      link->member_name);
+  nb_goto ("      ", 0, fc);
+}
+
+
+static bool write_resumable_step (const type_t *type, bool load, FILE *fc)
+{
+  char *utype = make_cname (type->type_name);
+  fprintf (fc,
+    "static int cser_raw_n%s_step_%s (cser_raw_nb_t *s, cser_raw_nb_frame_t *f)\n"
+    "{\n",
+    load ? "load" : "store", utype);
+  if (is_pod (type))
+    fprintf (fc,
+      "  if (CSER_RAW_POD_%s)\n"
+      "    return cser_raw_n%s (s, (%suint8_t *)f->val, sizeof (%s)%s);\n",
+      utype,
+      load ? "get" : "put", load ? "" : "const ", type->type_name,
+      load ? "" : ", 0");
+  fprintf (fc,
+    "  for (;;)\n"
+    "  {\n"
+    "    %s%s *val = f->val;\n",
+    load ? "" : "const ", type->type_name);
+  if (!type->composite)
+    fputs ("    (void)s; (void)val;\n", fc);
+  fputs ("    switch (f->member)\n    {\n", fc);
+
+  const member_t *link = list_link (type);
+  unsigned k = 0;
+  for (const member_t *m = type->composite; m && m != link; m = m->next)
+  {
+    nb_member (m, load, k, fc);
+    k += nb_states (m);
   }
+  if (link)
+    nb_link (type, link, load, k, fc);
+  fputs (
+    "      default:\n"
+    "        return 0;\n"
+    "    }\n"
+    "  }\n"
+    "}\n", fc);
 
-  fputs ("  return 0;\n}\n", fc);
+  free (utype);
+  return !ferror (fc);
+}
 
+
+static bool write_resumable (const type_t *type, FILE *fh, FILE *fc)
+{
+  for (const member_t *m = type->composite; m; m = m->next)
+  {
+    if (m->opts.shared)
+    {
+      fprintf (stderr, "error: resumable functions do not support shared member '%s' of '%s'\n",
+        m->member_name, type->type_name);
+      return false;
+    }
+  }
+
+  if (!write_resumable_step (type, false, fc) ||
+      !write_resumable_step (type, true, fc))
+    return false;
+
+  char *utype = make_cname (type->type_name);
+  fprintf (fh,
+    "int cser_raw_nb_store_%s (cser_raw_nb_t *s, const %s *val, cser_raw_nb_write_fn w, void *q);\n"
+    "int cser_raw_nb_load_%s (cser_raw_nb_t *s, %s *val, cser_raw_nb_read_fn r, void *q);\n"
+    "int cser_raw_nb_load_alloc_%s (cser_raw_nb_t *s, %s *val, cser_raw_nb_read_fn r, void *q, const cser_alloc_t *alloc);\n",
+    utype, type->type_name,
+    utype, type->type_name,
+    utype, type->type_name);
+  // The header frame needs the fingerprint to outlive the call
+  const char *fp_arg = options->prefixed ? ", &cser_raw_nb_fingerprint_" : "";
+  if (options->prefixed)
+    fprintf (fc,
+      "static const uint64_t cser_raw_nb_fingerprint_%s = CSER_RAW_FINGERPRINT_%s;\n",
+      utype, utype);
+  fprintf (fc,
+    "int cser_raw_nb_store_%s (cser_raw_nb_t *s, const %s *val, cser_raw_nb_write_fn w, void *q)\n"
+    "{\n"
+    "  return cser_raw_nb_start (s, cser_raw_nstore_step_header, cser_raw_nstore_step_%s, val, w, 0, q, 0%s%s);\n"
+    "}\n"
+    "int cser_raw_nb_load_alloc_%s (cser_raw_nb_t *s, %s *val, cser_raw_nb_read_fn r, void *q, const cser_alloc_t *alloc)\n"
+    "{\n"
+    "  return cser_raw_nb_start (s, cser_raw_nload_step_header, cser_raw_nload_step_%s, val, 0, r, q, alloc%s%s);\n"
+    "}\n"
+    "int cser_raw_nb_load_%s (cser_raw_nb_t *s, %s *val, cser_raw_nb_read_fn r, void *q)\n"
+    "{\n"
+    "  return cser_raw_nb_load_alloc_%s (s, val, r, q, 0);\n"
+    "}\n",
+    utype, type->type_name,
+    utype, fp_arg, options->prefixed ? utype : "",
+    utype, type->type_name,
+    utype, fp_arg, options->prefixed ? utype : "",
+    utype, type->type_name,
+    utype);
+  free (utype);
   return !ferror (fh) && !ferror (fc);
 }
 
 
-bool backend_raw (const type_list_t *types, const alias_list_t *aliases, FILE *fh, FILE *fc)
+// The LZ compression stage, for -Z. Output is cut into blocks which are
+// compressed independently using LZ4 style sequences, and blocks which do
+// not shrink are passed through as they are.
+static void write_compress_support (FILE *fh, FILE *fc)
+{
+  fputs (
+"/* LZ compression stage, sitting between a store or load and the actual */\n"
+"/* callbacks: cser_raw_lz_write/cser_raw_lz_read are passed to those in  */\n"
+"/* place of the callbacks, with the cser_raw_lz_t as opaque pointer. A   */\n"
+"/* block is a multiple of the store buffer size, so that flushes fill it */\n"
+"/* exactly, and both sides must agree on it. The context is large, and  */\n"
+"/* best not placed on the stack.                                         */\n"
+"#ifndef CSER_RAW_LZ_BLOCK\n"
+"# define CSER_RAW_LZ_BLOCK (16 * CSER_RAW_BUFSZ)\n"
+"#endif\n"
+"#define CSER_RAW_LZ_HASH_BITS 12\n"
+"#define CSER_RAW_LZ_BOUND(n) ((n) + (n) / 255 + 16)\n"
+"typedef struct cser_raw_lz\n"
+"{\n"
+"  cser_raw_write_fn w;\n"
+"  cser_raw_read_fn r;\n"
+"  void *q;\n"
+"  size_t len; /* bytes held in raw */\n"
+"  size_t pos; /* loading: bytes of raw handed out so far */\n"
+"  uint32_t table[1 << CSER_RAW_LZ_HASH_BITS];\n"
+"  uint8_t raw[CSER_RAW_LZ_BLOCK];\n"
+"  uint8_t packed[8 + CSER_RAW_LZ_BOUND (CSER_RAW_LZ_BLOCK)];\n"
+"} cser_raw_lz_t;\n"
+"\n"
+"void cser_raw_lz_writer (cser_raw_lz_t *z, cser_raw_write_fn w, void *q);\n"
+"void cser_raw_lz_reader (cser_raw_lz_t *z, cser_raw_read_fn r, void *q);\n"
+"int cser_raw_lz_write (const uint8_t *bytes, size_t n, void *z);\n"
+"int cser_raw_lz_read (uint8_t *bytes, size_t n, void *z);\n"
+"/* Writes out what is left after a store, and the end of the stream */\n"
+"int cser_raw_lz_finish (cser_raw_lz_t *z);\n"
+"\n", fh);
+
+  fputs (
+"static inline uint32_t cser_raw_lz_load32 (const uint8_t *p)\n"
+"{\n"
+"  uint32_t v;\n"
+"  memcpy (&v, p, 4);\n"
+"  return v;\n"
+"}\n"
+"\n"
+"static inline uint8_t *cser_raw_lz_length (uint8_t *op, size_t n)\n"
+"{\n"
+"  for (; n >= 255; n -= 255)\n"
+"    *op++ = 255;\n"
+"  *op++ = (uint8_t)n;\n"
+"  return op;\n"
+"}\n"
+"\n"
+"static inline uint8_t *cser_raw_lz_literals (uint8_t *op, const uint8_t *lit, size_t n, unsigned match)\n"
+"{\n"
+"  *op++ = (uint8_t)((n < 15 ? n : 15) << 4 | match);\n"
+"  if (n >= 15)\n"
+"    op = cser_raw_lz_length (op, n - 15);\n"
+"  memcpy (op, lit, n);\n"
+"  return op + n;\n"
+"}\n"
+"\n"
+"/* Each sequence is a token holding the literal and match lengths (with */\n"
+"/* extra length bytes following when 15 or more), the literals, and the */\n"
+"/* 16 bit offset of the match. The final sequence has literals only.    */\n"
+"static size_t cser_raw_lz_pack (uint32_t *table, const uint8_t *src, size_t n, uint8_t *dst)\n"
+"{\n"
+"  uint8_t *op = dst;\n"
+"  size_t ip = 0, anchor = 0;\n"
+"  memset (table, 0, sizeof (uint32_t) << CSER_RAW_LZ_HASH_BITS);\n"
+"  while (n > 12 && ip < n - 12)\n"
+"  {\n"
+"    uint32_t v = cser_raw_lz_load32 (src + ip);\n"
+"    uint32_t *slot = &table[(v * 2654435761u) >> (32 - CSER_RAW_LZ_HASH_BITS)];\n"
+"    size_t ref = *slot;\n"
+"    *slot = (uint32_t)ip;\n"
+"    if (ref >= ip || ip - ref > 65535 || cser_raw_lz_load32 (src + ref) != v)\n"
+"    {\n"
+"      ip += 1 + ((ip - anchor) >> 6); /* skip faster through data not matching */\n"
+"      continue;\n"
+"    }\n"
+"    size_t len = 4;\n"
+"    while (ip + len + 8 <= n - 5 && memcmp (src + ref + len, src + ip + len, 8) == 0)\n"
+"      len += 8;\n"
+"    while (ip + len < n - 5 && src[ref + len] == src[ip + len])\n"
+"      ++len;\n"
+"    while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1])\n"
+"    {\n"
+"      --ip;\n"
+"      --ref;\n"
+"      ++len;\n"
+"    }\n"
+"    op = cser_raw_lz_literals (op, src + anchor, ip - anchor, len - 4 < 15 ? (unsigned)(len - 4) : 15);\n"
+"    *op++ = (uint8_t)(ip - ref);\n"
+"    *op++ = (uint8_t)((ip - ref) >> 8);\n"
+"    if (len - 4 >= 15)\n"
+"      op = cser_raw_lz_length (op, len - 4 - 15);\n"
+"    ip += len;\n"
+"    anchor = ip;\n"
+"  }\n"
+"  op = cser_raw_lz_literals (op, src + anchor, n - anchor, 0);\n"
+"  return (size_t)(op - dst);\n"
+"}\n"
+"\n"
+"static inline int cser_raw_lz_extend (const uint8_t **ip, const uint8_t *iend, size_t *n)\n"
+"{\n"
+"  uint8_t c;\n"
+"  do\n"
+"  {\n"
+"    if (*ip == iend)\n"
+"      return -EBADMSG;\n"
+"    c = *(*ip)++;\n"
+"    *n += c;\n"
+"  } while (c == 255);\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"/* Checks everything, as the input may have been damaged */\n"
+"static int cser_raw_lz_unpack (const uint8_t *src, size_t n, uint8_t *dst, size_t len)\n"
+"{\n"
+"  const uint8_t *ip = src, *iend = src + n;\n"
+"  uint8_t *op = dst, *oend = dst + len;\n"
+"  for (;;)\n"
+"  {\n"
+"    if (ip == iend)\n"
+"      return -EBADMSG;\n"
+"    unsigned token = *ip++;\n"
+"    size_t lit = token >> 4;\n"
+"    if (lit == 15 && cser_raw_lz_extend (&ip, iend, &lit) != 0)\n"
+"      return -EBADMSG;\n"
+"    if ((size_t)(iend - ip) < lit || (size_t)(oend - op) < lit)\n"
+"      return -EBADMSG;\n"
+"    memcpy (op, ip, lit);\n"
+"    op += lit;\n"
+"    ip += lit;\n"
+"    if (ip == iend)\n"
+"      break;\n"
+"    if (iend - ip < 2)\n"
+"      return -EBADMSG;\n"
+"    size_t off = ip[0] | (size_t)ip[1] << 8;\n"
+"    ip += 2;\n"
+"    size_t mlen = token & 15;\n"
+"    if (mlen == 15 && cser_raw_lz_extend (&ip, iend, &mlen) != 0)\n"
+"      return -EBADMSG;\n"
+"    mlen += 4;\n"
+"    if (off == 0 || off > (size_t)(op - dst) || (size_t)(oend - op) < mlen)\n"
+"      return -EBADMSG;\n"
+"    const uint8_t *ref = op - off;\n"
+"    if (off >= mlen)\n"
+"      memcpy (op, ref, mlen);\n"
+"    else\n"
+"      for (size_t i = 0; i < mlen; ++i)\n"
+"        op[i] = ref[i];\n"
+"    op += mlen;\n"
+"  }\n"
+"  return op == oend ? 0 : -EBADMSG;\n"
+"}\n"
+"\n"
+"void cser_raw_lz_writer (cser_raw_lz_t *z, cser_raw_write_fn w, void *q)\n"
+"{\n"
+"  z->w = w;\n"
+"  z->r = 0;\n"
+"  z->q = q;\n"
+"  z->len = z->pos = 0;\n"
+"}\n"
+"\n"
+"void cser_raw_lz_reader (cser_raw_lz_t *z, cser_raw_read_fn r, void *q)\n"
+"{\n"
+"  z->w = 0;\n"
+"  z->r = r;\n"
+"  z->q = q;\n"
+"  z->len = z->pos = 0;\n"
+"}\n"
+"\n"
+"/* A block goes out as its length and packed length (equal if it was */\n"
+"/* not worth packing), followed by the packed or plain bytes.         */\n"
+"static int cser_raw_lz_block (cser_raw_lz_t *z, const uint8_t *src, size_t n)\n"
+"{\n"
+"  size_t packed = cser_raw_lz_pack (z->table, src, n, z->packed + 8);\n"
+"  cser_raw_put32 (z->packed, (uint32_t)n);\n"
+"  if (packed < n)\n"
+"  {\n"
+"    cser_raw_put32 (z->packed + 4, (uint32_t)packed);\n"
+"    return z->w (z->packed, packed + 8, z->q);\n"
+"  }\n"
+"  cser_raw_put32 (z->packed + 4, (uint32_t)n);\n"
+"  int ret = z->w (z->packed, 8, z->q);\n"
+"  return ret != 0 ? ret : z->w (src, n, z->q);\n"
+"}\n"
+"\n"
+"int cser_raw_lz_write (const uint8_t *bytes, size_t n, void *q)\n"
+"{\n"
+"  cser_raw_lz_t *z = q;\n"
+"  while (n)\n"
+"  {\n"
+"    if (z->len == 0 && n >= sizeof (z->raw))\n"
+"    {\n"
+"      /* whole blocks are packed straight from the caller's bytes */\n"
+"      int ret = cser_raw_lz_block (z, bytes, sizeof (z->raw));\n"
+"      if (ret != 0)\n"
+"        return ret;\n"
+"      bytes += sizeof (z->raw);\n"
+"      n -= sizeof (z->raw);\n"
+"      continue;\n"
+"    }\n"
+"    size_t k = sizeof (z->raw) - z->len;\n"
+"    if (k > n)\n"
+"      k = n;\n"
+"    memcpy (z->raw + z->len, bytes, k);\n"
+"    z->len += k;\n"
+"    bytes += k;\n"
+"    n -= k;\n"
+"    if (z->len == sizeof (z->raw))\n"
+"    {\n"
+"      int ret = cser_raw_lz_block (z, z->raw, z->len);\n"
+"      if (ret != 0)\n"
+"        return ret;\n"
+"      z->len = 0;\n"
+"    }\n"
+"  }\n"
+"  return 0;\n"
+"}\n"
+"\n"
+"int cser_raw_lz_finish (cser_raw_lz_t *z)\n"
+"{\n"
+"  if (z->len)\n"
+"  {\n"
+"    int ret = cser_raw_lz_block (z, z->raw, z->len);\n"
+"    if (ret != 0)\n"
+"      return ret;\n"
+"    z->len = 0;\n"
+"  }\n"
+"  static const uint8_t end[8] = { 0 };\n"
+"  return z->w (end, sizeof (end), z->q);\n"
+"}\n"
+"\n"
+"static int cser_raw_lz_next (cser_raw_lz_t *z)\n"
+"{\n"
+"  uint8_t head[8];\n"
+"  int ret = z->r (head, sizeof (head), z->q);\n"
+"  if (ret != 0)\n"
+"    return ret;\n"
+"  size_t n = cser_raw_get32 (head);\n"
+"  size_t packed = cser_raw_get32 (head + 4);\n"
+"  if (n == 0)\n"
+"    return -ENODATA;\n"
+"  if (n > sizeof (z->raw))\n"
+"    return -EMSGSIZE;\n"
+"  if (packed > n)\n"
+"    return -EBADMSG;\n"
+"  z->len = z->pos = 0;\n"
+"  if (packed == n)\n"
+"    ret = z->r (z->raw, n, z->q);\n"
+"  else\n"
+"  {\n"
+"    ret = z->r (z->packed, packed, z->q);\n"
+"    if (ret == 0)\n"
+"      ret = cser_raw_lz_unpack (z->packed, packed, z->raw, n);\n"
+"  }\n"
+"  if (ret == 0)\n"
+"    z->len = n;\n"
+"  return ret;\n"
+"}\n"
+"\n"
+"int cser_raw_lz_read (uint8_t *bytes, size_t n, void *q)\n"
+"{\n"
+"  cser_raw_lz_t *z = q;\n"
+"  while (n)\n"
+"  {\n"
+"    if (z->pos == z->len)\n"
+"    {\n"
+"      int ret = cser_raw_lz_next (z);\n"
+"      if (ret != 0)\n"
+"        return ret;\n"
+"    }\n"
+"    size_t k = z->len - z->pos;\n"
+"    if (k > n)\n"
+"      k = n;\n"
+"    memcpy (bytes, z->raw + z->pos, k);\n"
+"    z->pos += k;\n"
+"    bytes += k;\n"
+"    n -= k;\n"
+"  }\n"
+"  return 0;\n"
+"}\n"
+"\n", fc);
+}
+
+
+// With -H, equivalent native spellings share the codecs of the canonical
+// one, which the first of them in the list emits, and the others forward
+// to. Natives then get no entry points, which structs never call anyway.
+static bool write_native_spelling (const type_list_t *types, const type_list_t *t, FILE *fh, FILE *fc)
+{
+  const type_t *canonical = lookup_type (native_canonical (t->def.type_name));
+  if (is_first_spelling (types, t) &&
+      ((is_integer_native (canonical->type_name) &&
+        !write_varint_native (canonical, fc)) ||
+       !write_store_native (canonical, fh, fc) ||
+       !write_load_native (canonical, fh, fc) ||
+       !write_size_native (canonical, fc) ||
+       (options->resumable && !write_resumable_native (canonical, fc))))
+    return false;
+  if (strcmp (canonical->type_name, t->def.type_name) == 0)
+    return true;
+
+  char *utype = make_cname (t->def.type_name);
+  char *ucanon = make_cname (canonical->type_name);
+  const char *type_name = t->def.type_name;
+  if (is_integer_native (type_name))
+    fprintf (fc,
+      "static inline int cser_raw_bstore_varint_%s (const %s *val, cser_raw_buf_t *b)\n"
+      "{ return cser_raw_bstore_varint_%s (val, b); }\n"
+      "static inline size_t cser_raw_bsize_varint_%s (const %s *val)\n"
+      "{ return cser_raw_bsize_varint_%s (val); }\n"
+      "static inline int cser_raw_bload_varint_%s (%s *val, cser_raw_buf_t *b)\n"
+      "{ return cser_raw_bload_varint_%s (val, b); }\n",
+      utype, type_name, ucanon,
+      utype, type_name, ucanon,
+      utype, type_name, ucanon);
+  fprintf (fc,
+    "static inline int cser_raw_bstore_%s (const %s *val, cser_raw_buf_t *b)\n"
+    "{ return cser_raw_bstore_%s (val, b); }\n"
+    "static inline int cser_raw_bload_%s (%s *val, cser_raw_buf_t *b)\n"
+    "{ return cser_raw_bload_%s (val, b); }\n"
+    "static inline size_t cser_raw_bsize_%s (const %s *val)\n"
+    "{ return cser_raw_bsize_%s (val); }\n",
+    utype, type_name, ucanon,
+    utype, type_name, ucanon,
+    utype, type_name, ucanon);
+  if (options->resumable && is_integer_native (type_name))
+    fprintf (fc,
+      "static inline int cser_raw_nstore_varint_%s (cser_raw_nb_t *s, const %s *val)\n"
+      "{ return cser_raw_nstore_varint_%s (s, val); }\n"
+      "static inline int cser_raw_nload_varint_%s (cser_raw_nb_t *s, %s *val)\n"
+      "{ return cser_raw_nload_varint_%s (s, val); }\n",
+      utype, type_name, ucanon,
+      utype, type_name, ucanon);
+  if (options->resumable)
+    fprintf (fc,
+      "static inline int cser_raw_nstore_%s (cser_raw_nb_t *s, const %s *val)\n"
+      "{ return cser_raw_nstore_%s (s, val); }\n"
+      "static inline int cser_raw_nload_%s (cser_raw_nb_t *s, %s *val)\n"
+      "{ return cser_raw_nload_%s (s, val); }\n",
+      utype, type_name, ucanon,
+      utype, type_name, ucanon);
+  free (ucanon);
+  free (utype);
+  return !ferror (fc);
+}
+
+
+bool backend_raw (const type_list_t *types, const alias_list_t *aliases, const options_t *opts, FILE *fh, FILE *fc)
 {
+  options = opts;
+  all_types = types;
+
   // Callback definitions
   fputs ("#include <stdint.h>\n", fh);
   fputs ("#include <stdlib.h>\n", fh);
+  fputs ("#include <string.h>\n", fh);
   fputs ("#include <sys/types.h>\n", fh);
+  fputs ("#include <sys/uio.h>\n", fh);
   fputs ("#include <errno.h>\n\n", fh);
   fputs ("/* The callback functions take a buffer, a length, and an opaque */\n"
          "/* pointer which is passed through. They MUST return zero (0) on */\n"
@@ -369,20 +5946,115 @@ bool backend_raw (const type_list_t *types, const alias_list_t *aliases, FILE *f
          "/* read(2)/write(2).                                             */\n"
          , fh);
   fputs ("typedef int (*cser_raw_write_fn) (const uint8_t *bytes, size_t n, void *q);\n", fh);
-  fputs ("typedef int (*cser_raw_read_fn) (uint8_t *bytes, size_t n, void *q);\n\n", fh);
+  fputs ("typedef int (*cser_raw_read_fn) (uint8_t *bytes, size_t n, void *q);\n", fh);
+  fputs ("/* As the write function, but taking a list of buffers as for writev(2) */\n", fh);
+  fputs ("typedef int (*cser_raw_writev_fn) (const struct iovec *iov, int iovcnt, void *q);\n", fh);
+  fputs ("/* As the read function, but short reads are fine, as for read(2): the */\n"
+         "/* number of bytes read, zero at the end of the input, or a negative  */\n"
+         "/* error code. This lets loads read ahead into a buffer.              */\n", fh);
+  fputs ("typedef ssize_t (*cser_raw_readsome_fn) (uint8_t *bytes, size_t n, void *q);\n\n", fh);
 
-  for (; types; types = types->next)
+  write_buffer_support (fh, fc);
+  if (options->instrument)
+    write_stats_support (fc);
+  write_ref_support (types, fc);
+  write_skip_support (types, fc);
+  write_tag_support (types, fc);
+  write_index_support (types, fh, fc);
+  write_par_support (types, fc);
+  if (options->masked)
+    write_fields_support (fh);
+  if (options->compress)
+    write_compress_support (fh, fc);
+  if (options->resumable)
+    write_resumable_support (types, fh, fc);
+
+  // Native codecs are static inline, so they need to precede their users
+  for (const type_list_t *t = types; t; t = t->next)
   {
-    if (types->def.csfn == TYPE_NATIVE)
+    if (t->def.csfn == TYPE_NATIVE && options->inline_natives)
     {
-      if (!write_store_native (&types->def, fh, fc) ||
-          !write_load_native (&types->def, fh, fc))
+      if (!write_native_spelling (types, t, fh, fc))
         return false;
     }
-    else
+    else if (t->def.csfn == TYPE_NATIVE)
+    {
+      if ((is_integer_native (t->def.type_name) &&
+           !write_varint_native (&t->def, fc)) ||
+          !write_store_native (&t->def, fh, fc) ||
+          !write_load_native (&t->def, fh, fc) ||
+          !write_size_native (&t->def, fc) ||
+          !write_wrappers (&t->def, fh, fc) ||
+          (options->resumable && !write_resumable_native (&t->def, fc)))
+        return false;
+    }
+  }
+
+  for (const type_list_t *t = types; t; t = t->next)
+    write_bounded_size (&t->def, fh);
+
+  fputs ("#include <stddef.h>\n", fc);
+  for (const type_list_t *t = types; t; t = t->next)
+    if (is_pod (&t->def))
+      write_pod_support (&t->def, fc);
+  for (const type_list_t *t = types; t; t = t->next)
+    if (is_par_element (&t->def))
+      write_par_items (&t->def, fc);
+
+  const bool skips = writes_skip ();
+  for (const type_list_t *t = types; t && skips; t = t->next)
+  {
+    if (needs_skip (&t->def))
+    {
+      char *utype = make_cname (t->def.type_name);
+      fprintf (fc, "static inline int cser_raw_bskip_%s (cser_raw_buf_t *b);\n", utype);
+      free (utype);
+    }
+  }
+
+  // Releasing a value may release values of the member types
+  for (const type_list_t *t = types; t && options->delta; t = t->next)
+  {
+    if (t->def.csfn == TYPE_COMPOSITE && !reaches_shared (&t->def))
+    {
+      char *utype = make_cname (t->def.type_name);
+      fprintf (fc, "static inline void cser_raw_release_%s (%s *val, const cser_alloc_t *alloc);\n",
+        utype, t->def.type_name);
+      free (utype);
+    }
+  }
+
+  // Step functions refer to those of the member types
+  for (const type_list_t *t = types; t && options->resumable; t = t->next)
+  {
+    if (t->def.csfn == TYPE_COMPOSITE && !reaches_unresumable (&t->def))
+    {
+      char *utype = make_cname (t->def.type_name);
+      fprintf (fc,
+        "static int cser_raw_nstore_step_%s (cser_raw_nb_t *s, cser_raw_nb_frame_t *f);\n"
+        "static int cser_raw_nload_step_%s (cser_raw_nb_t *s, cser_raw_nb_frame_t *f);\n",
+        utype, utype);
+      free (utype);
+    }
+  }
+
+  for (; types; types = types->next)
+  {
+    if (types->def.csfn != TYPE_NATIVE)
     {
       if (!write_store_struct (&types->def, fh, fc) ||
-          !write_load_struct (&types->def, fh, fc))
+          !write_load_struct (&types->def, false, fh, fc) ||
+          !write_size_struct (&types->def, fh, fc) ||
+          !write_wrappers (&types->def, fh, fc) ||
+          !write_bounded (&types->def, fh, fc) ||
+          (skips && !write_skip_struct (&types->def, fc)) ||
+          !write_index_at (&types->def, fh, fc) ||
+          (options->masked && !write_fields (&types->def, fh, fc)) ||
+          (options->delta && !reaches_shared (&types->def) &&
+           !write_delta (&types->def, fh, fc)) ||
+          (options->resumable && !reaches_unresumable (&types->def) &&
+           !write_resumable (&types->def, fh, fc)) ||
+          (options->framed && !write_framed (&types->def, fh, fc)))
         return false;
     }
   }
@@ -394,11 +6066,101 @@ bool backend_raw (const type_list_t *types, const alias_list_t *aliases, FILE *f
 
     fprintf (fh,
      "static inline int cser_raw_store_%s (const %s *val, cser_raw_write_fn w, void *q)\n"
-     "{ return cser_raw_store_%s (val, w, q); }\n",
+     "{ return cser_raw_store_%s (val, w, q); }\n"
+     "static inline int cser_raw_storev_%s (const %s *val, cser_raw_writev_fn wv, void *q)\n"
+     "{ return cser_raw_storev_%s (val, wv, q); }\n"
+     "static inline int cser_raw_load_%s (%s *val, cser_raw_read_fn r, void *q)\n"
+     "{ return cser_raw_load_%s (val, r, q); }\n"
+     "static inline int cser_raw_load_alloc_%s (%s *val, cser_raw_read_fn r, void *q, const cser_alloc_t *alloc)\n"
+     "{ return cser_raw_load_alloc_%s (val, r, q, alloc); }\n"
+     "static inline int cser_raw_load_buffered_%s (%s *val, cser_raw_readsome_fn rs, void *q, const cser_alloc_t *alloc)\n"
+     "{ return cser_raw_load_buffered_%s (val, rs, q, alloc); }\n"
+     "static inline size_t cser_raw_size_%s (const %s *val)\n"
+     "{ return cser_raw_size_%s (val); }\n",
+      ualias, aliases->alias_name,
+      uactual,
+      ualias, aliases->alias_name,
+      uactual,
+      ualias, aliases->alias_name,
+      uactual,
+      ualias, aliases->alias_name,
+      uactual,
+      ualias, aliases->alias_name,
+      uactual,
       ualias, aliases->alias_name,
       uactual
     );
 
+    const type_t *actual = lookup_type (aliases->actual_name);
+    if (actual && actual->csfn == TYPE_COMPOSITE)
+      fprintf (fh,
+       "#define CSER_RAW_FINGERPRINT_%s CSER_RAW_FINGERPRINT_%s\n"
+       "static inline int cser_raw_bstore_%s (const %s *val, cser_raw_buf_t *b)\n"
+       "{ return cser_raw_bstore_%s (val, b); }\n"
+       "static inline int cser_raw_bload_%s (%s *val, cser_raw_buf_t *b)\n"
+       "{ return cser_raw_bload_%s (val, b); }\n"
+       "static inline size_t cser_raw_bsize_%s (const %s *val)\n"
+       "{ return cser_raw_bsize_%s (val); }\n",
+        ualias, uactual,
+        ualias, aliases->alias_name,
+        uactual,
+        ualias, aliases->alias_name,
+        uactual,
+        ualias, aliases->alias_name,
+        uactual
+      );
+
+    if (actual && actual->csfn == TYPE_COMPOSITE && options->resumable &&
+        !reaches_unresumable (actual))
+      fprintf (fh,
+       "static inline int cser_raw_nb_store_%s (cser_raw_nb_t *s, const %s *val, cser_raw_nb_write_fn w, void *q)\n"
+       "{ return cser_raw_nb_store_%s (s, val, w, q); }\n"
+       "static inline int cser_raw_nb_load_%s (cser_raw_nb_t *s, %s *val, cser_raw_nb_read_fn r, void *q)\n"
+       "{ return cser_raw_nb_load_%s (s, val, r, q); }\n"
+       "static inline int cser_raw_nb_load_alloc_%s (cser_raw_nb_t *s, %s *val, cser_raw_nb_read_fn r, void *q, const cser_alloc_t *alloc)\n"
+       "{ return cser_raw_nb_load_alloc_%s (s, val, r, q, alloc); }\n",
+        ualias, aliases->alias_name,
+        uactual,
+        ualias, aliases->alias_name,
+        uactual,
+        ualias, aliases->alias_name,
+        uactual
+      );
+
+    if (actual && actual->csfn == TYPE_COMPOSITE && options->framed)
+      fprintf (fh,
+       "static inline int cser_raw_store_framed_%s (const %s *val, cser_raw_write_fn w, void *q)\n"
+       "{ return cser_raw_store_framed_%s (val, w, q); }\n"
+       "static inline int cser_raw_load_framed_%s (%s *val, cser_raw_read_fn r, void *q)\n"
+       "{ return cser_raw_load_framed_%s (val, r, q); }\n"
+       "static inline int cser_raw_load_alloc_framed_%s (%s *val, cser_raw_read_fn r, void *q, const cser_alloc_t *alloc)\n"
+       "{ return cser_raw_load_alloc_framed_%s (val, r, q, alloc); }\n",
+        ualias, aliases->alias_name,
+        uactual,
+        ualias, aliases->alias_name,
+        uactual,
+        ualias, aliases->alias_name,
+        uactual
+      );
+
+    char *bounded = max_size_expr (actual);
+    if (bounded)
+      fprintf (fh,
+       "#define CSER_RAW_MAX_BSIZE_%s CSER_RAW_MAX_BSIZE_%s\n"
+       "#define CSER_RAW_MAX_SIZE_%s CSER_RAW_MAX_SIZE_%s\n"
+       "static inline size_t cser_raw_store_bounded_%s (const %s *val, uint8_t buf[CSER_RAW_MAX_SIZE_%s])\n"
+       "{ return cser_raw_store_bounded_%s (val, buf); }\n"
+       "static inline int cser_raw_load_bounded_%s (%s *val, const uint8_t *buf, size_t len)\n"
+       "{ return cser_raw_load_bounded_%s (val, buf, len); }\n",
+        ualias, uactual,
+        ualias, uactual,
+        ualias, aliases->alias_name, ualias,
+        uactual,
+        ualias, aliases->alias_name,
+        uactual
+      );
+    free (bounded);
+
     free (ualias);
     free (uactual);
   }
@@ -5,6 +5,11 @@
 #include <stdlib.h>
 
 
+// With -H the native codecs are static inline in the header, and format
+// into a buffer on the stack rather than with asprintf (3).
+static const options_t *options;
+
+
 static bool write_store_native (const type_t *type, FILE *fh, FILE *fc)
 {
   if (strstr (type->type_name, "float") ||
@@ -15,6 +20,23 @@ static bool write_store_native (const type_t *type, FILE *fh, FILE *fc)
   }
 
   char *utype = make_cname (type->type_name);
+  bool unsign = strstr (type->type_name, "unsigned");
+
+  if (options->inline_natives)
+  {
+    fprintf (fh,
+      "static inline bool cser_xml_store_%s (const %s *val, void *ctx)\n"
+      "{\n"
+      "  char str[24];\n"
+      "  snprintf (str, sizeof (str), \"%%ll%s\", (%s long long)*val);\n"
+      "  return cser_xml_setvalue (str, ctx);\n"
+      "}\n",
+      utype, type->type_name,
+      unsign ? "u" : "d", unsign ? "unsigned" : ""
+      );
+    free (utype);
+    return !ferror (fh);
+  }
 
   fprintf (fh,
     "bool cser_xml_store_%s (const %s *val, void *ctx);\n",
@@ -26,7 +48,6 @@ static bool write_store_native (const type_t *type, FILE *fh, FILE *fc)
     utype, type->type_name
     );
 
-  bool unsign = strstr (type->type_name, "unsigned");
   fprintf (fc,
     "  char *str;\n"
     "  if (asprintf (&str, \"%%ll%s\", (%s long long)*val) < 0)\n"
@@ -55,6 +76,27 @@ static bool write_load_native (const type_t *type, FILE *fh, FILE *fc)
   }
 
   char *utype = make_cname (type->type_name);
+  if (options->inline_natives)
+  {
+    fprintf (fh,
+      "static inline bool cser_xml_load_%s (%s *val, void *ctx)\n"
+      "{\n"
+      "  char *str = cser_xml_getvalue (ctx);\n"
+      "  if (!str)\n"
+      "    return false;\n"
+      "  %s tmp = (%s)strto%sll (str, 0, 0);\n"
+      "  free (str);\n"
+      "  *val = tmp;\n"
+      "  return true;\n"
+      "}\n",
+      utype, type->type_name,
+      type->type_name, type->type_name,
+        strstr (type->type_name, "unsigned") ? "u" : ""
+      );
+    free (utype);
+    return !ferror (fh);
+  }
+
   fprintf (fh,
     "bool cser_xml_load_%s (%s *val, void *ctx);\n",
     utype, type->type_name
@@ -129,9 +171,9 @@ static void write_store_member_item (const member_t *m, FILE *fc)
         "      return false;\n", fc);
 
     fprintf (fc,
-      "    if (has_value && !cser_xml_store_%s (%sval->%s%s, ctx))\n"
+      "    if (has_value && !cser_xml_store_%s ((const %s *)%sval->%s%s, ctx))\n"
       "      return false;\n",
-      utype, item_is_ptr ? "" : "&", m->member_name, use_idx ? "[i]" : ""
+      utype, m->base_type, item_is_ptr ? "" : "&", m->member_name, use_idx ? "[i]" : ""
       );
 
     if (m->opts.cardinality != CDN_SINGLE)
@@ -157,7 +199,7 @@ static void write_store_begin (const char *name, bool maybe_null, FILE *fc)
 }
 
 
-static bool write_store_struct (const type_t *type, FILE *fh, FILE *fc)
+static bool write_store_struct (const type_t *type, bool stats, FILE *fh, FILE *fc)
 {
   char *utype = make_cname (type->type_name);
   fprintf (fh,
@@ -165,13 +207,28 @@ static bool write_store_struct (const type_t *type, FILE *fh, FILE *fc)
     utype, type->type_name
     );
   fprintf (fc,
-    "bool cser_xml_store_%s (const %s *val, void *ctx)\n{\n",
-    utype, type->type_name
+    "%sbool cser_xml_store_%s%s (const %s *val, void *ctx)\n{\n",
+    stats ? "static " : "", utype, stats ? "_uncounted" : "", type->type_name
     );
   free (utype);
 
+  const member_t *link = list_link (type);
+  if (link)
+    fputs (
+      "  size_t depth = 0;\n"
+      "  for (;;)\n"
+      "  {\n", fc);
+
   for (member_t *m = type->composite; m; m = m->next)
   {
+    if (m == link)
+      break;
+    if (m->opts.shared)
+    {
+      fprintf (stderr, "error: backend_xml does not support shared member '%s' of '%s'\n",
+        m->member_name, type->type_name);
+      return false;
+    }
     switch (m->opts.cardinality)
     {
       case CDN_VAR_ARRAY:
@@ -188,8 +245,9 @@ static bool write_store_struct (const type_t *type, FILE *fh, FILE *fc)
           write_store_member_item (m, fc);
         else
         {
+          // The terminator is stored too, which is what ends the load
           fprintf (fc,
-            "  for (size_t i = 0; val->%s && val->%s[i]; ++i)\n",
+            "  for (size_t i = 0; val->%s && (i == 0 || val->%s[i - 1]); ++i)\n",
             m->member_name, m->member_name
             );
           write_store_member_item (m, fc);
@@ -215,6 +273,25 @@ static bool write_store_struct (const type_t *type, FILE *fh, FILE *fc)
       );
   }
 
+  // Lists are walked rather than recursed into, to keep stack use constant.
+  // The tags of the list items nest, so they can only be closed at the end.
+  if (link)
+  {
+    write_store_begin (link->member_name, true, fc);
+    fprintf (fc,
+      "  ++depth;\n"
+      "  if (!val->%s)\n"
+      "    break;\n"
+      "  val = val->%s;\n"
+      "  }\n"
+      "  while (depth--)\n"
+      "    if (!cser_xml_closetag (\"%s\", ctx))\n"
+      "      return false;\n\n",
+      link->member_name,
+      link->member_name,
+      link->member_name);
+  }
+
   fputs ("  return true;\n}\n\n", fc);
 
   return true;
@@ -237,9 +314,26 @@ static void write_load_member_item (const member_t *m, FILE *fc)
       m->member_name, use_idx ? "[i]" : ""
       );
 
+  // Strings come from the glue as heap memory; only copy them when a
+  // different allocator is in use.
   if (is_string (m))
     fprintf (fc,
-      "    val->%s = tag.has_value ? cser_xml_getvalue (ctx) : 0;\n",
+      "  {\n"
+      "    char *str = tag.has_value ? cser_xml_getvalue (ctx) : 0;\n"
+      "    const cser_alloc_t *alloc = cser_xml_allocator (ctx);\n"
+      "    if (str && alloc)\n"
+      "    {\n"
+      "      size_t len = strlen (str) + 1;\n"
+      "      char *copy = cser_alloc (alloc, len, 1);\n"
+      "      if (copy)\n"
+      "        memcpy (copy, str, len);\n"
+      "      free (str);\n"
+      "      if (!copy)\n"
+      "        return false;\n"
+      "      str = copy;\n"
+      "    }\n"
+      "    val->%s = str;\n"
+      "  }\n",
       m->member_name
       );
   else
@@ -247,16 +341,21 @@ static void write_load_member_item (const member_t *m, FILE *fc)
     bool needs_alloc = (m->opts.is_ptr && fixed_size);
     if (needs_alloc)
     {
+      // Only tmpval itself is released on failure; anything the item
+      // allocated is left behind unless the allocator is an arena.
       fprintf (fc,
-        "    %s *tmpval = (%s *)calloc (1, sizeof (%s));\n"
+        "    %s *tmpval = (%s *)cser_alloc (cser_xml_allocator (ctx), 1, sizeof (%s));\n"
+        "    if (!tmpval)\n"
+        "      return false;\n"
         "    if (!cser_xml_load_%s (tmpval, ctx))\n"
         "    {\n"
-        "      free (tmpval);\n" // FIXME: needs to be a deep-free
+        "      cser_free (cser_xml_allocator (ctx), tmpval, sizeof (%s));\n" // FIXME: needs to be a deep-free
         "      return false;\n"
         "    }\n"
         "    val->%s%s = tmpval;\n",
         m->base_type, m->base_type, m->base_type,
         utype,
+        m->base_type,
         m->member_name, use_idx ? "[i]" : ""
         );
     }
@@ -273,7 +372,7 @@ static void write_load_member_item (const member_t *m, FILE *fc)
 }
 
 
-static bool write_load_struct (const type_t *type, FILE *fh, FILE *fc)
+static bool write_load_struct (const type_t *type, bool stats, FILE *fh, FILE *fc)
 {
   char *utype = make_cname (type->type_name);
   fprintf (fh,
@@ -281,15 +380,23 @@ static bool write_load_struct (const type_t *type, FILE *fh, FILE *fc)
     utype, type->type_name
     );
   fprintf (fc,
-    "bool cser_xml_load_%s (%s *val, void *ctx)\n"
+    "%sbool cser_xml_load_%s%s (%s *val, void *ctx)\n"
     "{\n"
     "  cser_xml_tag_t tag;\n",
-    utype, type->type_name
+    stats ? "static " : "", utype, stats ? "_uncounted" : "", type->type_name
     );
   free (utype);
 
+  const member_t *link = list_link (type);
+  if (link)
+    fputs (
+      "  for (;;)\n"
+      "  {\n", fc);
+
   for (member_t *m = type->composite; m; m = m->next)
   {
+    if (m == link)
+      break;
     utype = make_cname (type->type_name);
     fprintf (fc,
       "  if (!cser_xml_nexttag (&tag, ctx))\n"
@@ -303,15 +410,23 @@ static bool write_load_struct (const type_t *type, FILE *fh, FILE *fc)
     {
       case CDN_VAR_ARRAY:
         fprintf (fc,
-          "  val->%s = (%s *)calloc (val->%s, sizeof (%s));\n"
+          "  val->%s = (%s *)cser_alloc (cser_xml_allocator (ctx), val->%s, sizeof (%s));\n"
+          "  if (!val->%s && val->%s)\n"
+          "    return false;\n"
           "  for (size_t i = 0; i < (val->%s); ++i)\n"
           "  {\n"
-          "    if (!cser_xml_nexttag (&tag, ctx))\n"
-          "      return false;\n" // FIXME: need to deep-free val->%s here
-          "    if (strcmp (\"i\", tag.name) != 0)\n"
-          "      return false;\n" // FIXME: ... and here
+          "    if (!cser_xml_nexttag (&tag, ctx) ||\n"
+          "        strcmp (\"i\", tag.name) != 0)\n"
+          "    {\n"
+          "      cser_free (cser_xml_allocator (ctx), val->%s, val->%s * sizeof (%s));\n" // FIXME: needs to deep-free items 0..i-1 first
+          "      val->%s = 0;\n"
+          "      return false;\n"
+          "    }\n"
           , m->member_name, m->base_type, m->opts.variable_array_size_member, m->base_type
+          , m->member_name, m->opts.variable_array_size_member
           , m->opts.variable_array_size_member
+          , m->member_name, m->opts.variable_array_size_member, m->base_type
+          , m->member_name
           );
         write_load_member_item (m, fc);
         fputs ("  }\n", fc);
@@ -322,7 +437,7 @@ static bool write_load_struct (const type_t *type, FILE *fh, FILE *fc)
             "  {\n"
             "  val->%s = 0;\n"
             "  size_t n = 0;\n"
-            "  for (size_t i = 0; tag.has_value; ++i)\n"
+            "  for (size_t i = 0; tag.has_value && (i == 0 || val->%s[i - 1]); ++i)\n"
             "  {\n"
             "    if (!cser_xml_nexttag (&tag, ctx))\n"
             "      return false;\n"
@@ -330,18 +445,19 @@ static bool write_load_struct (const type_t *type, FILE *fh, FILE *fc)
             "      return false;\n"
             "    if (i >= n)\n"
             "    {\n"
-            "      if (n == 0)\n"
-            "        n = 2 * sizeof (%s);\n"
-            "      val->%s = (%s *)realloc (val->%s, n *= 2);\n"
-            "      if (!val->%s)\n"
+            "      size_t was = n;\n"
+            "      n = n ? 2 * n : 16;\n"
+            "      %s *grown = (%s *)cser_realloc (cser_xml_allocator (ctx), val->%s, was, n, sizeof (%s));\n"
+            "      if (!grown)\n"
             "        return false;\n"
-            "      memset (((char *)val->%s) + n/2, n/2, 0);\n"
+            "      val->%s = grown;\n"
+            "      memset (val->%s + i, 0, (n - i) * sizeof (%s));\n"
             "    }\n"
             , m->member_name
-            , m->base_type
-            , m->member_name, m->base_type, m->member_name
             , m->member_name
+            , m->base_type, m->base_type, m->member_name, m->base_type
             , m->member_name
+            , m->member_name, m->base_type
             );
         write_load_member_item (m, fc);
         if (!is_string (m))
@@ -367,14 +483,100 @@ static bool write_load_struct (const type_t *type, FILE *fh, FILE *fc)
     }
   }
 
+  // Each new list item is appended at the tail, and then loaded in turn
+  if (link)
+    fprintf (fc,
+      "  if (!cser_xml_nexttag (&tag, ctx))\n"
+      "    return false;\n"
+      "  if (strcmp (tag.name, \"%s\") != 0)\n"
+      "    return false;\n"
+      "  if (!tag.has_value)\n"
+      "  {\n"
+      "    val->%s = 0;\n"
+      "    break;\n"
+      "  }\n"
+      "  %s *item = (%s *)cser_alloc (cser_xml_allocator (ctx), 1, sizeof (%s));\n"
+      "  if (!item)\n"
+      "    return false;\n"
+      "  val->%s = item;\n"
+      "  val = item;\n"
+      "  }\n",
+      link->member_name,
+      link->member_name,
+      type->type_name, type->type_name, type->type_name,
+      link->member_name);
+
   fputs ("  return true;\n}\n\n", fc);
 
   return true;
 }
 
 
-bool backend_xml (const type_list_t *types, const alias_list_t *aliases, FILE *fh, FILE *fc)
+// With -I the struct functions above are emitted as static _uncounted ones,
+// and the public names count into cser_xml_stats_<type> around them. The
+// glue hides the bytes and allocations, so only calls, errors and ticks
+// are counted, and nested structs count as calls of their own.
+static void write_counted (const type_t *type, const char *op, const char *cnst, FILE *fc)
+{
+  char *utype = make_cname (type->type_name);
+  fprintf (fc,
+    "bool cser_xml_%s_%s (%s%s *val, void *ctx)\n"
+    "{\n"
+    "  cser_stats_call_t call;\n"
+    "  cser_stats_enter (&call, &cser_xml_stats_%s.%s);\n"
+    "  bool ok = cser_xml_%s_%s_uncounted (val, ctx);\n"
+    "  cser_stats_leave (&call, ok ? 0 : -1);\n"
+    "  return ok;\n"
+    "}\n\n",
+    op, utype, cnst, type->type_name,
+    utype, op,
+    op, utype);
+  free (utype);
+}
+
+
+static void write_stats (const type_t *type, FILE *fh, FILE *fc)
 {
+  char *utype = make_cname (type->type_name);
+  fprintf (fh, "extern cser_stats_t cser_xml_stats_%s;\n", utype);
+  fprintf (fc,
+    "cser_stats_t cser_xml_stats_%s = { .backend = \"xml\", .type = \"%s\" };\n\n",
+    utype, type->type_name);
+  free (utype);
+}
+
+
+// With -H, equivalent native spellings forward to the canonical one, see
+// native_canonical ().
+static bool write_native_spelling (const type_list_t *types, const type_list_t *t, FILE *fh, FILE *fc)
+{
+  const type_t *canonical = lookup_type (native_canonical (t->def.type_name));
+  if (is_first_spelling (types, t) &&
+      (!write_store_native (canonical, fh, fc) ||
+       !write_load_native (canonical, fh, fc)))
+    return false;
+  if (strcmp (canonical->type_name, t->def.type_name) == 0)
+    return true;
+
+  char *utype = make_cname (t->def.type_name);
+  char *ucanon = make_cname (canonical->type_name);
+  fprintf (fh,
+    "static inline bool cser_xml_store_%s (const %s *val, void *ctx)\n"
+    "{ return cser_xml_store_%s (val, ctx); }\n"
+    "static inline bool cser_xml_load_%s (%s *val, void *ctx)\n"
+    "{ return cser_xml_load_%s (val, ctx); }\n",
+    utype, t->def.type_name, ucanon,
+    utype, t->def.type_name, ucanon);
+  free (ucanon);
+  free (utype);
+  return !ferror (fh);
+}
+
+
+bool backend_xml (const type_list_t *types, const alias_list_t *aliases, const options_t *opts, FILE *fh, FILE *fc)
+{
+  options = opts;
+
   fputs (
 "\n\n/* cser xml backend */\n"
 "#include <stdbool.h>\n"
@@ -394,23 +596,38 @@ bool backend_xml (const type_list_t *types, const alias_list_t *aliases, FILE *f
 "extern bool cser_xml_closetag (const char *tagname, void *ctx);\n\n"
 "extern bool cser_xml_nexttag (cser_xml_tag_t *tag, void *ctx);\n"
 "extern char *cser_xml_getvalue (void *ctx);\n"
+"// Allocator for loaded data, or null for the C library heap\n"
+"extern const cser_alloc_t *cser_xml_allocator (void *ctx);\n"
 "// end glue prototypes\n"
 "\n"
 , fh);
 
+  for (const type_list_t *t = types; t && options->inline_natives; t = t->next)
+    if (t->def.csfn == TYPE_NATIVE && !write_native_spelling (types, t, fh, fc))
+      return false;
+
   for (; types; types = types->next)
   {
     if (types->def.csfn == TYPE_NATIVE)
     {
-      if (!write_store_native (&types->def, fh, fc) ||
-          !write_load_native (&types->def, fh, fc))
+      if (!options->inline_natives &&
+          (!write_store_native (&types->def, fh, fc) ||
+           !write_load_native (&types->def, fh, fc)))
         return false;
     }
     else
     {
-      if (!write_store_struct (&types->def, fh, fc) ||
-          !write_load_struct (&types->def, fh, fc))
+      bool stats = opts->instrument;
+      if (stats)
+        write_stats (&types->def, fh, fc);
+      if (!write_store_struct (&types->def, stats, fh, fc) ||
+          !write_load_struct (&types->def, stats, fh, fc))
         return false;
+      if (stats)
+      {
+        write_counted (&types->def, "store", "const ", fc);
+        write_counted (&types->def, "load", "", fc);
+      }
     }
   }
 
@@ -6,6 +6,6 @@
 #include "model.h"
 #include <stdio.h>
 
-bool backend_xml (const type_list_t *types, const alias_list_t *aliases, FILE *fh, FILE *fc);
+bool backend_xml (const type_list_t *types, const alias_list_t *aliases, const options_t *opts, FILE *fh, FILE *fc);
 
 #endif
@@ -318,12 +318,17 @@ struct_declaration_list
 
 struct_declaration
     : specifier_qualifier_list ';'  {set_type($1);} /* for anonymous struct/union */
-    | specifier_qualifier_list pragma ';'  {set_type($1); handle_pragma($2);} /* for anonymous struct/union */
+    | specifier_qualifier_list member_pragmas ';'  {set_type($1);} /* for anonymous struct/union */
     | specifier_qualifier_list struct_declarator_list ';' {set_type($1);}
-    | specifier_qualifier_list struct_declarator_list pragma ';' {set_type($1); handle_pragma($3);}
+    | specifier_qualifier_list struct_declarator_list member_pragmas ';' {set_type($1);}
     | static_assert_declaration
     ;
 
+member_pragmas
+    : pragma {handle_pragma($1);}
+    | member_pragmas pragma {handle_pragma($2);}
+    ;
+
 specifier_qualifier_list
     : type_specifier specifier_qualifier_list {MKVAL("%s %s",$1,$2); $$=s;}
     | type_specifier
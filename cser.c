@@ -5,6 +5,8 @@
 #include "c11_parser.h"
 #include "backend_raw.h"
 #include "backend_xml.h"
+#include "backend_image.h"
+#include "backend_bench.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,6 +19,8 @@ static alias_list_t *aliases;
 
 static int verbose;
 
+static options_t opts;
+
 static void print_decs (const decorations_t *d)
 {
   for (size_t i = 0; i < d->is_ptr; ++i)
@@ -96,6 +100,95 @@ const type_t *lookup_type (const char *type_name)
 }
 
 
+// A composite type forms a single-linked list if its last member points
+// back to the type itself. Backends (de)serialize such lists iteratively.
+const member_t *list_link (const type_t *t)
+{
+  if (t->csfn != TYPE_COMPOSITE || !t->composite)
+    return 0;
+  const member_t *m = t->composite;
+  while (m->next)
+    m = m->next;
+  if (m->opts.is_ptr == 1 &&
+      m->opts.cardinality == CDN_SINGLE &&
+      !m->opts.shared &&
+      lookup_type (m->base_type) == t)
+    return m;
+  return 0;
+}
+
+
+// FNV-1a, folded over the parts of a type's model which decide how it is
+// serialized. Types already being hashed further up (i.e. recursive ones)
+// contribute only their name. Structs using the tagged encoding describe
+// themselves on the wire, so any one of them can load what another stored,
+// and they all hash the same.
+uint64_t fingerprint_bytes (uint64_t h, const void *p, size_t n)
+{
+  const uint8_t *b = p;
+  for (size_t i = 0; i < n; ++i)
+    h = (h ^ b[i]) * 0x100000001b3ull;
+  return h;
+}
+
+
+static uint64_t fingerprint_str (uint64_t h, const char *s)
+{
+  return fingerprint_bytes (h, s ? s : "", s ? strlen (s) + 1 : 1);
+}
+
+
+static bool fingerprint_tagged (const type_t *t)
+{
+  if (opts.tagged)
+    return true;
+  for (const member_t *m = t->composite; m; m = m->next)
+    if (m->opts.field_id)
+      return true;
+  return false;
+}
+
+
+static uint64_t fingerprint_type (uint64_t h, const type_t *t, const type_t **stack, unsigned depth)
+{
+  if (t->csfn == TYPE_COMPOSITE && fingerprint_tagged (t))
+    return fingerprint_str (h, "tagged");
+  h = fingerprint_str (h, t->type_name);
+  if (t->csfn != TYPE_COMPOSITE)
+    return h;
+  for (unsigned i = 0; i < depth; ++i)
+    if (stack[i] == t)
+      return fingerprint_str (h, "^");
+  if (depth == 64)
+    return fingerprint_str (h, "...");
+  stack[depth] = t;
+  h = fingerprint_str (h, "{");
+  for (const member_t *m = t->composite; m; m = m->next)
+  {
+    uint8_t deco[] = {
+      (uint8_t)m->opts.is_ptr, (uint8_t)m->opts.cardinality,
+      m->opts.varint, m->opts.shared, m->opts.shuffle, m->opts.index
+    };
+    h = fingerprint_str (h, m->member_name);
+    h = fingerprint_bytes (h, deco, sizeof (deco));
+    h = fingerprint_str (h, m->opts.arr_sz);
+    h = fingerprint_str (h, m->opts.variable_array_size_member);
+    const type_t *mt = lookup_type (m->base_type);
+    h = mt ?
+      fingerprint_type (h, mt, stack, depth + 1) :
+      fingerprint_str (h, m->base_type);
+  }
+  return fingerprint_str (h, "}");
+}
+
+
+uint64_t type_fingerprint (const type_t *t)
+{
+  const type_t *stack[64];
+  return fingerprint_type (0xcbf29ce484222325ull, t, stack, 0);
+}
+
+
 char *make_cname (const char *name)
 {
   char *underscored = strdup (name);
@@ -155,6 +248,51 @@ static void init_builtin_types (void)
 }
 
 
+// Native types have several spellings each, e.g. long, long int and
+// signed long int. Returns the one which -H implements them all under
+// (itself a builtin), or the type name if it has no other spellings.
+const char *native_canonical (const char *type_name)
+{
+  static const char *const spellings[][2] =
+  {
+    { "signed short",           "short" },
+    { "short int",              "short" },
+    { "signed short int",       "short" },
+    { "short signed int",       "short" },
+    { "unsigned short int",     "unsigned short" },
+    { "short unsigned int",     "unsigned short" },
+    { "signed",                 "int" },
+    { "signed int",             "int" },
+    { "unsigned",               "unsigned int" },
+    { "signed long",            "long" },
+    { "long int",               "long" },
+    { "signed long int",        "long" },
+    { "long signed int",        "long" },
+    { "unsigned long int",      "unsigned long" },
+    { "long unsigned int",      "unsigned long" },
+    { "long long int",          "long long" },
+    { "signed long long int",   "long long" },
+  };
+  for (size_t i = 0; i < sizeof (spellings) / sizeof (spellings[0]); ++i)
+    if (strcmp (type_name, spellings[i][0]) == 0)
+      return spellings[i][1];
+  return type_name;
+}
+
+
+// Whether t is the first native type in the list to have its canonical
+// spelling, i.e. the one to emit the shared implementation with.
+bool is_first_spelling (const type_list_t *types, const type_list_t *t)
+{
+  const char *canonical = native_canonical (t->def.type_name);
+  for (; types && types != t; types = types->next)
+    if (types->def.csfn == TYPE_NATIVE &&
+        strcmp (native_canonical (types->def.type_name), canonical) == 0)
+      return false;
+  return true;
+}
+
+
 static void mark_used (const char *type_name)
 {
   for (type_list_t *t = types; t; t = t->next)
@@ -208,21 +346,362 @@ typedef struct include_list
 } include_list_t;
 
 
+// Allocator support shared by all backends. It is emitted ahead of the
+// backend output, so that it is only defined once per header.
+static void write_alloc_support (FILE *fh)
+{
+  fputs (
+"\n"
+"#include <stdbool.h>\n"
+"#include <stddef.h>\n"
+"#include <stdint.h>\n"
+"#include <stdlib.h>\n"
+"#include <string.h>\n"
+"\n"
+"/* Allocator used by the generated loaders for all pointer members,     */\n"
+"/* arrays and strings. Memory from zalloc must be zeroed. The old size   */\n"
+"/* is passed to resize and release so that the allocator need not track */\n"
+"/* it. A null allocator selects calloc/realloc/free.                     */\n"
+"typedef struct cser_alloc\n"
+"{\n"
+"  void *(*zalloc) (size_t size, void *ctx);\n"
+"  void *(*resize) (void *ptr, size_t old_size, size_t size, void *ctx);\n"
+"  void (*release) (void *ptr, size_t size, void *ctx);\n"
+"  void *ctx;\n"
+"} cser_alloc_t;\n"
+"\n"
+"static inline void *cser_alloc (const cser_alloc_t *a, size_t n, size_t size)\n"
+"{\n"
+"  if (size && n > SIZE_MAX / size)\n"
+"    return 0;\n"
+"  return a ? a->zalloc (n * size, a->ctx) : calloc (n, size);\n"
+"}\n"
+"\n"
+"static inline void *cser_realloc (const cser_alloc_t *a, void *ptr, size_t old_n, size_t n, size_t size)\n"
+"{\n"
+"  if (size && n > SIZE_MAX / size)\n"
+"    return 0;\n"
+"  return a ? a->resize (ptr, old_n * size, n * size, a->ctx) : realloc (ptr, n * size);\n"
+"}\n"
+"\n"
+"static inline void cser_free (const cser_alloc_t *a, void *ptr, size_t size)\n"
+"{\n"
+"  if (a)\n"
+"    a->release (ptr, size, a->ctx);\n"
+"  else\n"
+"    free (ptr);\n"
+"}\n"
+"\n"
+"/* Bump pointer arena. Everything loaded through cser_arena_allocator () */\n"
+"/* lives in a few large blocks, which cser_arena_destroy () hands back   */\n"
+"/* in one go. This also covers whatever a failed load left behind.      */\n"
+"#ifndef CSER_ARENA_BLOCKSZ\n"
+"# define CSER_ARENA_BLOCKSZ 65536\n"
+"#endif\n"
+"#ifndef CSER_ARENA_ALIGN\n"
+"# define CSER_ARENA_ALIGN 16\n"
+"#endif\n"
+"#define CSER_ARENA_ROUND(n) (((n) + CSER_ARENA_ALIGN - 1) & ~(size_t)(CSER_ARENA_ALIGN - 1))\n"
+"typedef struct cser_arena_block\n"
+"{\n"
+"  struct cser_arena_block *next;\n"
+"  size_t used;\n"
+"  size_t size;\n"
+"} cser_arena_block_t;\n"
+"\n"
+"typedef struct cser_arena\n"
+"{\n"
+"  cser_arena_block_t *head;\n"
+"  size_t block_size;\n"
+"} cser_arena_t;\n"
+"\n"
+"static inline uint8_t *cser_arena_data (cser_arena_block_t *blk)\n"
+"{\n"
+"  return (uint8_t *)blk + CSER_ARENA_ROUND (sizeof (*blk));\n"
+"}\n"
+"\n"
+"static inline void cser_arena_init (cser_arena_t *a, size_t block_size)\n"
+"{\n"
+"  a->head = 0;\n"
+"  a->block_size = block_size ? block_size : CSER_ARENA_BLOCKSZ;\n"
+"}\n"
+"\n"
+"static inline void cser_arena_destroy (cser_arena_t *a)\n"
+"{\n"
+"  while (a->head)\n"
+"  {\n"
+"    cser_arena_block_t *next = a->head->next;\n"
+"    free (a->head);\n"
+"    a->head = next;\n"
+"  }\n"
+"}\n"
+"\n"
+"static inline void *cser_arena_zalloc (size_t size, void *ctx)\n"
+"{\n"
+"  cser_arena_t *a = ctx;\n"
+"  if (size > SIZE_MAX - CSER_ARENA_ALIGN)\n"
+"    return 0; /* would wrap when rounded */\n"
+"  size = CSER_ARENA_ROUND (size ? size : 1);\n"
+"  cser_arena_block_t *blk = a->head;\n"
+"  if (!blk || blk->size - blk->used < size)\n"
+"  {\n"
+"    /* oversized requests get a block of their own, behind the current one */\n"
+"    size_t want = size > a->block_size ? size : a->block_size;\n"
+"    if (want > SIZE_MAX - CSER_ARENA_ROUND (sizeof (*blk)))\n"
+"      return 0;\n"
+"    blk = malloc (CSER_ARENA_ROUND (sizeof (*blk)) + want);\n"
+"    if (!blk)\n"
+"      return 0;\n"
+"    blk->used = 0;\n"
+"    blk->size = want;\n"
+"    if (a->head && size > a->block_size)\n"
+"    {\n"
+"      blk->next = a->head->next;\n"
+"      a->head->next = blk;\n"
+"    }\n"
+"    else\n"
+"    {\n"
+"      blk->next = a->head;\n"
+"      a->head = blk;\n"
+"    }\n"
+"  }\n"
+"  void *ptr = cser_arena_data (blk) + blk->used;\n"
+"  blk->used += size;\n"
+"  return memset (ptr, 0, size);\n"
+"}\n"
+"\n"
+"/* Only the most recent allocation can grow or shrink in place */\n"
+"static inline bool cser_arena_is_last (cser_arena_t *a, void *ptr, size_t size)\n"
+"{\n"
+"  cser_arena_block_t *blk = a->head;\n"
+"  if (size > SIZE_MAX - CSER_ARENA_ALIGN)\n"
+"    return false;\n"
+"  size = CSER_ARENA_ROUND (size ? size : 1);\n"
+"  return ptr && blk && blk->used >= size &&\n"
+"    (uint8_t *)ptr == cser_arena_data (blk) + blk->used - size;\n"
+"}\n"
+"\n"
+"static inline void *cser_arena_resize (void *ptr, size_t old_size, size_t size, void *ctx)\n"
+"{\n"
+"  cser_arena_t *a = ctx;\n"
+"  if (size > SIZE_MAX - CSER_ARENA_ALIGN)\n"
+"    return 0;\n"
+"  if (cser_arena_is_last (a, ptr, old_size))\n"
+"  {\n"
+"    cser_arena_block_t *blk = a->head;\n"
+"    size_t base = blk->used - CSER_ARENA_ROUND (old_size ? old_size : 1);\n"
+"    if (blk->size - base >= CSER_ARENA_ROUND (size ? size : 1))\n"
+"    {\n"
+"      blk->used = base + CSER_ARENA_ROUND (size ? size : 1);\n"
+"      return ptr;\n"
+"    }\n"
+"  }\n"
+"  void *grown = cser_arena_zalloc (size, a);\n"
+"  if (grown && ptr)\n"
+"    memcpy (grown, ptr, old_size < size ? old_size : size);\n"
+"  return grown;\n"
+"}\n"
+"\n"
+"static inline void cser_arena_release (void *ptr, size_t size, void *ctx)\n"
+"{\n"
+"  cser_arena_t *a = ctx;\n"
+"  if (cser_arena_is_last (a, ptr, size))\n"
+"    a->head->used -= CSER_ARENA_ROUND (size ? size : 1);\n"
+"}\n"
+"\n"
+"static inline cser_alloc_t cser_arena_allocator (cser_arena_t *a)\n"
+"{\n"
+"  const cser_alloc_t alloc =\n"
+"    { cser_arena_zalloc, cser_arena_resize, cser_arena_release, a };\n"
+"  return alloc;\n"
+"}\n"
+"\n"
+, fh);
+}
+
+
+// Per type counters for -I, shared by all backends. Each backend defines a
+// cser_<backend>_stats_<type> for every struct, and its entry points fold
+// what a call did into it on the way out.
+static void write_stats_support (FILE *fh)
+{
+  fputs (
+"/* Counters of the calls made to the entry points of one backend for one */\n"
+"/* type. Ticks are only counted with CSER_STATS_TICKS defined, and are   */\n"
+"/* then TSC cycles on x86, or nanoseconds elsewhere.                     */\n"
+"typedef struct cser_stats_op\n"
+"{\n"
+"  uint64_t calls;\n"
+"  uint64_t errors;\n"
+"  uint64_t bytes;\n"
+"  uint64_t allocs;\n"
+"  uint64_t ticks;\n"
+"} cser_stats_op_t;\n"
+"\n"
+"typedef struct cser_stats\n"
+"{\n"
+"  const char *backend;\n"
+"  const char *type;\n"
+"  cser_stats_op_t store;\n"
+"  cser_stats_op_t load;\n"
+"} cser_stats_t;\n"
+"\n"
+"/* All counters, terminated by a null pointer */\n"
+"extern cser_stats_t *const cser_stats_registry[];\n"
+"\n"
+"#ifndef CSER_STATS_ADD\n"
+"# ifdef __GNUC__\n"
+"#  define CSER_STATS_ADD(counter, n) __atomic_fetch_add (&(counter), (n), __ATOMIC_RELAXED)\n"
+"# else\n"
+"#  define CSER_STATS_ADD(counter, n) ((counter) += (n))\n"
+"# endif\n"
+"#endif\n"
+"\n"
+"#ifdef CSER_STATS_TICKS\n"
+"# if defined (__x86_64__) || defined (__i386__)\n"
+"#  include <x86intrin.h>\n"
+"static inline uint64_t cser_stats_ticks (void)\n"
+"{\n"
+"  return __rdtsc ();\n"
+"}\n"
+"# else\n"
+"#  include <time.h>\n"
+"static inline uint64_t cser_stats_ticks (void)\n"
+"{\n"
+"  struct timespec ts;\n"
+"  clock_gettime (CLOCK_MONOTONIC, &ts);\n"
+"  return ts.tv_sec * 1000000000ull + ts.tv_nsec;\n"
+"}\n"
+"# endif\n"
+"#else\n"
+"static inline uint64_t cser_stats_ticks (void)\n"
+"{\n"
+"  return 0;\n"
+"}\n"
+"#endif\n"
+"\n"
+"/* What a single call did so far, and the allocator it was given */\n"
+"typedef struct cser_stats_call\n"
+"{\n"
+"  cser_stats_op_t *op;\n"
+"  uint64_t start;\n"
+"  uint64_t bytes;\n"
+"  uint64_t allocs;\n"
+"  const cser_alloc_t *alloc;\n"
+"  cser_alloc_t counted;\n"
+"} cser_stats_call_t;\n"
+"\n"
+"static inline void cser_stats_enter (cser_stats_call_t *c, cser_stats_op_t *op)\n"
+"{\n"
+"  c->op = op;\n"
+"  c->bytes = 0;\n"
+"  c->allocs = 0;\n"
+"  c->alloc = 0;\n"
+"  c->start = cser_stats_ticks ();\n"
+"}\n"
+"\n"
+"static inline int cser_stats_leave (cser_stats_call_t *c, int ret)\n"
+"{\n"
+"  CSER_STATS_ADD (c->op->calls, 1);\n"
+"  if (ret != 0)\n"
+"    CSER_STATS_ADD (c->op->errors, 1);\n"
+"  CSER_STATS_ADD (c->op->bytes, c->bytes);\n"
+"  CSER_STATS_ADD (c->op->allocs, c->allocs);\n"
+"#ifdef CSER_STATS_TICKS\n"
+"  CSER_STATS_ADD (c->op->ticks, cser_stats_ticks () - c->start);\n"
+"#endif\n"
+"  return ret;\n"
+"}\n"
+"\n"
+"static inline void *cser_stats_zalloc (size_t size, void *ctx)\n"
+"{\n"
+"  cser_stats_call_t *c = ctx;\n"
+"  ++c->allocs;\n"
+"  return cser_alloc (c->alloc, 1, size);\n"
+"}\n"
+"\n"
+"static inline void *cser_stats_resize (void *ptr, size_t old_size, size_t size, void *ctx)\n"
+"{\n"
+"  cser_stats_call_t *c = ctx;\n"
+"  ++c->allocs;\n"
+"  return cser_realloc (c->alloc, ptr, old_size, size, 1);\n"
+"}\n"
+"\n"
+"static inline void cser_stats_release (void *ptr, size_t size, void *ctx)\n"
+"{\n"
+"  cser_stats_call_t *c = ctx;\n"
+"  cser_free (c->alloc, ptr, size);\n"
+"}\n"
+"\n"
+"/* Stands in for the allocator of a call (null for the C library) */\n"
+"static inline const cser_alloc_t *cser_stats_allocator (cser_stats_call_t *c, const cser_alloc_t *alloc)\n"
+"{\n"
+"  const cser_alloc_t counted =\n"
+"    { cser_stats_zalloc, cser_stats_resize, cser_stats_release, c };\n"
+"  c->alloc = alloc;\n"
+"  c->counted = counted;\n"
+"  return &c->counted;\n"
+"}\n"
+"\n"
+, fh);
+}
+
+
+// The registry lists the counters of each backend in turn
+static void write_stats_registry (unsigned backends, FILE *fc)
+{
+  static const struct { unsigned backend; const char *name; } which[] =
+  {
+    { BACKEND_RAW, "raw" },
+    { BACKEND_XML, "xml" },
+    { BACKEND_IMAGE, "image" },
+  };
+
+  fputs ("\ncser_stats_t *const cser_stats_registry[] =\n{\n", fc);
+  for (size_t k = 0; k < sizeof (which) / sizeof (which[0]); ++k)
+  {
+    if (!(backends & which[k].backend))
+      continue;
+    for (const type_list_t *t = types; t; t = t->next)
+    {
+      if (t->def.csfn != TYPE_COMPOSITE)
+        continue;
+      char *utype = make_cname (t->def.type_name);
+      fprintf (fc, "  &cser_%s_stats_%s,\n", which[k].name, utype);
+      free (utype);
+    }
+  }
+  fputs ("  0\n};\n", fc);
+}
+
+
 void syntax (const char *name)
 {
   fprintf (stderr, "cser v%s\n", VERSION);
-  fprintf (stderr, "Syntax: %s [-v] [-o <basename>] [[-b <backend>]...] [[-i <include>]...] <type...>\n", name);
+  fprintf (stderr, "Syntax: %s [-v] [-o <basename>] [-E <order>] [-V] [-L] [-R] [-F] [-Z] [-T] [-P] [-M] [-S] [-D] [-I] [-H] [-B] [[-b <backend>]...] [[-i <include>]...] <type...>\n", name);
   fprintf (stderr, "  available backends:\n");
   fprintf (stderr, "    raw     binary format (default)\n");
   fprintf (stderr, "    xml     XML format\n");
+  fprintf (stderr, "    image   relocatable in-memory image, for use with mmap\n");
   fprintf (stderr, "  files specified with -i are #include'd in the output\n");
+  fprintf (stderr, "  -E selects the raw byte order: big, little or native\n");
+  fprintf (stderr, "  -V uses variable length encoding for all raw integers\n");
+  fprintf (stderr, "  -L length prefixes raw zero-terminated arrays and strings\n");
+  fprintf (stderr, "  -R adds resumable raw functions, for non-blocking I/O\n");
+  fprintf (stderr, "  -F adds raw functions for a framed, checksummed stream\n");
+  fprintf (stderr, "  -Z adds an LZ compression stage for the raw callbacks\n");
+  fprintf (stderr, "  -T uses the tagged raw encoding for all structs\n");
+  fprintf (stderr, "  -P prefixes raw streams with the type fingerprint\n");
+  fprintf (stderr, "  -M (de)serializes large raw arrays on multiple threads\n");
+  fprintf (stderr, "  -S adds raw loads of selected struct members only\n");
+  fprintf (stderr, "  -D adds raw deltas, storing only what changed from a base value\n");
+  fprintf (stderr, "  -I counts calls, bytes and allocations per type in the entry points\n");
+  fprintf (stderr, "  -H canonicalises native type spellings, with their codecs in the header\n");
+  fprintf (stderr, "  -B writes a benchmark program for the types to <basename>_bench.c\n");
   fprintf (stderr, "\n");
   exit (1);
 }
 
-#define BACKEND_RAW  0x01
-#define BACKEND_XML  0x02
-
 int main (int argc, char *argv[])
 {
   init_builtin_types ();
@@ -230,16 +709,29 @@ int main (int argc, char *argv[])
   include_list_t *includes = 0;
   const char *basename = "out";
 
-  int backends = 0;
+  unsigned backends = 0;
+  bool bench = false;
 
   int opt;
-  while ((opt = getopt (argc, argv, "hvo:i:b:")) != -1)
+  while ((opt = getopt (argc, argv, "hvo:i:b:E:VLRFZTPMSDIHB")) != -1)
   {
     switch (opt)
     {
       case 'h': syntax (argv[0]);
-      // -E => load up some extra types and try to parse without preprocessing?
       case 'v': ++verbose; break;
+      case 'V': opts.varint = true; break;
+      case 'L': opts.counted = true; break;
+      case 'R': opts.resumable = true; break;
+      case 'F': opts.framed = true; break;
+      case 'Z': opts.compress = true; break;
+      case 'T': opts.tagged = true; break;
+      case 'P': opts.prefixed = true; break;
+      case 'M': opts.parallel = true; break;
+      case 'S': opts.masked = true; break;
+      case 'D': opts.delta = true; break;
+      case 'I': opts.instrument = true; break;
+      case 'H': opts.inline_natives = true; break;
+      case 'B': bench = true; break;
       case 'o': basename = optarg; break;
       case 'i':
       {
@@ -251,9 +743,16 @@ int main (int argc, char *argv[])
         *i = inc;
         break;
       }
+      case 'E':
+        if (strcmp ("big", optarg) == 0) { opts.byte_order = ORDER_BIG; break; }
+        if (strcmp ("little", optarg) == 0) { opts.byte_order = ORDER_LITTLE; break; }
+        if (strcmp ("native", optarg) == 0) { opts.byte_order = ORDER_NATIVE; break; }
+        syntax (argv[0]);
+        break;
       case 'b':
         if (strcmp ("raw", optarg) == 0) { backends |= BACKEND_RAW; break; }
         if (strcmp ("xml", optarg) == 0) { backends |= BACKEND_XML; break; }
+        if (strcmp ("image", optarg) == 0) { backends |= BACKEND_IMAGE; break; }
         // fall through
       default:
         syntax (argv[0]);
@@ -270,6 +769,7 @@ int main (int argc, char *argv[])
 
 
   // work out which types we need
+  const int first_type = optind;
   while (optind < argc)
   {
     const type_t *t = lookup_type (argv[optind]);
@@ -286,6 +786,11 @@ int main (int argc, char *argv[])
     mark_used (argv[optind++]);
   }
 
+  // With -H the other spellings of a native type forward to this one
+  for (type_list_t *t = types; t && opts.inline_natives; t = t->next)
+    if (t->used && t->def.csfn == TYPE_NATIVE)
+      mark_used (native_canonical (t->def.type_name));
+
   // discard unused types & aliases
   type_list_t **t = &types;
   while (*t)
@@ -313,19 +818,21 @@ int main (int argc, char *argv[])
   }
 
   // start writing the output
-  char *h, *c;
-  if (asprintf(&h, "%s.h", basename) < 0 || asprintf(&c, "%s.c", basename) < 0)
+  char *h, *c, *b = 0;
+  if (asprintf(&h, "%s.h", basename) < 0 || asprintf(&c, "%s.c", basename) < 0 ||
+      (bench && asprintf(&b, "%s_bench.c", basename) < 0))
     return 2;
 
   FILE *fh = fopen (h, "w");
   FILE *fc = fopen (c, "w");
-  if (!fh || !fc)
+  FILE *fb = bench ? fopen (b, "w") : 0;
+  if (!fh || !fc || (bench && !fb))
   {
     perror ("fopen");
     return 3;
   }
 
-  FILE *tmpf[3] = { fh, fc, 0 };
+  FILE *tmpf[4] = { fh, fc, fb, 0 };
   for (size_t i = 0; tmpf[i]; ++i)
   {
     fprintf (tmpf[i],
@@ -354,17 +861,28 @@ int main (int argc, char *argv[])
   if (!backends)
     backends = BACKEND_RAW;
 
+  write_alloc_support (fh);
+  if (opts.instrument)
+    write_stats_support (fh);
+
   // invoke chosen backend(s)
+  bool ok = true;
   if (backends & BACKEND_RAW)
-    backend_raw (types, aliases, fh, fc);
+    ok = backend_raw (types, aliases, &opts, fh, fc) && ok;
   if (backends & BACKEND_XML)
-    backend_xml (types, aliases, fh, fc);
+    ok = backend_xml (types, aliases, &opts, fh, fc) && ok;
+  if (backends & BACKEND_IMAGE)
+    ok = backend_image (types, aliases, &opts, fh, fc) && ok;
+  if (opts.instrument)
+    write_stats_registry (backends, fc);
+  if (bench)
+    ok = backend_bench (types, argv + first_type, argc - first_type, backends, h, fb) && ok;
 
 
   fprintf (fh, "#endif\n");
 
 
-  int ret = 0;
+  int ret = ok ? 0 : 8;
   if (ferror (fh))
   {
     fprintf (stderr, "error: writing to '%s' failed\n", h);
@@ -376,8 +894,16 @@ int main (int argc, char *argv[])
     ret = 7;
   }
 
+  if (fb && ferror (fb))
+  {
+    fprintf (stderr, "error: writing to '%s' failed\n", b);
+    ret = 7;
+  }
+
   fclose (fh);
   fclose (fc);
+  if (fb)
+    fclose (fb);
 
   return ret;
 }
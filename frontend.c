@@ -258,6 +258,12 @@ void capture_member (void)
     }
   }
 
+  m->opts.varint = info->varint;
+  m->opts.shared = info->shared;
+  m->opts.shuffle = info->shuffle;
+  m->opts.index = info->index;
+  m->opts.field_id = info->field_id;
+
   if (info->union_select)
   {
     if (!member_scope->next)
@@ -466,6 +472,22 @@ void handle_pragma (const char *prag)
     info->omit = false;
   else if (strcmp (prag, "select") == 0)
     info->union_select = true;
+  else if (strcmp (prag, "varint") == 0)
+    info->varint = true;
+  else if (strcmp (prag, "shared") == 0)
+    info->shared = true;
+  else if (strcmp (prag, "shuffle") == 0)
+    info->shuffle = true;
+  else if (strcmp (prag, "index") == 0)
+    info->index = true;
+  else if (strncmp (prag, "id:", 3) == 0)
+  {
+    char *end;
+    unsigned long id = strtoul (prag + 3, &end, 10);
+    if (id == 0 || id >= (1ul << 20) || (*end && *end != '"'))
+      yyerror ("field id must be between 1 and 1048575");
+    info->field_id = (unsigned)id;
+  }
   else
     fprintf (stderr, "warning: unrecognised pragma: cser %s\n", prag);
 
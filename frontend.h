@@ -27,6 +27,11 @@ typedef struct parse_info
   char *array_def; // null => default, "0"/"1" -> single/zeroterm, other->vararr
   bool omit;
   bool union_select;
+  bool varint;
+  bool shared;
+  bool shuffle;
+  bool index;
+  unsigned field_id;
 
   struct parse_info *next;
 } parse_info_t;
@@ -53,6 +53,25 @@ typedef struct decorations
   char *variable_array_size_member;
   // TODO: ensure we abort if this member is *after* the array, as we
   // can't necessarily restore it in that case...
+
+  // Use a variable length encoding for integers, where supported
+  bool varint;
+
+  // The pointed-to object may be referenced from elsewhere too (or even
+  // from within itself), so identity is to be preserved
+  bool shared;
+
+  // Store the elements of an integer array member as byte planes (all the
+  // first bytes, then all the second bytes, ...), which compresses better
+  bool shuffle;
+
+  // Precede the elements of a varlen array member with a table of their
+  // offsets, so that single elements can be loaded directly
+  bool index;
+
+  // Field id for the tagged raw encoding, 0 if not given (in which case one
+  // is derived from the member name)
+  unsigned field_id;
 } decorations_t;
 
 
@@ -113,9 +132,49 @@ typedef struct alias_list
 } alias_list_t;
 
 
+// Byte order used by the raw backend on the wire
+typedef enum
+{
+  ORDER_DEFAULT, // big endian, without a stream header
+  ORDER_BIG,
+  ORDER_LITTLE,
+  ORDER_NATIVE,
+} byte_order_t;
+
+
+// Code generation options, as given on the command line
+typedef struct options
+{
+  byte_order_t byte_order;
+  bool varint; // variable length encoding of all integers in the raw backend
+  bool counted; // length prefixed rather than zero terminated raw arrays
+  bool resumable; // raw state machines for non-blocking I/O
+  bool framed; // raw functions for a chunked, checksummed stream
+  bool compress; // raw LZ compression stage
+  bool tagged; // raw members carry field id and length, for all structs
+  bool prefixed; // raw streams start with the type fingerprint
+  bool parallel; // raw arrays of fixed size structs use a thread pool
+  bool masked; // raw loads of selected members only
+  bool delta; // raw deltas against a base value
+  bool instrument; // entry points update per type counters
+  bool inline_natives; // native codecs in the header, once per spelling
+} options_t;
+
+
+// Backends selected on the command line
+#define BACKEND_RAW  0x01
+#define BACKEND_XML  0x02
+#define BACKEND_IMAGE 0x04
+
+
 void add_type (type_list_t *t);
 void add_alias (alias_list_t *a);
 const type_t *lookup_type (const char *type_name);
+const member_t *list_link (const type_t *t);
 char *make_cname (const char *type_name);
+uint64_t fingerprint_bytes (uint64_t h, const void *p, size_t n);
+uint64_t type_fingerprint (const type_t *t);
+const char *native_canonical (const char *type_name);
+bool is_first_spelling (const type_list_t *types, const type_list_t *t);
 
 #endif
@@ -28,6 +28,58 @@ int r (uint8_t *bytes, size_t n, void *q)
   return 0;
 }
 
+int wv (const struct iovec *iov, int iovcnt, void *q)
+{
+  for (int i = 0; i < iovcnt; ++i)
+    if (w (iov[i].iov_base, iov[i].iov_len, q) != 0)
+      return -1;
+  return 0;
+}
+
+// Moves at most three bytes at a time, and would block every other call
+ssize_t nbw (const uint8_t *bytes, size_t n, void *q)
+{
+  static int calls;
+  buf_t *b = q;
+  if (calls++ % 2)
+    return -EAGAIN;
+  if (n > 3)
+    n = 3;
+  if ((b->p + n) >= b->end)
+    return -ENOSPC;
+  memcpy (b->p, bytes, n);
+  b->p += n;
+  return n;
+}
+
+ssize_t nbr (uint8_t *bytes, size_t n, void *q)
+{
+  static int calls;
+  buf_t *b = q;
+  if (calls++ % 2)
+    return -EAGAIN;
+  if (n > 3)
+    n = 3;
+  if ((b->p + n) >= b->end)
+    return 0;
+  memcpy (bytes, b->p, n);
+  b->p += n;
+  return n;
+}
+
+// Reads at most seven bytes at a time
+ssize_t rsome (uint8_t *bytes, size_t n, void *q)
+{
+  buf_t *b = q;
+  if (n > 7)
+    n = 7;
+  if (n > (size_t)(b->end - b->p))
+    n = (size_t)(b->end - b->p);
+  memcpy (bytes, b->p, n);
+  b->p += n;
+  return n;
+}
+
 bool cser_xml_opentag (const cser_xml_tag_t *tag, void *ctx)
 {
   (void)ctx;
@@ -65,18 +117,27 @@ char *cser_xml_getvalue (void *ctx)
   return 0;
 }
 
+const cser_alloc_t *cser_xml_allocator (void *ctx)
+{
+  (void)ctx;
+  return 0;
+}
+
 int main (int argc, char *argv[])
 {
   (void)argc; (void)argv;
 
   int16_t stuff[3] = { 0x9876, 0xf0f0, 0x0000 };
-  const foo f = { 12, "this is a test!", { &stuff[0], &stuff[1], &stuff[2]}, "short string", 0, 0, "omitted" };
+  uint64_t vals[2] = { 0x0123456789abcdefull, 42 };
+  node_t nodes[3] = { { 1, &nodes[1] }, { -2, &nodes[2] }, { 3, 0 } };
+  const foo f = { 12, "this is a test!", { &stuff[0], &stuff[1], &stuff[2]}, "short string", 0, 0, "omitted", { 1, 0xdeadbeef, 3 }, 2, vals, { { 7, { -1, 2 } }, { 8, { 3, -4 } } }, nodes };
   printf ("a: %x\nb: %s\nmc[0]: %hx\nmc[1]: %hx\nmc[2]: %hx\nmd: %s\n",
     f.a, f.b, *f.mc[0], *f.mc[1], *f.mc[2], f.md);
 
-  uint8_t space[256] = { 0 };
+  uint8_t space[512] = { 0 };
   buf_t buf = { space, space + sizeof (space), space };
   printf ("store: %d\n", cser_raw_store_foo (&f, w, &buf));
+  printf ("size: %d\n", cser_raw_size_foo (&f) == (size_t)(buf.p - buf.mem));
 
   FILE *o = fopen ("test.dmp", "w");
   fwrite (buf.mem, buf.end - buf.mem, 1, o);
@@ -89,6 +150,198 @@ int main (int argc, char *argv[])
 
   printf ("a: %x\nb: %s\nmc[0]: %hx\nmc[1]: %hx\nmc[2]: %hx\nmd: %s\n",
     f2.a, f2.b, *f2.mc[0], *f2.mc[1], *f2.mc[2], f2.md);
+  printf ("c: %x %x %x\nvals: %llx %llx\n",
+    f2.c[0], f2.c[1], f2.c[2],
+    (unsigned long long)f2.vals[0], (unsigned long long)f2.vals[1]);
+  printf ("pods: %u %d %d %u %d %d\n",
+    f2.pods[0].id, f2.pods[0].pt[0], f2.pods[0].pt[1],
+    f2.pods[1].id, f2.pods[1].pt[0], f2.pods[1].pt[1]);
+  printf ("list:");
+  for (const node_t *n = f2.list; n; n = n->next)
+    printf (" %d", n->v);
+  printf ("\n");
+
+  buf.p = buf.mem;
+  foo fb;
+  printf ("buffered load: %d", cser_raw_load_buffered_foo (&fb, rsome, &buf, 0));
+  printf (" %s %s %hx %d\n", fb.b, fb.md, *fb.mc[1], fb.list->next->v);
+
+  buf.p = buf.mem;
+
+  cser_arena_t arena;
+  cser_arena_init (&arena, 0);
+  const cser_alloc_t alloc = cser_arena_allocator (&arena);
+  foo f3;
+  printf ("arena load: %d\n", cser_raw_load_alloc_foo (&f3, r, &buf, &alloc));
+  printf ("arena: %s %s %hx %d\n", f3.b, f3.md, *f3.mc[1], f3.list->next->v);
+  printf ("arena huge: %d\n", cser_alloc (&alloc, SIZE_MAX - 3, 1) == 0);
+  cser_arena_destroy (&arena);
+
+  uint8_t space2[512] = { 0 };
+  buf_t buf2 = { space2, space2 + sizeof (space2), space2 };
+  printf ("storev: %d", cser_raw_storev_foo (&f, wv, &buf2));
+  printf (" %d\n", memcmp (space, space2, sizeof (space)) == 0);
+
+  memset (space2, 0, sizeof (space2));
+  buf2.p = buf2.mem;
+  cser_raw_nb_t nb;
+  int ret = cser_raw_nb_store_foo (&nb, &f, nbw, &buf2);
+  while (ret == -EAGAIN)
+    ret = cser_raw_nb_resume (&nb);
+  printf ("nb store: %d %d\n", ret, memcmp (space, space2, sizeof (space)) == 0);
+
+  buf2.p = buf2.mem;
+  foo f5;
+  ret = cser_raw_nb_load_foo (&nb, &f5, nbr, &buf2);
+  while (ret == -EAGAIN)
+    ret = cser_raw_nb_resume (&nb);
+  printf ("nb load: %d %s %s %hx %x %d\n", ret, f5.b, f5.md, *f5.mc[1], f5.c[1], f5.list->next->v);
+
+  memset (space2, 0, sizeof (space2));
+  buf2.p = buf2.mem;
+  printf ("framed store: %d\n", cser_raw_store_framed_foo (&f, w, &buf2));
+  buf2.p = buf2.mem;
+  foo f6;
+  printf ("framed load: %d", cser_raw_load_framed_foo (&f6, r, &buf2));
+  printf (" %s %s %d\n", f6.b, f6.md, f6.list->next->v);
+  buf2.p = buf2.mem;
+  space2[40] ^= 0x10;
+  printf ("framed corrupt: %d\n", cser_raw_load_framed_foo (&f6, r, &buf2) == -EBADMSG);
+
+  static cser_raw_lz_t lz;
+  memset (space2, 0, sizeof (space2));
+  buf2.p = buf2.mem;
+  cser_raw_lz_writer (&lz, w, &buf2);
+  ret = cser_raw_store_foo (&f, cser_raw_lz_write, &lz);
+  if (ret == 0)
+    ret = cser_raw_lz_finish (&lz);
+  printf ("lz store: %d\n", ret);
+  buf2.p = buf2.mem;
+  foo f7;
+  cser_raw_lz_reader (&lz, r, &buf2);
+  printf ("lz load: %d", cser_raw_load_foo (&f7, cser_raw_lz_read, &lz));
+  printf (" %s %s %x %d\n", f7.b, f7.md, f7.c[1], f7.list->next->v);
+
+  rec_v2_t v2 = { 5, 1ull << 40, "tagged" }, v2b;
+  rec_v1_t v1;
+  buf2.p = buf2.mem;
+  printf ("tagged store: %d\n", cser_raw_store_rec_v2_t (&v2, w, &buf2));
+  buf2.p = buf2.mem;
+  printf ("tagged newer: %d", cser_raw_load_rec_v1_t (&v1, r, &buf2));
+  printf (" %u %s\n", v1.a, v1.s);
+  buf2.p = buf2.mem;
+  cser_raw_store_rec_v1_t (&v1, w, &buf2);
+  buf2.p = buf2.mem;
+  printf ("tagged older: %d", cser_raw_load_rec_v2_t (&v2b, r, &buf2));
+  printf (" %u %llu %s\n", v2b.a, (unsigned long long)v2b.added, v2b.s);
+  buf2.p = buf2.mem;
+  cser_raw_store_foo (&f, w, &buf2);
+  buf2.p = buf2.mem;
+  printf ("fingerprint: %d\n", cser_raw_load_rec_v1_t (&v1, r, &buf2) == -EPROTO);
+  buf2.p = buf2.mem;
+  foo f8;
+  uint64_t fields = CSER_RAW_FIELD_BIT (CSER_RAW_FIELD_foo_b) | CSER_RAW_FIELD_BIT (CSER_RAW_FIELD_foo_c);
+  printf ("fields load: %d", cser_raw_load_fields_foo (&f8, fields, r, &buf2, 0));
+  printf (" %s %x %u %d\n", f8.b, f8.c[1], f8.a, f8.list == 0);
+
+  // Applied to the loaded copy, which owns what the replaced members
+  // (including the last node of the list) point to
+  node_t nodes9[2] = { { 1, &nodes9[1] }, { -2, 0 } };
+  foo f9 = f;
+  f9.b = "changed";
+  f9.c[1] = 0xfeedface;
+  f9.list = nodes9;
+  buf2.p = buf2.mem;
+  printf ("delta store: %d", cser_raw_store_delta_foo (&f, &f9, w, &buf2));
+  printf (" %d\n", (int)(buf2.p - buf2.mem));
+  buf2.p = buf2.mem;
+  printf ("delta apply: %d", cser_raw_apply_delta_foo (&f2, r, &buf2, 0));
+  printf (" %s %x %d\n", f2.b, f2.c[1], cser_raw_equal_foo (&f9, &f2));
+
+  // Runs of vals along with a new num, which a valid delta never has
+  uint64_t vals3[2] = { vals[0], 7 };
+  foo f11 = f, f12 = f;
+  f11.vals = vals3;
+  buf2.p = buf2.mem;
+  cser_raw_store_delta_foo (&f, &f11, w, &buf2);
+  const uint8_t bad[] = { 0, 0x03, 100, 1, 50, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+  memcpy (buf2.p - 15, bad, sizeof (bad));
+  buf2.p = buf2.mem;
+  f12.vals = vals3;
+  printf ("delta corrupt: %d\n", cser_raw_apply_delta_foo (&f12, r, &buf2, 0) == -EPROTO);
+
+  static pod_t many[1000], many2[1000];
+  static uint8_t space3[9000];
+  for (int i = 0; i < 1000; ++i)
+  {
+    many[i].id = i * 3;
+    many[i].pt[0] = -i;
+    many[i].pt[1] = i;
+  }
+  pods_t ps = { 1000, many }, ps2;
+  buf_t buf3 = { space3, space3 + sizeof (space3), space3 };
+  printf ("par store: %d\n", cser_raw_store_pods_t (&ps, w, &buf3));
+  buf3.p = buf3.mem;
+  printf ("par load: %d", cser_raw_load_pods_t (&ps2, r, &buf3));
+  memcpy (many2, ps2.pods, sizeof (many2));
+  printf (" %u %d\n", ps2.n, memcmp (many, many2, sizeof (many)) == 0);
+
+  static entry_t entries[100];
+  static char labels[100][8];
+  for (int i = 0; i < 100; ++i)
+  {
+    entries[i].id = i * 7;
+    snprintf (labels[i], sizeof (labels[i]), "e%d", i);
+    entries[i].label = labels[i];
+  }
+  entries[58].label = 0;
+  catalog_t cat = { "catalog", 100, entries }, cat2;
+  buf3.p = buf3.mem;
+  printf ("index store: %d\n", cser_raw_store_catalog_t (&cat, w, &buf3));
+  cser_raw_mem_t stored = { buf3.mem, (size_t)(buf3.p - buf3.mem) };
+  entry_t e;
+  printf ("index at: %d", cser_raw_load_catalog_t_entries_at (&e, 57, cser_raw_pread_mem, &stored, 0));
+  printf (" %u %s", e.id, e.label);
+  printf (" %d", cser_raw_load_catalog_t_entries_at (&e, 100, cser_raw_pread_mem, &stored, 0));
+  memset (&e, 0xa5, sizeof (e));
+  printf (" %d", cser_raw_load_catalog_t_entries_at (&e, 58, cser_raw_pread_mem, &stored, 0));
+  printf (" %d\n", e.label == 0);
+  buf3.p = buf3.mem;
+  printf ("index load: %d", cser_raw_load_catalog_t (&cat2, r, &buf3));
+  printf (" %s %u %s\n", cat2.name, cat2.entries[99].id, cat2.entries[99].label);
+  // Too short for an offset table, so the elements before are passed over
+  catalog_t few = { "few", 3, entries + 55 };
+  buf3.p = buf3.mem;
+  cser_raw_store_catalog_t (&few, w, &buf3);
+  stored.len = (size_t)(buf3.p - buf3.mem);
+  printf ("index short: %d", cser_raw_load_catalog_t_entries_at (&e, 2, cser_raw_pread_mem, &stored, 0));
+  printf (" %u %s\n", e.id, e.label);
+
+  uint8_t bounded[CSER_RAW_MAX_SIZE_pod_t];
+  pod_t pod;
+  size_t blen = cser_raw_store_bounded_pod_t (&f.pods[1], bounded);
+  printf ("bounded: %zu %d", blen, cser_raw_load_bounded_pod_t (&pod, bounded, blen));
+  printf (" %u %d %d\n", pod.id, pod.pt[0], pod.pt[1]);
+
+  size_t isz = cser_image_size_foo (&f);
+  void *img;
+  if (posix_memalign (&img, CSER_IMAGE_ALIGN, isz) != 0)
+    return 1;
+  foo *f4;
+  printf ("image store: %d\n", cser_image_store_foo (&f, img, isz));
+  printf ("image map: %d\n", cser_image_map_foo (img, isz, &f4));
+  printf ("image: %s %s %hx %llx %d\n", f4->b, f4->md, *f4->mc[2],
+    (unsigned long long)f4->vals[0], f4->list->next->next->v);
+  free (img);
+
+  size_t n_stats = 0;
+  while (cser_stats_registry[n_stats])
+    ++n_stats;
+  printf ("stats: %zu %llu %llu %llu", n_stats,
+    (unsigned long long)cser_raw_stats_foo.store.calls,
+    (unsigned long long)cser_raw_stats_foo.load.errors,
+    (unsigned long long)cser_raw_stats_pod_t.load.bytes);
+  printf (" %d\n", cser_image_stats_foo.store.bytes == isz);
 
   printf ("\nxmlstore: %d\n", cser_xml_store_foo (&f, 0));
 
@@ -1,3 +1,18 @@
+typedef struct {
+  uint32_t id;
+  int16_t pt[2];
+} pod_t;
+
+typedef struct node {
+  int32_t v;
+  struct node *next;
+} node_t;
+
+typedef struct {
+  uint32_t n;
+  pod_t *pods _Pragma("cser varlen:n");
+} pods_t;
+
 typedef struct {
   uint32_t a;
   char *b;
@@ -6,5 +21,48 @@ typedef struct {
   unsigned char *us _Pragma("cser zeroterm");
   bool *empty;
   const char *omitted _Pragma("cser omit");
+  uint32_t c[3] _Pragma("cser shuffle");
+  unsigned num _Pragma("cser varint");
+  uint64_t *vals _Pragma("cser varlen:num");
+  pod_t pods[2];
+  node_t *list;
 } foo;
 
+
+typedef struct {
+  uint32_t a _Pragma("cser id:1");
+  char *s _Pragma("cser id:2");
+} rec_v1_t;
+
+typedef struct {
+  uint32_t a _Pragma("cser id:1");
+  uint64_t added _Pragma("cser id:3");
+  char *s _Pragma("cser id:2");
+} rec_v2_t;
+
+typedef struct {
+  uint32_t id;
+  char *label;
+} entry_t;
+
+typedef struct {
+  char *name;
+  uint32_t n;
+  entry_t *entries _Pragma("cser varlen:n") _Pragma("cser index");
+} catalog_t;
+
+typedef struct {
+  uint32_t w;
+} weight_t;
+
+typedef struct gnode {
+  int32_t v;
+  weight_t *w _Pragma("cser shared");
+  struct gnode *left _Pragma("cser shared");
+  struct gnode *right _Pragma("cser shared");
+} gnode_t;
+
+typedef struct {
+  gnode_t *root _Pragma("cser shared");
+  gnode_t *also _Pragma("cser shared");
+} graph_t;